@@ -0,0 +1,266 @@
+/**
+ * Idle cost, wakeup latency and syscalls per event of the device reactor, on
+ * either backend, versus the old listener threads.
+ *
+ * Every "device" is a non-blocking pipe. The reactor modes register all of them
+ * as readers on one EventLoop, with epoll (wait, then read) or with io_uring
+ * (multishot reads, completions carry the data). The spin mode reproduces the
+ * former thread-per-device listeners that retried read() on EAGAIN. Each mode
+ * first idles to measure CPU time and thread count, then receives timestamped
+ * events to measure the write-to-callback latency.
+ *
+ * Each mode then runs again without the idle phase in a child traced with
+ * ptrace, counting the syscalls of every thread but the one writing events.
+ * Tracing slows the threads down, so the spin count is a lower bound.
+ *
+ * Usage: ptt-bench-event-loop [devices] [idle_seconds] [events]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "common/utilities/LatencyHistogram.h"
+#include "common/utilities/Utility.h"
+#include "common/utilities/numbers/Conversion.h"
+#include "server/device/EventLoop.h"
+
+#define DEFAULT_DEVICES 8
+#define DEFAULT_IDLE_SECONDS 2
+#define DEFAULT_EVENTS 2000
+/* Gap between events, roughly a fast typist on one device */
+#define EVENT_INTERVAL_US 500
+
+namespace {
+    struct Pipe {
+        int read_fd = -1;
+        int write_fd = -1;
+    };
+
+    /* How a mode sets up its listeners and tears them down again */
+    struct Mode {
+        std::function<void(std::vector<Pipe> &pipes, LatencyHistogram &latency)> setup;
+        std::function<void()> teardown;
+    };
+
+    uint64_t cpu_micros() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<uint64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+               usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    }
+
+    int thread_count() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.starts_with("Threads:")) {
+                return safeStrToInt(Utility::trim(line.substr(8))).value;
+            }
+        }
+        return -1;
+    }
+
+    /* Reads every queued timestamp and records how long it took to get here */
+    void drain(const int fd, LatencyHistogram &latency) {
+        uint64_t sent_us = 0;
+        while (read(fd, &sent_us, sizeof(sent_us)) == sizeof(sent_us)) {
+            latency.record(monotonic_micros() - sent_us);
+        }
+    }
+
+    /* Same for timestamps a reader was handed */
+    void record(const uint8_t *data, const ssize_t bytes, LatencyHistogram &latency) {
+        const size_t count = bytes > 0 ? static_cast<size_t>(bytes) / sizeof(uint64_t) : 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t sent_us = 0;
+            std::memcpy(&sent_us, data + i * sizeof(sent_us), sizeof(sent_us));
+            latency.record(monotonic_micros() - sent_us);
+        }
+    }
+
+    Mode reactor_mode(const IoEngine engine, std::unique_ptr<EventLoop> &loop, std::vector<Pipe> *&registered) {
+        return {
+            [engine, &loop, &registered](std::vector<Pipe> &pipes, LatencyHistogram &latency) {
+                EventLoop::set_io_engine(engine);
+                loop = std::make_unique<EventLoop>();
+                for (const auto &p: pipes) {
+                    loop->add_reader(p.read_fd, EPOLLIN, [&latency](const uint8_t *data, const ssize_t bytes) {
+                        record(data, bytes, latency);
+                    });
+                }
+                registered = &pipes;
+                loop->start();
+            },
+            [&loop, &registered] {
+                loop->stop();
+                for (const auto &p: *registered) loop->remove(p.read_fd);
+                loop.reset();
+            },
+        };
+    }
+
+    Mode spin_mode(std::atomic<bool> &running, std::vector<std::thread> &listeners) {
+        return {
+            [&running, &listeners](std::vector<Pipe> &pipes, LatencyHistogram &latency) {
+                running = true;
+                for (const auto &p: pipes) {
+                    listeners.emplace_back([fd = p.read_fd, &latency, &running] {
+                        while (running) drain(fd, latency);
+                    });
+                }
+            },
+            [&running, &listeners] {
+                running = false;
+                for (auto &listener: listeners) listener.join();
+                listeners.clear();
+            },
+        };
+    }
+
+    /* Returns false if the pipes could not be created */
+    bool run_mode(const std::string &name, const Mode &mode, const int devices, const int idle_seconds,
+                  const int events, const bool report) {
+        std::vector<Pipe> pipes(devices);
+        for (auto &[read_fd, write_fd]: pipes) {
+            int fds[2];
+            if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+                Utility::pError("pipe2 failed");
+                return false;
+            }
+            read_fd = fds[0];
+            write_fd = fds[1];
+        }
+
+        LatencyHistogram latency;
+        mode.setup(pipes, latency);
+
+        const int threads = thread_count();
+        const uint64_t cpu_before = cpu_micros();
+        const uint64_t wall_before = monotonic_micros();
+        std::this_thread::sleep_for(std::chrono::seconds(idle_seconds));
+        const double idle_cpu = 100.0 * static_cast<double>(cpu_micros() - cpu_before) /
+                                static_cast<double>(monotonic_micros() - wall_before);
+
+        for (int i = 0; i < events; ++i) {
+            const uint64_t now = monotonic_micros();
+            if (write(pipes[i % pipes.size()].write_fd, &now, sizeof(now)) != sizeof(now)) break;
+            std::this_thread::sleep_for(std::chrono::microseconds(EVENT_INTERVAL_US));
+        }
+        /* Let the last event arrive */
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        mode.teardown();
+
+        for (const auto &[read_fd, write_fd]: pipes) {
+            close(read_fd);
+            close(write_fd);
+        }
+        if (report) {
+            Utility::print(name + ": threads=" + std::to_string(threads) + " idle_cpu=" + std::to_string(idle_cpu) +
+                           "% latency " + latency.summary());
+        }
+        return true;
+    }
+
+    /**
+     *  Runs body in a child under ptrace and counts the syscalls of all its threads but the main one.
+     *  Returns -1 if the child could not be traced.
+     */
+    int64_t count_syscalls(const std::function<bool()> &body) {
+        const pid_t pid = fork();
+        if (pid < 0) return -1;
+        if (pid == 0) {
+            if (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) < 0) _exit(1);
+            raise(SIGSTOP);
+            _exit(body() ? 0 : 1);
+        }
+
+        int status = 0;
+        if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status) ||
+            ptrace(PTRACE_SETOPTIONS, pid, nullptr,
+                   PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL) < 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+
+        int64_t syscalls = 0;
+        /* Threads between syscall entry and exit; every syscall stops the tracee at both */
+        std::unordered_set<pid_t> inside;
+        std::unordered_set<pid_t> started{pid};
+        ptrace(PTRACE_SYSCALL, pid, nullptr, 0);
+        while (true) {
+            const pid_t tid = waitpid(-1, &status, __WALL);
+            if (tid < 0) return -1;
+            if (WIFEXITED(status) || WIFSIGNALED(status)) {
+                if (tid == pid) break;
+                continue;
+            }
+
+            int signal = 0;
+            const int stop = WSTOPSIG(status);
+            if (stop == (SIGTRAP | 0x80)) {
+                if (!inside.erase(tid)) {
+                    inside.insert(tid);
+                    if (tid != pid) ++syscalls;
+                }
+            } else if (stop == SIGSTOP && started.insert(tid).second) {
+                /* New threads start stopped, that stop is not for them to see */
+            } else if (stop != SIGTRAP) {
+                signal = stop;
+            }
+            ptrace(PTRACE_SYSCALL, tid, nullptr, signal);
+        }
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? syscalls : -1;
+    }
+}
+
+int main(const int argc, char *argv[]) {
+    const int devices = argc > 1 ? safeStrToInt(argv[1]).value : DEFAULT_DEVICES;
+    const int idle_seconds = argc > 2 ? safeStrToInt(argv[2]).value : DEFAULT_IDLE_SECONDS;
+    const int events = argc > 3 ? safeStrToInt(argv[3]).value : DEFAULT_EVENTS;
+    if (devices <= 0 || idle_seconds < 0 || events < 0) {
+        Utility::error("Usage: ptt-bench-event-loop [devices] [idle_seconds] [events]");
+        return 1;
+    }
+    Utility::print(std::to_string(devices) + " devices, " + std::to_string(idle_seconds) + "s idle, " +
+                   std::to_string(events) + " events");
+
+    std::unique_ptr<EventLoop> loop;
+    std::vector<Pipe> *registered = nullptr;
+    std::atomic<bool> running{false};
+    std::vector<std::thread> listeners;
+
+    const std::vector<std::pair<std::string, Mode> > modes = {
+        {"reactor epoll", reactor_mode(IoEngine::Epoll, loop, registered)},
+        {"reactor io_uring", reactor_mode(IoEngine::IoUring, loop, registered)},
+        {"spin", spin_mode(running, listeners)},
+    };
+    for (const auto &[name, mode]: modes) {
+        if (!run_mode(name, mode, devices, idle_seconds, events, true)) return 1;
+
+        const int64_t syscalls = count_syscalls([&] { return run_mode(name, mode, devices, 0, events, false); });
+        if (syscalls < 0) {
+            Utility::print(name + ": syscalls/event unavailable, ptrace failed");
+        } else if (events > 0) {
+            Utility::print(name + ": syscalls/event=" +
+                           std::to_string(static_cast<double>(syscalls) / static_cast<double>(events)));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,229 @@
+/**
+ * Cost of forwarding a grabbed device through the proxy to its virtual clone.
+ *
+ * mouse: a uinput mouse reports motion at a fixed rate, 8 kHz by default like a
+ * high-end gaming mouse, with a button edge every 64 reports so key frames
+ * interleave with motion. The proxy grabs it exclusively and forwards every
+ * frame. Reports the loop thread's CPU time, read-to-forward latency and what
+ * the bounded backlog had to coalesce or drop.
+ *
+ * remap: a uinput keyboard types through codes 1-255, forwarded once with an
+ * empty remap table and once with MAX_REMAP_ENTRIES entries rotating every
+ * code to the next one. Each run is forked so its ServerStats start at zero.
+ *
+ * Needs write access to /dev/uinput.
+ *
+ * Usage: ptt-bench-passthrough mouse|remap [seconds] [rate_hz]
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "common/utilities/Utility.h"
+#include "common/utilities/numbers/Conversion.h"
+#include "server/device/EventLoop.h"
+#include "server/device/VirtualInputProxy.h"
+#include "server/stats/ServerStats.h"
+#include "UinputDevice.h"
+
+#define DEFAULT_SECONDS 5
+#define DEFAULT_RATE_HZ 8000
+/* A button press or release every this many motion reports */
+#define BUTTON_EDGE_EVERY 64
+/* Key frames per second in remap mode, far beyond any typist */
+#define DEFAULT_KEY_RATE_HZ 1000
+
+namespace {
+    uint64_t thread_cpu_micros() {
+        rusage usage{};
+        getrusage(RUSAGE_THREAD, &usage);
+        return static_cast<uint64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+               usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    }
+
+    DeviceCapabilities mouse_caps() {
+        DeviceCapabilities caps;
+        caps.name = "PTT Bench Mouse";
+        for (const int code: {BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, BTN_SIDE, BTN_EXTRA}) caps.key_bits.set(code);
+        caps.num_keys = static_cast<int>(caps.key_bits.count());
+        for (const int code: {REL_X, REL_Y, REL_WHEEL}) caps.rel_bits.set(code);
+        return caps;
+    }
+
+    DeviceCapabilities keyboard_caps() {
+        DeviceCapabilities caps;
+        caps.name = "PTT Bench Keyboard";
+        for (int code = 1; code <= MAX_REMAP_ENTRIES; ++code) caps.key_bits.set(code);
+        caps.key_bits.set(BTN_EXTRA);
+        caps.num_keys = static_cast<int>(caps.key_bits.count());
+        return caps;
+    }
+
+    /* Calls report(n) on a fixed schedule, spinning because sleeps are coarser than 125 us */
+    template<typename Report>
+    uint64_t paced(const int seconds, const int rate_hz, Report &&report) {
+        const uint64_t interval_ns = 1000000000ULL / static_cast<uint64_t>(rate_hz);
+        const auto started = std::chrono::steady_clock::now();
+        const auto until = started + std::chrono::seconds(seconds);
+        auto next = started;
+        uint64_t reports = 0;
+        while (next < until) {
+            while (std::chrono::steady_clock::now() < next) {
+            }
+            if (!report(reports)) break;
+            ++reports;
+            next += std::chrono::nanoseconds(interval_ns);
+        }
+        return reports;
+    }
+
+    uint64_t flood(const UinputDevice &device, const int seconds, const int rate_hz) {
+        bool button_down = false;
+        const uint64_t reports = paced(seconds, rate_hz, [&](const uint64_t n) {
+            input_event report[4];
+            size_t count = 0;
+            report[count++] = UinputDevice::event(EV_REL, REL_X, 1);
+            report[count++] = UinputDevice::event(EV_REL, REL_Y, -1);
+            if (n % BUTTON_EDGE_EVERY == 0) {
+                button_down = !button_down;
+                report[count++] = UinputDevice::event(EV_KEY, BTN_LEFT, button_down ? 1 : 0);
+            }
+            report[count++] = UinputDevice::event(EV_SYN, SYN_REPORT, 0);
+            if (!device.write_events(report, count)) {
+                Utility::pError("Failed to write to uinput");
+                return false;
+            }
+            return true;
+        });
+        if (button_down) {
+            device.emit_key(BTN_LEFT, false);
+        }
+        return reports;
+    }
+
+    /**
+     *  Grabs the device through a proxy, runs the workload and prints what it cost.
+     */
+    template<typename Workload>
+    void run_proxied(const std::string &label, const UinputDevice &device, const std::vector<RemapEntry> &remap,
+                     const int seconds, Workload &&workload) {
+        EventLoop loop;
+        loop.start();
+        uint64_t cpu_before = 0;
+        uint64_t cpu_after = 0;
+        {
+            VirtualInputProxy proxy(loop);
+            const auto subscriber = proxy.add_subscriber([](int, bool, uint64_t) {
+            });
+            DeviceSetup setup{};
+            setup.vendor_id = UinputDevice::VENDOR_ID;
+            setup.product_id = UinputDevice::PRODUCT_ID;
+            setup.uid = device.uid();
+            setup.target_key = BTN_EXTRA;
+            setup.exclusive = true;
+            setup.remap_count = static_cast<uint8_t>(remap.size());
+            setup.remap = remap;
+            proxy.add_device(setup, subscriber);
+            proxy.start();
+
+            loop.run_in_loop([&] { cpu_before = thread_cpu_micros(); });
+            const uint64_t frames = workload();
+            /* Let the tail through */
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            loop.run_in_loop([&] { cpu_after = thread_cpu_micros(); });
+
+            const ServerStats &stats = ServerStats::instance();
+            const uint64_t cpu_us = cpu_after - cpu_before;
+            Utility::print(label + ": " + std::to_string(frames) + " frames, loop_cpu=" +
+                           std::to_string(100.0 * static_cast<double>(cpu_us) / (seconds * 1000000.0)) + "% (" +
+                           std::to_string(frames ? 1000.0 * static_cast<double>(cpu_us) / static_cast<double>(frames)
+                                              : 0.0) + " ns/frame)");
+            Utility::print("  events_read=" + std::to_string(stats.events_read.load()) +
+                           " read_calls=" + std::to_string(stats.read_calls.load()) +
+                           " frames_forwarded=" + std::to_string(stats.frames_forwarded.load()) +
+                           " events_coalesced=" + std::to_string(stats.events_coalesced.load()) +
+                           " backlog_events_dropped=" + std::to_string(stats.backlog_events_dropped.load()));
+            Utility::print("  latency.read " + stats.read_latency.summary());
+            Utility::print("  latency.forward " + stats.forward_latency.summary());
+        }
+        loop.stop();
+    }
+
+    int bench_mouse(const int seconds, const int rate_hz) {
+        const UinputDevice mouse(mouse_caps());
+        if (!mouse.ok()) {
+            Utility::error("uinput is not available, nothing to measure");
+            return 1;
+        }
+
+        run_proxied("mouse @" + std::to_string(rate_hz) + " Hz", mouse, {}, seconds, [&] {
+            return flood(mouse, seconds, rate_hz);
+        });
+        return 0;
+    }
+
+    /* Runs one configuration in a child process, so ServerStats only hold its own numbers */
+    template<typename Run>
+    bool run_forked(Run &&run) {
+        const pid_t pid = fork();
+        if (pid < 0) {
+            Utility::pError("fork failed");
+            return false;
+        }
+        if (pid == 0) {
+            _exit(run());
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    int bench_remap(const int seconds, const int rate_hz) {
+        std::vector<RemapEntry> rotation;
+        for (int code = 1; code <= MAX_REMAP_ENTRIES; ++code) {
+            rotation.push_back({static_cast<uint16_t>(code), static_cast<uint16_t>(code % MAX_REMAP_ENTRIES + 1)});
+        }
+
+        for (const auto &remap: {std::vector<RemapEntry>{}, rotation}) {
+            const bool ok = run_forked([&] {
+                const UinputDevice keyboard(keyboard_caps());
+                if (!keyboard.ok()) {
+                    Utility::error("uinput is not available, nothing to measure");
+                    return 1;
+                }
+
+                run_proxied("remap entries=" + std::to_string(remap.size()), keyboard, remap, seconds, [&] {
+                    /* Press and release every code in turn, one edge per frame */
+                    return paced(seconds, rate_hz, [&](const uint64_t n) {
+                        const auto code = static_cast<uint16_t>(n / 2 % MAX_REMAP_ENTRIES + 1);
+                        return keyboard.emit_key(code, n % 2 == 0);
+                    });
+                });
+                return 0;
+            });
+            if (!ok) return 1;
+        }
+        return 0;
+    }
+}
+
+int main(const int argc, char *argv[]) {
+    const std::string mode = argc > 1 ? argv[1] : "";
+    const int seconds = argc > 2 ? safeStrToInt(argv[2]).value : DEFAULT_SECONDS;
+    const int rate_hz = argc > 3
+                            ? safeStrToInt(argv[3]).value
+                            : mode == "remap"
+                                  ? DEFAULT_KEY_RATE_HZ
+                                  : DEFAULT_RATE_HZ;
+    if ((mode != "mouse" && mode != "remap") || seconds <= 0 || rate_hz <= 0) {
+        Utility::error("Usage: ptt-bench-passthrough mouse|remap [seconds] [rate_hz]");
+        return 1;
+    }
+    return mode == "mouse" ? bench_mouse(seconds, rate_hz) : bench_remap(seconds, rate_hz);
+}
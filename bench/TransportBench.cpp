@@ -0,0 +1,217 @@
+/**
+ * Round trip of a KEY_EVENT_V2 packet over the local Unix socket versus TCP on 127.0.0.1.
+ *
+ * The server side is an EventLoop reader that reassembles packets with PacketReader
+ * and sends them back through an OutboundQueue key lane, the path key events
+ * take out of a ClientSession. The client side writes and reads with the
+ * blocking write_packet()/read_packet() helpers InputClient uses. Both TCP
+ * ends have Nagle's algorithm off, as in the server and client.
+ *
+ * Usage: ptt-bench-transport [events]
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/input.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "common/protocol/Packets.h"
+#include "common/utilities/LatencyHistogram.h"
+#include "common/utilities/Utility.h"
+#include "common/utilities/numbers/Conversion.h"
+#include "server/device/EventLoop.h"
+#include "server/session/OutboundQueue.h"
+
+#define DEFAULT_EVENTS 20000
+/* Round trips before measuring, to warm up caches and the TCP connection */
+#define WARMUP_EVENTS 1000
+
+namespace {
+    /* Echoes every KEY_EVENT_V2 of one connection back the way a session sends key events */
+    class EchoServer {
+    public:
+        EchoServer(EventLoop &loop, const int listen_fd, const bool tcp) : loop_(loop), tcp_(tcp) {
+            loop_.add(listen_fd, EPOLLIN, [this, listen_fd](uint32_t) { accept_client(listen_fd); });
+        }
+
+        ~EchoServer() {
+            if (client_fd_ >= 0) {
+                loop_.remove(client_fd_);
+                close(client_fd_);
+            }
+        }
+
+    private:
+        EventLoop &loop_;
+        bool tcp_;
+        int client_fd_ = -1;
+        PacketReader reader_;
+        OutboundQueue outbound_;
+
+        void accept_client(const int listen_fd) {
+            client_fd_ = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_fd_ < 0) return;
+            if (tcp_) {
+                constexpr int nodelay = 1;
+                setsockopt(client_fd_, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            }
+            loop_.remove(listen_fd);
+            loop_.add_reader(client_fd_, EPOLLIN, [this](const uint8_t *data, const ssize_t bytes) {
+                on_received(data, bytes);
+            });
+        }
+
+        void on_received(const uint8_t *data, const ssize_t bytes) {
+            if (bytes <= 0) {
+                loop_.remove(client_fd_);
+                return;
+            }
+            reader_.feed(data, static_cast<size_t>(bytes));
+
+            PacketHeader hdr{};
+            std::vector<uint8_t> payload;
+            while (reader_.next(hdr, payload)) {
+                outbound_.push(OutboundQueue::Lane::Key, Channel::Events, hdr.type, payload.data(),
+                               static_cast<uint32_t>(payload.size()));
+            }
+            /* The replies are tiny, a loopback socket always takes them */
+            outbound_.flush(client_fd_);
+        }
+    };
+
+    int listen_unix(const std::string &path) {
+        unlink(path.c_str());
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+            Utility::pError("Failed to listen on " + path);
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    int connect_unix(const std::string &path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            Utility::pError("Failed to connect to " + path);
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /* Listens on an ephemeral loopback port and reports it through port */
+    int listen_tcp(uint16_t &port) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+
+        const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(fd, 1) < 0 ||
+            getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) < 0) {
+            Utility::pError("Failed to listen on 127.0.0.1");
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        port = ntohs(addr.sin_port);
+        return fd;
+    }
+
+    /* Returns false if the connection broke */
+    bool round_trip(const int fd, const uint32_t sequence, LatencyHistogram *latency, uint64_t &total_us) {
+        KeyEventPayloadV2 event{};
+        event.key = KEY_F13;
+        event.state = sequence % 2;
+        event.sequence = sequence;
+        event.timestamp_us = monotonic_micros();
+        if (!write_packet(fd, Channel::Events, static_cast<uint16_t>(EventType::KEY_EVENT_V2), &event,
+                          sizeof(event))) {
+            return false;
+        }
+
+        PacketHeader hdr{};
+        std::vector<uint8_t> payload;
+        if (!read_packet(fd, hdr, payload) || payload.size() != sizeof(event)) return false;
+
+        if (latency) {
+            const uint64_t elapsed_us = monotonic_micros() - event.timestamp_us;
+            latency->record(elapsed_us);
+            total_us += elapsed_us;
+        }
+        return true;
+    }
+
+    void run_transport(const std::string &label, const int listen_fd, const bool tcp, const int events,
+                       const std::function<int()> &connect_client) {
+        EventLoop loop;
+        {
+            EchoServer server(loop, listen_fd, tcp);
+            loop.start();
+
+            const int fd = connect_client();
+            if (fd < 0) {
+                loop.stop();
+                close(listen_fd);
+                return;
+            }
+
+            LatencyHistogram latency;
+            uint64_t total_us = 0;
+            int completed = 0;
+            for (int i = 0; i < WARMUP_EVENTS + events; ++i) {
+                if (!round_trip(fd, static_cast<uint32_t>(i), i >= WARMUP_EVENTS ? &latency : nullptr, total_us)) {
+                    Utility::error(label + ": connection broke after " + std::to_string(i) + " round trips");
+                    break;
+                }
+                if (i >= WARMUP_EVENTS) ++completed;
+            }
+            close(fd);
+            loop.stop();
+
+            Utility::print(label + ": round trip " + latency.summary() + " mean=" +
+                           std::to_string(completed ? static_cast<double>(total_us) / completed : 0.0) + "us");
+        }
+        close(listen_fd);
+    }
+}
+
+int main(const int argc, char *argv[]) {
+    const int events = argc > 1 ? safeStrToInt(argv[1]).value : DEFAULT_EVENTS;
+    if (events <= 0) {
+        Utility::error("Usage: ptt-bench-transport [events]");
+        return 1;
+    }
+    Utility::print(std::to_string(events) + " KEY_EVENT_V2 round trips per transport");
+
+    const std::string unix_path = "/tmp/ptt-bench-transport-" + std::to_string(getpid()) + ".sock";
+    if (const int listen_fd = listen_unix(unix_path); listen_fd >= 0) {
+        run_transport("unix", listen_fd, false, events, [&] { return connect_unix(unix_path); });
+        unlink(unix_path.c_str());
+    }
+
+    uint16_t port = 0;
+    if (const int listen_fd = listen_tcp(port); listen_fd >= 0) {
+        run_transport("tcp 127.0.0.1", listen_fd, true, events, [&] {
+            return open_tcp_connection("127.0.0.1:" + std::to_string(port));
+        });
+    }
+    return 0;
+}
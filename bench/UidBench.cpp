@@ -0,0 +1,103 @@
+/**
+ * Cost of computing a device UID from its capabilities, the streaming
+ * hasher behind generate_uid() versus the former stringstream-and-crc32 version.
+ *
+ * Both run over the same capability sets, from a mouse with a handful of
+ * codes to a device reporting every key and axis, and must agree on the UID.
+ *
+ * Usage: ptt-bench-uid [iterations]
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/device/DeviceCapabilities.h"
+#include "common/utilities/Utility.h"
+#include "common/utilities/numbers/Conversion.h"
+#include "LegacyUid.h"
+
+#define DEFAULT_ITERATIONS 20000
+
+namespace {
+    struct Case {
+        std::string label;
+        DeviceCapabilities caps;
+    };
+
+    std::vector<Case> cases() {
+        std::vector<Case> out;
+
+        DeviceCapabilities mouse;
+        mouse.name = "Bench Mouse";
+        for (const int code: {BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, BTN_SIDE, BTN_EXTRA}) mouse.key_bits.set(code);
+        for (const int code: {REL_X, REL_Y, REL_WHEEL, REL_HWHEEL}) mouse.rel_bits.set(code);
+        out.push_back({"mouse", mouse});
+
+        DeviceCapabilities keyboard;
+        keyboard.name = "Bench Keyboard";
+        for (int code = KEY_ESC; code <= KEY_MICMUTE; ++code) keyboard.key_bits.set(code);
+        out.push_back({"keyboard", keyboard});
+
+        DeviceCapabilities gamepad;
+        gamepad.name = "Bench Gamepad";
+        for (int code = BTN_SOUTH; code <= BTN_THUMBR; ++code) gamepad.key_bits.set(code);
+        for (int code = ABS_X; code <= ABS_RZ; ++code) {
+            gamepad.abs_bits.set(code);
+            gamepad.abs_info[code] = {0, -32768, 32767, 16, 128, 0};
+            gamepad.abs_info_valid.set(code);
+        }
+        out.push_back({"gamepad", gamepad});
+
+        DeviceCapabilities everything;
+        everything.name = "Bench Everything";
+        for (int code = 0; code <= KEY_MAX; ++code) everything.key_bits.set(code);
+        for (int code = 0; code <= ABS_MAX; ++code) {
+            everything.abs_bits.set(code);
+            everything.abs_info[code] = {0, 0, 4095, 4, 8, 12};
+            everything.abs_info_valid.set(code);
+        }
+        for (int code = 0; code <= REL_MAX; ++code) everything.rel_bits.set(code);
+        out.push_back({"every code", everything});
+
+        for (auto &[label, caps]: out) caps.num_keys = static_cast<int>(caps.key_bits.count());
+        return out;
+    }
+
+    /* Nanoseconds per call, the sum of the UIDs keeps the calls from being optimized away */
+    template<typename Uid>
+    double time_per_call(const int iterations, uint32_t &sink, Uid &&uid) {
+        const auto started = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            sink += uid();
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - started;
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) /
+               iterations;
+    }
+}
+
+int main(const int argc, char *argv[]) {
+    const int iterations = argc > 1 ? safeStrToInt(argv[1]).value : DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        Utility::error("Usage: ptt-bench-uid [iterations]");
+        return 1;
+    }
+
+    uint32_t sink = 0;
+    for (const auto &[label, caps]: cases()) {
+        if (DeviceUtils::generate_uid(caps) != legacy_uid(caps)) {
+            Utility::error(label + ": UIDs disagree");
+            return 1;
+        }
+
+        const double hasher_ns = time_per_call(iterations, sink, [&] { return DeviceUtils::generate_uid(caps); });
+        const double legacy_ns = time_per_call(iterations, sink, [&] { return legacy_uid(caps); });
+        Utility::print(label + " (" + std::to_string(caps.num_keys) + " keys): hasher=" +
+                       std::to_string(hasher_ns) + " ns legacy=" + std::to_string(legacy_ns) + " ns speedup=" +
+                       std::to_string(legacy_ns / hasher_ns) + "x");
+    }
+    Utility::debugPrint("checksum " + std::to_string(sink));
+    return 0;
+}
@@ -38,6 +38,7 @@ fi
 sudo sed "s|ExecStart=/usr/bin/ptt-server|ExecStart=$BIN_DIR/ptt-server|" ptt-server.service > /tmp/ptt-server.service
 sudo install -Dm644 /tmp/ptt-server.service "$SYSTEMD_DIR/ptt-server.service"
 rm /tmp/ptt-server.service
+sudo install -Dm644 ptt-server.socket "$SYSTEMD_DIR/ptt-server.socket"
 
 mkdir -p "$USER_SYSTEMD_DIR"
 
@@ -46,5 +47,5 @@ sed -i "s|ExecStart=/usr/bin/ptt-client|ExecStart=$BIN_DIR/ptt-client|" ptt-clie
 install -Dm644 ptt-client.service "$USER_SYSTEMD_DIR/ptt-client.service"
 
 echo "Installed! Now run:"
-echo "  sudo systemctl enable --now ptt-server"
+echo "  sudo systemctl enable --now ptt-server.socket"
 echo "  systemctl --user enable --now ptt-client"
@@ -8,6 +8,7 @@
 #include <stdexcept>
 #include <cstring>
 #include <unistd.h>
+#include <algorithm>
 #include <chrono>
 #include <atomic>
 
@@ -15,25 +16,42 @@ InputClient::~InputClient() {
     stop();
 }
 
-void InputClient::set_callback(std::function<void(bool)> callback) {
+void InputClient::set_callback(std::function<void(const KeyEvent &)> callback) {
     callback_ = std::move(callback);
 }
 
 void InputClient::clear_devices() {
     configs_.clear();
+    /* The server-side session still holds the old configs */
+    resume_token_ = 0;
+}
+
+void InputClient::set_server(const std::string &address, const std::string &secret) {
+    if (address != server_address_) {
+        /* Sessions are kept per server, another one won't know the token */
+        resume_token_ = 0;
+    }
+    server_address_ = address;
+    shared_secret_ = secret;
 }
 
 void InputClient::add_device(const uint16_t vendor_id, const uint16_t product_id,
-                             const uint32_t uid, const int target_key, const bool exclusive) {
-    configs_.push_back({vendor_id, product_id, uid, target_key, exclusive});
+                             const uint32_t uid, const int target_key, const bool exclusive,
+                             const uint16_t debounce_ms, std::vector<RemapEntry> remap) {
+    DeviceSetup setup{};
+    static_cast<DeviceConfig &>(setup) = {vendor_id, product_id, uid, target_key, exclusive, 0, debounce_ms};
+    setup.remap = std::move(remap);
+    configs_.push_back(std::move(setup));
 }
 
-bool InputClient::wait_for_ack(const int fd) {
+bool InputClient::wait_for_ack(const int fd, std::vector<uint8_t> *payload) {
     PacketHeader hdr{};
-    if (std::vector<uint8_t> payload; !read_packet(fd, hdr, payload)) return false;
+    std::vector<uint8_t> received;
+    if (!read_packet(fd, hdr, received)) return false;
 
     if (hdr.channel == static_cast<uint16_t>(Channel::Control) &&
         hdr.type == static_cast<uint16_t>(ControlType::ACK)) {
+        if (payload) *payload = std::move(received);
         return true;
     }
 
@@ -41,19 +59,44 @@ bool InputClient::wait_for_ack(const int fd) {
     return false;
 }
 
-int InputClient::connect_and_handshake() const {
-    int fd = connect_to_server();
+int InputClient::connect_and_handshake() {
+    int fd = connect_to_server(server_address_);
+    remote_ = !server_address_.empty();
 
-    write_packet_safe(fd, Channel::Control,
+    HandshakePayload hello{};
+    hello.version = PROTOCOL_VERSION;
+    hello.resume_token = resume_token_;
+    std::vector<uint8_t> handshake(sizeof(hello));
+    std::memcpy(handshake.data(), &hello, sizeof(hello));
+    if (!server_address_.empty()) {
+        HandshakeSecret secret{};
+        std::memcpy(secret.secret, shared_secret_.data(), std::min(shared_secret_.size(), sizeof(secret.secret)));
+        const auto *bytes = reinterpret_cast<const uint8_t *>(&secret);
+        handshake.insert(handshake.end(), bytes, bytes + sizeof(secret));
+    }
+    write_packet_safe(fd, server_address_, Channel::Control,
                       static_cast<uint16_t>(ControlType::HAND_SHAKE),
-                      nullptr, 0);
-    if (!wait_for_ack(fd)) throw std::runtime_error("HAND_SHAKE not acknowledged by server");
+                      handshake.data(), handshake.size());
+
+    std::vector<uint8_t> ack;
+    if (!wait_for_ack(fd, &ack)) throw std::runtime_error("HAND_SHAKE not acknowledged by server");
+
+    HandshakePayload reply{};
+    std::memcpy(&reply, ack.data(), std::min(ack.size(), sizeof(reply)));
+    resume_token_ = reply.resume_token;
+    if (reply.flags & HANDSHAKE_FLAG_RESUMED) {
+        Utility::debugPrint("Resumed the previous server session");
+        return fd;
+    }
 
     if (!configs_.empty()) {
-        write_packet_safe(fd, Channel::Control,
+        /* Protocol 2+ servers echo their version, older ones send an empty ACK */
+        const uint16_t server_version = ack.size() >= sizeof(reply.version) ? reply.version : 1;
+        const std::vector<uint8_t> config_list = encode_config_list(configs_, server_version);
+        write_packet_safe(fd, server_address_, Channel::Control,
                           static_cast<uint16_t>(ControlType::CONFIG_LIST),
-                          configs_.data(),
-                          configs_.size() * sizeof(DeviceConfig));
+                          config_list.data(),
+                          config_list.size());
         if (!wait_for_ack(fd)) throw std::runtime_error("CONFIG_LIST not acknowledged by server");
     }
 
@@ -78,7 +121,7 @@ void InputClient::start() {
                 std::this_thread::sleep_for(std::chrono::milliseconds(PING_INTERVAL_MS));
                 if (!running_) break;
 
-                if (!write_packet_safe(sock_fd_, Channel::Control,
+                if (!write_packet_safe(sock_fd_, server_address_, Channel::Control,
                                        static_cast<uint16_t>(ControlType::PING),
                                        nullptr, 0)) {
                     Utility::error("Ping failed, will reconnect on next read");
@@ -92,6 +135,8 @@ void InputClient::start() {
 
         while (running_) {
             if (!read_packet(sock_fd_, hdr, payload)) {
+                /* disconnect() shut the socket down, a reconnect would open a session nobody ends */
+                if (!running_) break;
                 Utility::error("Read failed — reconnecting...");
 
                 if (sock_fd_ >= 0) {
@@ -113,11 +158,17 @@ void InputClient::start() {
             }
 
             if (hdr.channel == static_cast<uint16_t>(Channel::Events) &&
-                hdr.type == static_cast<uint16_t>(EventType::KEY_EVENT) &&
-                payload.size() == sizeof(KeyEventPayload)) {
+                hdr.type == static_cast<uint16_t>(EventType::KEY_EVENT_V2) &&
+                payload.size() == sizeof(KeyEventPayloadV2)) {
+                KeyEventPayloadV2 ev{};
+                std::memcpy(&ev, payload.data(), sizeof(ev));
+                dispatch_event({ev.key, ev.state != 0, ev.sequence, ev.timestamp_us});
+            } else if (hdr.channel == static_cast<uint16_t>(Channel::Events) &&
+                       hdr.type == static_cast<uint16_t>(EventType::KEY_EVENT) &&
+                       payload.size() == sizeof(KeyEventPayload)) {
                 KeyEventPayload ev{};
                 std::memcpy(&ev, payload.data(), sizeof(ev));
-                callback_(ev.state != 0);
+                dispatch_event({ev.key, ev.state != 0, 0, 0});
             } else if (hdr.channel == static_cast<uint16_t>(Channel::Control)) {
                 switch (static_cast<ControlType>(hdr.type)) {
                     case ControlType::PONG:
@@ -150,7 +201,50 @@ void InputClient::start() {
     });
 }
 
+void InputClient::dispatch_event(const KeyEvent &event) {
+    if (event.timestamp_us != 0 && !remote_) {
+        const uint64_t now = monotonic_micros();
+        const uint64_t latency = now > event.timestamp_us ? now - event.timestamp_us : 0;
+        callback_latency_.record(latency);
+        Utility::debugPrint("KEY_EVENT seq=" + std::to_string(event.sequence) +
+                            " press->callback " + std::to_string(latency) + "us");
+    }
+    callback_(event);
+}
+
+void InputClient::record_mute_applied(const KeyEvent &event) {
+    if (event.timestamp_us == 0 || remote_) return;
+
+    const uint64_t now = monotonic_micros();
+    const uint64_t latency = now > event.timestamp_us ? now - event.timestamp_us : 0;
+    mute_latency_.record(latency);
+    Utility::debugPrint("KEY_EVENT seq=" + std::to_string(event.sequence) +
+                        " press->mute " + std::to_string(latency) + "us");
+}
+
+void InputClient::report_latency() const {
+    if (callback_latency_.count() == 0) {
+        if (remote_) Utility::print("Latency is not measured over TCP, event timestamps come from the server's clock");
+        return;
+    }
+    Utility::print("Latency press->callback: " + callback_latency_.summary());
+    Utility::print("Latency press->mute:     " + mute_latency_.summary());
+}
+
 void InputClient::stop() {
+    send_bye();
+    resume_token_ = 0;
+    disconnect();
+}
+
+void InputClient::send_bye() const {
+    if (sock_fd_ >= 0) {
+        /* Let the server release our devices now instead of holding them for a resume */
+        write_packet(sock_fd_, Channel::Control, static_cast<uint16_t>(ControlType::BYE), nullptr, 0);
+    }
+}
+
+void InputClient::disconnect() {
     running_ = false;
     if (sock_fd_ >= 0) {
         shutdown(sock_fd_, SHUT_RDWR);
@@ -161,7 +255,9 @@ void InputClient::stop() {
 }
 
 void InputClient::restart() {
-    stop();
+    /* Without a token the old session can't be resumed, don't leave it parked with its grabs */
+    if (resume_token_ == 0) send_bye();
+    disconnect();
     sock_fd_ = connect_and_handshake();
     running_ = true;
 }
@@ -1,10 +1,21 @@
 #ifndef INPUTCLIENT_H
 #define INPUTCLIENT_H
 
+#include <atomic>
 #include <functional>
+#include <string>
 #include <thread>
 
-struct DeviceConfig;
+#include "common/utilities/LatencyHistogram.h"
+#include "common/utilities/Utility.h"
+
+struct KeyEvent {
+    int key;
+    bool pressed;
+    uint32_t sequence;
+    /* CLOCK_MONOTONIC microseconds when the kernel saw the event, 0 if the server did not send it */
+    uint64_t timestamp_us;
+};
 
 class InputClient {
 public:
@@ -14,26 +25,70 @@ public:
 
     void stop();
 
+    /**
+     *  Reconnects, resuming the server session unless clear_devices() or a new server address dropped it.
+     */
     void restart();
 
-    void set_callback(std::function<void(bool)> callback);
+    void set_callback(std::function<void(const KeyEvent &)> callback);
 
     void clear_devices();
 
-    void add_device(uint16_t vendor_id, uint16_t product_id, uint32_t uid, int target_key, bool exclusive = false);
+    /**
+     *  Connects to a ptt-server TCP listener at "host:port" instead of the local socket,
+     *  presenting the shared secret it was started with. An empty address means the local socket.
+     *  Takes effect on the next (re)connect.
+     */
+    void set_server(const std::string &address, const std::string &secret);
+
+    /**
+     *  The remap table is applied by the server while the device is exclusive,
+     *  servers older than protocol 7 ignore it.
+     */
+    void add_device(uint16_t vendor_id, uint16_t product_id, uint32_t uid, int target_key, bool exclusive = false,
+                    uint16_t debounce_ms = 0, std::vector<RemapEntry> remap = {});
+
+    /**
+     *  Records the time from the kernel event to the mute state being applied.
+     *  Not recorded over TCP, where the event was timestamped by another host's clock.
+     */
+    void record_mute_applied(const KeyEvent &event);
+
+    [[nodiscard]] const LatencyHistogram &callback_latency() const { return callback_latency_; }
+
+    [[nodiscard]] const LatencyHistogram &mute_latency() const { return mute_latency_; }
+
+    void report_latency() const;
 
 private:
-    std::vector<DeviceConfig> configs_;
+    std::vector<DeviceSetup> configs_;
+    std::string server_address_;
+    std::string shared_secret_;
 
     int sock_fd_ = -1;
     std::thread listener_thread_;
     std::atomic<bool> running_{false};
-    std::function<void(bool)> callback_;
+    std::function<void(const KeyEvent &)> callback_;
+    /* Issued by the server at handshake, lets a reconnect pick up the existing session */
+    std::atomic<uint64_t> resume_token_{0};
+    /* Connected over TCP: event timestamps are the server host's CLOCK_MONOTONIC and say nothing about latency here */
+    std::atomic<bool> remote_{false};
+
+    LatencyHistogram callback_latency_;
+    LatencyHistogram mute_latency_;
+
+    static bool wait_for_ack(int fd, std::vector<uint8_t> *payload = nullptr);
+
+    int connect_and_handshake();
 
+    /**
+     *  Ends the server-side session right away instead of leaving it to wait for a resume.
+     */
+    void send_bye() const;
 
-    static bool wait_for_ack(int fd);
+    void disconnect();
 
-    int connect_and_handshake() const;
+    void dispatch_event(const KeyEvent &event);
 };
 
 #endif //INPUTCLIENT_H
@@ -27,6 +27,7 @@ PushToTalkApp::~PushToTalkApp() {
     AudioUtilities::cleanupAudioSystem();
     Utility::print("Cleaning up client...");
     client_.stop();
+    client_.report_latency();
     Utility::print("Cleaning up virtual microphone...");
     virtualMicrophone_.stop();
 }
@@ -86,18 +87,28 @@ void PushToTalkApp::onShowSettings(GtkMenuItem *, gpointer) {
 void PushToTalkApp::run() {
     createTrayIcon();
 
+    client_.set_server(Settings::settings.serverAddress, Settings::settings.serverSecret);
     for (const DeviceSettings &device_settings: Settings::settings.devices) {
         client_.add_device(device_settings.getVendorID(), device_settings.getProductID(),
-                           device_settings.getDeviceUID(), device_settings.button, device_settings.exclusive);
+                           device_settings.getDeviceUID(), device_settings.button, device_settings.exclusive,
+                           device_settings.debounceMs, device_settings.getRemap());
     }
     try {
-        client_.set_callback([](const bool pressed) {
+        client_.set_callback([this](const KeyEvent &event) {
             Utility::debugPrint(
-                "Button " + std::string(
-                    pressed ? "pressed" : "released"));
+                "Button " + std::to_string(event.key) + " " + std::string(
+                    event.pressed ? "pressed" : "released"));
+            {
+                std::lock_guard lock(heldKeysMutex_);
+                const bool wasActive = !heldKeys_.empty();
+                if (event.pressed) heldKeys_.insert(event.key);
+                else heldKeys_.erase(event.key);
+                if (wasActive == !heldKeys_.empty()) return;
+            }
             AudioUtilities::playSound(
-                (!pressed ? Settings::settings.sPttOffPath : Settings::settings.sPttOnPath).c_str());
-            AudioUtilities::setMicMute(!pressed);
+                (!event.pressed ? Settings::settings.sPttOffPath : Settings::settings.sPttOnPath).c_str());
+            AudioUtilities::setMicMute(!event.pressed);
+            client_.record_mute_applied(event);
         });
 
         client_.start();
@@ -136,8 +147,14 @@ void PushToTalkApp::stop() {
 void PushToTalkApp::reload() {
     Utility::print("Reloading client...");
     client_.clear_devices();
+    {
+        std::lock_guard lock(heldKeysMutex_);
+        heldKeys_.clear();
+    }
+    client_.set_server(Settings::settings.serverAddress, Settings::settings.serverSecret);
     for (const auto &dev: Settings::settings.devices)
-        client_.add_device(dev.getVendorID(), dev.getProductID(), dev.getDeviceUID(), dev.button, dev.exclusive);
+        client_.add_device(dev.getVendorID(), dev.getProductID(), dev.getDeviceUID(), dev.button, dev.exclusive,
+                           dev.debounceMs, dev.getRemap());
     client_.restart();
 
     virtualMicrophone_.set_audio_config(Settings::settings.rate, Settings::settings.channels,
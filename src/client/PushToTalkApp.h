@@ -1,6 +1,8 @@
 #pragma once
 
+#include <mutex>
 #include <thread>
+#include <unordered_set>
 #include <gtk/gtk.h>
 #include "InputClient.h"
 #include "client/utilities/VirtualMicrophone.h"
@@ -28,6 +30,10 @@ private:
 
     VirtualMicrophone virtualMicrophone_;
 
+    /* PTT stays active while any bound key is held */
+    std::mutex heldKeysMutex_;
+    std::unordered_set<int> heldKeys_;
+
     static void initializeGtk(int argc, char *argv[]);
 
     void createTrayIcon();
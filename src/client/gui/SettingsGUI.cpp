@@ -20,6 +20,8 @@ struct DeviceRow {
     GtkWidget *deviceEntry;
     GtkWidget *buttonEntry;
     GtkWidget *exclusiveCheck;
+    GtkWidget *debounceEntry;
+    GtkWidget *remapEntry;
 };
 
 std::vector<DeviceRow> deviceEntries;
@@ -38,9 +40,13 @@ void onAddDeviceClicked(GtkButton *, gpointer) {
     GtkWidget *deviceEntry = gtk_entry_new();
     GtkWidget *buttonEntry = gtk_entry_new();
     GtkWidget *exclusiveCheck = gtk_check_button_new_with_label("Exclusive");
+    GtkWidget *debounceEntry = gtk_entry_new();
+    GtkWidget *remapEntry = gtk_entry_new();
 
     gtk_entry_set_placeholder_text(GTK_ENTRY(deviceEntry), "vendor:product:uid");
     gtk_entry_set_placeholder_text(GTK_ENTRY(buttonEntry), "button");
+    gtk_entry_set_placeholder_text(GTK_ENTRY(debounceEntry), "debounce ms");
+    gtk_entry_set_placeholder_text(GTK_ENTRY(remapEntry), "remap from:to,...");
 
     GtkWidget *removeBtn = gtk_button_new_from_icon_name("window-close", GTK_ICON_SIZE_BUTTON);
     gtk_widget_set_tooltip_text(removeBtn, "Remove this device");
@@ -49,10 +55,12 @@ void onAddDeviceClicked(GtkButton *, gpointer) {
     gtk_box_pack_start(GTK_BOX(row), deviceEntry, TRUE, TRUE, 0);
     gtk_box_pack_start(GTK_BOX(row), buttonEntry, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(row), exclusiveCheck, FALSE, FALSE, 0); // add checkbox
+    gtk_box_pack_start(GTK_BOX(row), debounceEntry, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(row), remapEntry, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(row), removeBtn, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(deviceBox), row, FALSE, FALSE, 0);
 
-    deviceEntries.push_back({deviceEntry, buttonEntry, exclusiveCheck});
+    deviceEntries.push_back({deviceEntry, buttonEntry, exclusiveCheck, debounceEntry, remapEntry});
     gtk_widget_show_all(deviceBox);
 }
 
@@ -96,7 +104,7 @@ gboolean onSaveSettings(gpointer) {
     std::lock_guard lock(gtk_mutex);
     std::vector<DeviceSettings> devices;
 
-    for (const auto &[deviceEntry, buttonEntry, exclusiveCheck]: deviceEntries) {
+    for (const auto &[deviceEntry, buttonEntry, exclusiveCheck, debounceEntry, remapEntry]: deviceEntries) {
         const std::string deviceStr = gtk_entry_get_text(GTK_ENTRY(deviceEntry));
         const IntConversionResult buttonRes = safeStrToInt(gtk_entry_get_text(GTK_ENTRY(buttonEntry)));
         if (!buttonRes.success) {
@@ -104,10 +112,24 @@ gboolean onSaveSettings(gpointer) {
             return G_SOURCE_REMOVE;
         }
 
+        const std::string debounceStr = gtk_entry_get_text(GTK_ENTRY(debounceEntry));
+        IntConversionResult debounceRes;
+        debounceRes.value = 0;
+        debounceRes.success = true;
+        if (!debounceStr.empty()) {
+            debounceRes = safeStrToInt(debounceStr);
+        }
+        if (!debounceRes.success || debounceRes.value < 0 || debounceRes.value > UINT16_MAX) {
+            Utility::error("Invalid debounce value.");
+            return G_SOURCE_REMOVE;
+        }
+
         devices.push_back(DeviceSettings{
             deviceStr,
             buttonRes.value,
-            static_cast<bool>(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(exclusiveCheck)))
+            static_cast<bool>(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(exclusiveCheck))),
+            static_cast<uint16_t>(debounceRes.value),
+            gtk_entry_get_text(GTK_ENTRY(remapEntry))
         });
     }
 
@@ -132,6 +154,8 @@ gboolean onSaveSettings(gpointer) {
             get_entry_text(SettingsGUI::settingsWindow, "captureBufferSize")).value;
         Settings::settings.playback_buffer_size = safeStrToInt(
             get_entry_text(SettingsGUI::settingsWindow, "playbackBufferSize")).value;
+        Settings::settings.serverAddress = get_entry_text(SettingsGUI::settingsWindow, "serverAddress");
+        Settings::settings.serverSecret = get_entry_text(SettingsGUI::settingsWindow, "serverSecret");
     } catch (...) {
         Utility::error("One or more fields have invalid values.");
         return G_SOURCE_REMOVE;
@@ -169,15 +193,23 @@ void SettingsGUI::showSettingsGui() {
     deviceBox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
     gtk_box_pack_start(GTK_BOX(deviceTab), deviceBox, TRUE, TRUE, 0);
 
-    for (const auto &[deviceStr, button, exclusive]: Settings::settings.devices) {
+    for (const auto &[deviceStr, button, exclusive, debounceMs, remap]: Settings::settings.devices) {
         GtkWidget *row = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
         GtkWidget *deviceEntry = gtk_entry_new();
         GtkWidget *buttonEntry = gtk_entry_new();
         GtkWidget *exclusiveCheck = gtk_check_button_new_with_label("Exclusive");
+        GtkWidget *debounceEntry = gtk_entry_new();
+        GtkWidget *remapEntry = gtk_entry_new();
 
         gtk_entry_set_text(GTK_ENTRY(deviceEntry), deviceStr.c_str());
         gtk_entry_set_text(GTK_ENTRY(buttonEntry), std::to_string(button).c_str());
         gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(exclusiveCheck), exclusive);
+        gtk_entry_set_placeholder_text(GTK_ENTRY(debounceEntry), "debounce ms");
+        if (debounceMs > 0) {
+            gtk_entry_set_text(GTK_ENTRY(debounceEntry), std::to_string(debounceMs).c_str());
+        }
+        gtk_entry_set_placeholder_text(GTK_ENTRY(remapEntry), "remap from:to,...");
+        gtk_entry_set_text(GTK_ENTRY(remapEntry), remap.c_str());
 
         GtkWidget *removeBtn = gtk_button_new_from_icon_name("window-close", GTK_ICON_SIZE_BUTTON);
         gtk_widget_set_tooltip_text(removeBtn, "Remove this device");
@@ -186,10 +218,12 @@ void SettingsGUI::showSettingsGui() {
         gtk_box_pack_start(GTK_BOX(row), deviceEntry, TRUE, TRUE, 0);
         gtk_box_pack_start(GTK_BOX(row), buttonEntry, FALSE, FALSE, 0);
         gtk_box_pack_start(GTK_BOX(row), exclusiveCheck, FALSE, FALSE, 0);
+        gtk_box_pack_start(GTK_BOX(row), debounceEntry, FALSE, FALSE, 0);
+        gtk_box_pack_start(GTK_BOX(row), remapEntry, FALSE, FALSE, 0);
         gtk_box_pack_start(GTK_BOX(row), removeBtn, FALSE, FALSE, 0);
         gtk_box_pack_start(GTK_BOX(deviceBox), row, FALSE, FALSE, 0);
 
-        deviceEntries.push_back({deviceEntry, buttonEntry, exclusiveCheck});
+        deviceEntries.push_back({deviceEntry, buttonEntry, exclusiveCheck, debounceEntry, remapEntry});
     }
 
     GtkWidget *addDeviceBtn = gtk_button_new_with_label("➕ Add Device");
@@ -232,6 +266,19 @@ void SettingsGUI::showSettingsGui() {
     gtk_notebook_append_page(GTK_NOTEBOOK(notebook), bufferTab, gtk_label_new("Buffer"));
 
 
+    GtkWidget *serverTab = gtk_grid_new();
+    gtk_grid_set_row_spacing(GTK_GRID(serverTab), 10);
+    gtk_grid_set_column_spacing(GTK_GRID(serverTab), 10);
+    gtk_container_set_border_width(GTK_CONTAINER(serverTab), 10);
+
+    add_grid_entry(GTK_GRID(serverTab), "Server Address (host:port, empty for local):",
+                   Settings::settings.serverAddress.c_str(), 0, "serverAddress", settingsWindow);
+    add_grid_entry(GTK_GRID(serverTab), "Shared Secret:", Settings::settings.serverSecret.c_str(), 1, "serverSecret",
+                   settingsWindow);
+    gtk_entry_set_visibility(GTK_ENTRY(g_object_get_data(G_OBJECT(settingsWindow), "serverSecret")), FALSE);
+    gtk_notebook_append_page(GTK_NOTEBOOK(notebook), serverTab, gtk_label_new("Server"));
+
+
     GtkWidget *buttonBox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
     gtk_box_set_homogeneous(GTK_BOX(buttonBox), FALSE);
 
@@ -2,7 +2,9 @@
 #include "common/utilities/Utility.h"
 #include "common/utilities/numbers/Conversion.h"
 
+#include <fcntl.h>
 #include <fstream>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <cstdlib>
 #include <map>
@@ -40,6 +42,15 @@ void Settings::saveSettings() {
         return;
     }
 
+    /* The file may hold the server secret, so restrict it before anything is written to it */
+    const int fd = open(configFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0 || (!serverSecret.empty() && fchmod(fd, 0600) < 0)) {
+        Utility::error("Could not open settings file for writing");
+        if (fd >= 0) close(fd);
+        return;
+    }
+    close(fd);
+
     std::ofstream file(configFilePath);
     if (!file.is_open()) {
         Utility::error("Could not open settings file for writing");
@@ -50,7 +61,11 @@ void Settings::saveSettings() {
         file << "device" << i << " = " << devices[i].deviceStr << "\n";
         file << "button" << i << " = " << devices[i].button << "\n";
         file << "exclusive" << i << " = " << devices[i].exclusive << "\n";
+        file << "debounce" << i << " = " << devices[i].debounceMs << "\n";
+        file << "remap" << i << " = " << devices[i].remap << "\n";
     }
+    file << "server = " << serverAddress << "\n";
+    file << "secret = " << serverSecret << "\n";
     file << "pttonpath = " << sPttOnPath << "\n";
     file << "pttoffpath = " << sPttOffPath << "\n";
     file << "volume = " << std::fixed << sVolume << "\n";
@@ -93,6 +108,22 @@ void Settings::loadSettings() {
             if (indexResult.success && indexResult.value >= 0) {
                 tempDevices[indexResult.value].exclusive = safeStrToBool(value);
             }
+        } else if (key.starts_with("debounce")) {
+            auto indexResult = safeStrToInt(key.substr(8));
+            auto valueResult = safeStrToInt(value);
+            if (indexResult.success && valueResult.success && indexResult.value >= 0 &&
+                valueResult.value >= 0 && valueResult.value <= UINT16_MAX) {
+                tempDevices[indexResult.value].debounceMs = static_cast<uint16_t>(valueResult.value);
+            }
+        } else if (key.starts_with("remap")) {
+            auto indexResult = safeStrToInt(key.substr(5));
+            if (indexResult.success && indexResult.value >= 0) {
+                tempDevices[indexResult.value].remap = value;
+            }
+        } else if (key == "server") {
+            serverAddress = value;
+        } else if (key == "secret") {
+            serverSecret = value;
         } else if (key == "pttonpath") {
             sPttOnPath = value;
         } else if (key == "pttoffpath") {
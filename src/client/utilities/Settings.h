@@ -12,6 +12,9 @@ struct DeviceSettings {
     std::string deviceStr;
     int button;
     bool exclusive;
+    uint16_t debounceMs = 0;
+    /* Comma separated "from:to" key codes, "to" may also be "drop" or "ptt" */
+    std::string remap;
 
     [[nodiscard]] uint32_t getVendorID() const {
         const auto result = safeStrToUInt32(Utility::split(deviceStr, ':')[0]);
@@ -27,6 +30,25 @@ struct DeviceSettings {
         const auto result = safeStrToUInt32(Utility::split(deviceStr, ':')[2]);
         return result.success ? result.value : 0;
     }
+
+    [[nodiscard]] std::vector<RemapEntry> getRemap() const {
+        std::vector<RemapEntry> entries;
+        for (const std::string &item: Utility::split(remap, ',')) {
+            const auto parts = Utility::split(item, ':');
+            if (parts.size() != 2) continue;
+
+            const auto from = safeStrToUInt16(parts[0]);
+            auto to = safeStrToUInt16(parts[1]);
+            if (parts[1] == "drop" || parts[1] == "ptt") {
+                to.value = parts[1] == "drop" ? REMAP_DROP : REMAP_TO_PTT;
+                to.success = true;
+            }
+            if (from.success && to.success && entries.size() < MAX_REMAP_ENTRIES) {
+                entries.push_back({from.value, to.value});
+            }
+        }
+        return entries;
+    }
 };
 
 class Settings {
@@ -34,6 +56,9 @@ public:
     static Settings settings;
 
     std::vector<DeviceSettings> devices;
+    /* "host:port" of a ptt-server TCP listener, empty for the local socket */
+    std::string serverAddress;
+    std::string serverSecret;
     std::string sPttOnPath;
     std::string sPttOffPath;
     float sVolume;
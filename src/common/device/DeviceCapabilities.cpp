@@ -1,6 +1,9 @@
 #include "DeviceCapabilities.h"
+#include <charconv>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
-#include <sstream>
+#include <string_view>
 #include <zlib.h>
 #include <sys/ioctl.h>
 #include <stdexcept>
@@ -21,76 +24,178 @@ bool DeviceUtils::test_bit(const int bit, const unsigned long *arr) {
     return (arr[bit / (sizeof(long) * 8)] >> (bit % (sizeof(long) * 8))) & 1;
 }
 
+void DeviceUtils::read_device_name(const int fd, char *name, const size_t size) {
+    /* UIDs of devices without a readable name have always hashed an empty name, saved configs depend on it */
+    if (ioctl(fd, EVIOCGNAME(size), name) < 0) {
+        name[0] = '\0';
+    }
+    name[size - 1] = '\0';
+}
+
 DeviceCapabilities DeviceUtils::get_device_capabilities(const int fd) {
     DeviceCapabilities caps;
 
-    char name[256] = "Unknown";
-    if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) >= 0) {
-        caps.name = name;
-    }
+    char name[256];
+    read_device_name(fd, name, sizeof(name));
+    caps.name = name;
 
-    unsigned long key_bits_raw[KEY_MAX / (sizeof(long) * 8) + 1] = {};
-    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key_bits_raw)), key_bits_raw) >= 0) {
-        for (int i = 0; i <= KEY_MAX; ++i) {
-            if (test_bit(i, key_bits_raw)) {
-                caps.key_bits.set(i);
-                caps.num_keys++;
-            }
+    caps.ev_bits.read(fd, 0);
+    caps.key_bits.read(fd, EV_KEY);
+    caps.abs_bits.read(fd, EV_ABS);
+    caps.rel_bits.read(fd, EV_REL);
+    caps.msc_bits.read(fd, EV_MSC);
+    caps.led_bits.read(fd, EV_LED);
+
+    caps.num_keys = static_cast<int>(caps.key_bits.count());
+
+    caps.abs_bits.for_each([&](const int code) {
+        if (ioctl(fd, EVIOCGABS(code), &caps.abs_info[code]) >= 0) {
+            caps.abs_info_valid.set(code);
         }
-    }
+    });
 
-    unsigned long abs_bits_raw[ABS_MAX / (sizeof(long) * 8) + 1] = {};
-    if (ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits_raw)), abs_bits_raw) >= 0) {
-        for (int i = 0; i <= ABS_MAX; ++i) {
-            if (test_bit(i, abs_bits_raw)) {
-                caps.abs_bits.set(i);
+    return caps;
+}
 
-                struct input_absinfo absinfo{};
-                if (ioctl(fd, EVIOCGABS(i), &absinfo) >= 0) {
-                    caps.abs_info[i] = absinfo;
+namespace {
+    /**
+     *  Streams the UID description string straight into CRC32 through a small stack buffer.
+     *  Produces exactly the same checksum as building the whole string first.
+     */
+    class UidHasher {
+    public:
+        void append(const std::string_view text) {
+            if (text.size() > sizeof(buffer_) - used_) {
+                flush();
+                if (text.size() > sizeof(buffer_)) {
+                    crc_ = crc32(crc_, reinterpret_cast<const Bytef *>(text.data()), text.size());
+                    return;
                 }
             }
+            std::memcpy(buffer_ + used_, text.data(), text.size());
+            used_ += text.size();
         }
-    }
 
-    unsigned long rel_bits_raw[REL_MAX / (sizeof(long) * 8) + 1] = {};
-    if (ioctl(fd, EVIOCGBIT(EV_REL, sizeof(rel_bits_raw)), rel_bits_raw) >= 0) {
-        for (int i = 0; i <= REL_MAX; ++i) {
-            if (test_bit(i, rel_bits_raw)) {
-                caps.rel_bits.set(i);
-            }
+        void append(const char c) {
+            if (used_ == sizeof(buffer_)) flush();
+            buffer_[used_++] = c;
         }
-    }
 
-    return caps;
-}
+        void append_int(const long value) {
+            char digits[24];
+            const auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+            append(std::string_view(digits, end - digits));
+        }
 
-uint32_t DeviceUtils::generate_uid(const DeviceCapabilities &caps) {
-    std::stringstream ss;
+        /* Separators are emitted lazily so the trailing ',' of the legacy format is dropped */
+        void separate() {
+            if (pending_comma_) append(',');
+            pending_comma_ = true;
+        }
 
-    ss << caps.name << ":" << caps.num_keys << ":";
+        uint32_t finish() {
+            flush();
+            return static_cast<uint32_t>(crc_);
+        }
 
-    for (int i = 0; i <= KEY_MAX; ++i) {
-        if (caps.key_bits.test(i)) ss << "K" << i << ",";
-    }
+    private:
+        char buffer_[512]{};
+        size_t used_ = 0;
+        uLong crc_ = crc32(0, nullptr, 0);
+        bool pending_comma_ = false;
 
-    for (int i = 0; i <= ABS_MAX; ++i) {
-        if (caps.abs_bits.test(i)) {
-            ss << "A" << i;
-            const auto &absinfo = caps.abs_info.at(i);
-            ss << ":" << absinfo.minimum << "," << absinfo.maximum << ","
-               << absinfo.fuzz << "," << absinfo.flat << "," << absinfo.resolution << ",";
+        void flush() {
+            if (used_ == 0) return;
+            crc_ = crc32(crc_, reinterpret_cast<const Bytef *>(buffer_), used_);
+            used_ = 0;
         }
+    };
+
+    /**
+     *  Hashes "name:num_keys:K<code>,...,A<code>:<min>,<max>,<fuzz>,<flat>,<res>,...,R<code>"
+     *  from raw EVIOCGBIT words, without materializing the string.
+     */
+    template<typename AbsInfoFn>
+    uint32_t hash_capabilities(const std::string_view name,
+                               const CapabilityBits<KEY_CNT> &key_bits,
+                               const CapabilityBits<ABS_CNT> &abs_bits,
+                               AbsInfoFn &&abs_info,
+                               const CapabilityBits<REL_CNT> &rel_bits) {
+        UidHasher hasher;
+        hasher.append(name);
+        hasher.append(':');
+        hasher.append_int(static_cast<long>(key_bits.count()));
+        hasher.append(':');
+
+        key_bits.for_each([&](const int code) {
+            hasher.separate();
+            hasher.append('K');
+            hasher.append_int(code);
+        });
+
+        abs_bits.for_each([&](const int code) {
+            const input_absinfo &absinfo = abs_info(code);
+            hasher.separate();
+            hasher.append('A');
+            hasher.append_int(code);
+            hasher.append(':');
+            hasher.append_int(absinfo.minimum);
+            hasher.append(',');
+            hasher.append_int(absinfo.maximum);
+            hasher.append(',');
+            hasher.append_int(absinfo.fuzz);
+            hasher.append(',');
+            hasher.append_int(absinfo.flat);
+            hasher.append(',');
+            hasher.append_int(absinfo.resolution);
+        });
+
+        rel_bits.for_each([&](const int code) {
+            hasher.separate();
+            hasher.append('R');
+            hasher.append_int(code);
+        });
+
+        return hasher.finish();
     }
+}
 
-    for (int i = 0; i <= REL_MAX; ++i) {
-        if (caps.rel_bits.test(i)) ss << "R" << i << ",";
-    }
+uint32_t DeviceUtils::generate_uid(const DeviceCapabilities &caps) {
+    return hash_capabilities(caps.name, caps.key_bits, caps.abs_bits,
+                             [&](const int code) -> const input_absinfo & {
+                                 if (!caps.abs_info_valid.test(code)) {
+                                     throw std::out_of_range("Missing absinfo for ABS[" + std::to_string(code) + "]");
+                                 }
+                                 return caps.abs_info[code];
+                             },
+                             caps.rel_bits);
+}
 
-    std::string uid_str = ss.str();
-    if (!uid_str.empty() && uid_str.back() == ',') {
-        uid_str.pop_back();
-    }
+uint32_t DeviceUtils::generate_uid(const int fd) {
+    char name[256];
+    read_device_name(fd, name, sizeof(name));
+
+    CapabilityBits<KEY_CNT> key_bits;
+    CapabilityBits<ABS_CNT> abs_bits;
+    CapabilityBits<REL_CNT> rel_bits;
+    key_bits.read(fd, EV_KEY);
+    abs_bits.read(fd, EV_ABS);
+    rel_bits.read(fd, EV_REL);
+
+    std::array<input_absinfo, ABS_CNT> abs_info{};
+    abs_bits.for_each([&](const int code) {
+        if (ioctl(fd, EVIOCGABS(code), &abs_info[code]) < 0) {
+            throw std::runtime_error("Failed to read absinfo for ABS[" + std::to_string(code) + "]");
+        }
+    });
+
+    return hash_capabilities(name, key_bits, abs_bits,
+                             [&](const int code) -> const input_absinfo & { return abs_info[code]; },
+                             rel_bits);
+}
 
-    return crc32(0, reinterpret_cast<const Bytef *>(uid_str.data()), uid_str.size());
+std::string DeviceUtils::format_device_id(const uint16_t vendor_id, const uint16_t product_id, const uint32_t uid) {
+    char id[32];
+    snprintf(id, sizeof(id), "0x%04x:0x%04x:0x%08x", vendor_id, product_id, uid);
+    return id;
 }
@@ -1,22 +1,90 @@
 #ifndef DEVICECAPABILITIES_H
 #define DEVICECAPABILITIES_H
 
-#include <bitset>
+#include <array>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
 #include <string>
+#include <sys/ioctl.h>
 #include <linux/input-event-codes.h>
-#include <bitset>
 #include <linux/input.h>
-#include <unordered_map>
+
+/**
+ * Fixed-size bitmap laid out exactly like the words returned by EVIOCGBIT,
+ * iterated with ctz/popcount instead of testing one bit at a time.
+ */
+template<size_t Bits>
+struct CapabilityBits {
+    static constexpr size_t BITS_PER_WORD = sizeof(unsigned long) * 8;
+    static constexpr size_t WORDS = (Bits + BITS_PER_WORD - 1) / BITS_PER_WORD;
+
+    unsigned long words[WORDS]{};
+
+    [[nodiscard]] bool test(const size_t bit) const {
+        return bit < Bits && (words[bit / BITS_PER_WORD] >> (bit % BITS_PER_WORD)) & 1UL;
+    }
+
+    void set(const size_t bit) {
+        if (bit < Bits) words[bit / BITS_PER_WORD] |= 1UL << (bit % BITS_PER_WORD);
+    }
+
+    void reset(const size_t bit) {
+        if (bit < Bits) words[bit / BITS_PER_WORD] &= ~(1UL << (bit % BITS_PER_WORD));
+    }
+
+    void clear() {
+        for (auto &word: words) word = 0;
+    }
+
+    [[nodiscard]] size_t count() const {
+        size_t total = 0;
+        for (const auto word: words) total += std::popcount(word);
+        return total;
+    }
+
+    [[nodiscard]] bool any() const {
+        for (const auto word: words) {
+            if (word) return true;
+        }
+        return false;
+    }
+
+    template<typename Fn>
+    void for_each(Fn &&fn) const {
+        for (size_t w = 0; w < WORDS; ++w) {
+            unsigned long word = words[w];
+            while (word) {
+                fn(static_cast<int>(w * BITS_PER_WORD + std::countr_zero(word)));
+                word &= word - 1;
+            }
+        }
+    }
+
+    /**
+     *  Loads the bitmap from EVIOCGBIT(ev_type). Leaves it empty on failure.
+     */
+    bool read(const int fd, const int ev_type) {
+        if (ioctl(fd, EVIOCGBIT(ev_type, sizeof(words)), words) < 0) {
+            clear();
+            return false;
+        }
+        return true;
+    }
+};
 
 struct DeviceCapabilities {
     std::string name;
 
-    std::bitset<KEY_MAX + 1> key_bits;
-    std::bitset<ABS_MAX + 1> abs_bits;
-    std::bitset<REL_MAX + 1> rel_bits;
+    CapabilityBits<EV_CNT> ev_bits;
+    CapabilityBits<KEY_CNT> key_bits;
+    CapabilityBits<ABS_CNT> abs_bits;
+    CapabilityBits<REL_CNT> rel_bits;
+    CapabilityBits<MSC_CNT> msc_bits;
+    CapabilityBits<LED_CNT> led_bits;
 
-    std::unordered_map<int, input_absinfo> abs_info;
+    std::array<input_absinfo, ABS_CNT> abs_info{};
+    CapabilityBits<ABS_CNT> abs_info_valid;
 
     int num_keys = 0;
 };
@@ -24,11 +92,28 @@ struct DeviceCapabilities {
 namespace DeviceUtils {
     uint16_t read_id_from_file(const std::string &path);
 
+    /**
+     *  Reads EVIOCGNAME into a NUL-terminated buffer, leaving it empty if the device has no name.
+     *  Both generate_uid() paths go through here so they hash the same name.
+     */
+    void read_device_name(int fd, char *name, size_t size);
+
     DeviceCapabilities get_device_capabilities(int fd);
 
     uint32_t generate_uid(const DeviceCapabilities &caps);
 
+    /**
+     *  Computes the same UID as generate_uid(get_device_capabilities(fd)),
+     *  reading capability words straight from the device without heap allocation.
+     */
+    uint32_t generate_uid(int fd);
+
     bool test_bit(int bit, const unsigned long *arr);
+
+    /**
+     *  Formats a device identity the way configs expect it, e.g. "0x046d:0xc52b:0x1a2b3c4d".
+     */
+    std::string format_device_id(uint16_t vendor_id, uint16_t product_id, uint32_t uid);
 }
 
 #endif // DEVICECAPABILITIES_H
@@ -1,8 +1,16 @@
 #pragma once
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <vector>
 #include <string>
+#include <stdexcept>
+#include <thread>
+#include <netdb.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -10,6 +18,20 @@
 
 #define SOCKET_PATH "/tmp/input_proxy.sock"
 #define PING_INTERVAL_MS 30000
+#define MAX_PACKET_PAYLOAD (1024 * 1024)
+
+/*
+ * Protocol versions, negotiated through the HAND_SHAKE payload:
+ *  1 - empty handshake, KEY_EVENT payloads
+ *  2 - HandshakePayload, KEY_EVENT_V2 with kernel timestamp and sequence number
+ *  3 - DeviceConfig.debounce_ms, KEY_EVENTs are only sent on press/release edges
+ *  4 - resume tokens in HandshakePayload, BYE
+ *  5 - STATS, also accepted before CONFIG_LIST
+ *  6 - DEVICE_LIST, DEVICE_WATCH and DEVICE_KEY
+ *  7 - remap tables after each DeviceConfig in CONFIG_LIST
+ *  8 - HandshakeSecret after HandshakePayload, required on TCP connections
+ */
+#define PROTOCOL_VERSION 8
 
 struct sockaddr;
 
@@ -26,10 +48,23 @@ enum class ControlType : uint16_t {
     ERROR = 4,
     PING = 5,
     PONG = 6,
+    /* Client is going away for good, its session must not be kept for resumption */
+    BYE = 7,
+    /* Empty request; the reply carries "name value" text lines of server counters and latencies */
+    STATS = 8,
+    /* Empty request; the reply has one "id<TAB>path<TAB>capabilities<TAB>name" line per input device.
+     * Local clients only, TCP clients get an ERROR */
+    DEVICE_LIST = 9,
+    /* Optional uint8 payload, 1 (default) starts and 0 stops DEVICE_KEY notifications; answered with ACK.
+     * Local clients only, TCP clients get an ERROR */
+    DEVICE_WATCH = 10,
 };
 
 enum class EventType : uint16_t {
     KEY_EVENT = 1,
+    KEY_EVENT_V2 = 2,
+    /* Key pressed on any input device, sent while DEVICE_WATCH is on */
+    DEVICE_KEY = 3,
 };
 
 struct PacketHeader {
@@ -39,12 +74,106 @@ struct PacketHeader {
     uint16_t flags;
 };
 
+/* Protocol 2 and 3 peers only exchange the leading version field */
+#define HANDSHAKE_PAYLOAD_V2_SIZE 4
+
+#define HANDSHAKE_FLAG_RESUMED 0x1
+
+struct HandshakePayload {
+    uint16_t version{};
+    uint16_t flags{};
+    uint32_t _pad{};
+    /* Client: token of the session to resume, 0 for a new one. Server: token for the next reconnect */
+    uint64_t resume_token{};
+};
+
+#define HANDSHAKE_SECRET_SIZE 64
+
+/* Shared secret a TCP client presents right after its HandshakePayload, zero padded */
+struct HandshakeSecret {
+    char secret[HANDSHAKE_SECRET_SIZE]{};
+};
+
 struct KeyEventPayload {
     int32_t key{};
     uint8_t state{};
     uint8_t _pad[3]{};
 };
 
+struct KeyEventPayloadV2 {
+    int32_t key{};
+    uint8_t state{};
+    uint8_t _pad[3]{};
+    /* Per-session counter, gaps mean events were lost */
+    uint32_t sequence{};
+    uint32_t _pad2{};
+    /* CLOCK_MONOTONIC time the kernel stamped the input event, in microseconds */
+    uint64_t timestamp_us{};
+};
+
+struct DeviceKeyPayload {
+    uint16_t vendor_id{};
+    uint16_t product_id{};
+    uint32_t uid{};
+    int32_t key{};
+    uint32_t _pad{};
+};
+
+/**
+ *  Serializes a CONFIG_LIST payload. Peers older than protocol 7 get bare
+ *  DeviceConfigs and no remap tables.
+ */
+inline std::vector<uint8_t> encode_config_list(const std::vector<DeviceSetup> &setups, const uint16_t version) {
+    std::vector<uint8_t> payload;
+    for (const auto &setup: setups) {
+        DeviceConfig config = setup;
+        const size_t remap_count = version >= 7 ? std::min<size_t>(setup.remap.size(), MAX_REMAP_ENTRIES) : 0;
+        config.remap_count = static_cast<uint8_t>(remap_count);
+
+        const auto *bytes = reinterpret_cast<const uint8_t *>(&config);
+        payload.insert(payload.end(), bytes, bytes + sizeof(config));
+        const auto *entries = reinterpret_cast<const uint8_t *>(setup.remap.data());
+        payload.insert(payload.end(), entries, entries + remap_count * sizeof(RemapEntry));
+    }
+    return payload;
+}
+
+/**
+ *  Parses a CONFIG_LIST payload sent by a peer speaking the given protocol version.
+ *  Throws on a truncated payload.
+ */
+inline std::vector<DeviceSetup> decode_config_list(const std::vector<uint8_t> &payload, const uint16_t version) {
+    std::vector<DeviceSetup> setups;
+    size_t offset = 0;
+    while (offset < payload.size()) {
+        if (payload.size() - offset < sizeof(DeviceConfig)) {
+            throw std::runtime_error("Invalid CONFIG_LIST payload size");
+        }
+        DeviceSetup &setup = setups.emplace_back();
+        DeviceConfig config{};
+        std::memcpy(&config, payload.data() + offset, sizeof(config));
+        static_cast<DeviceConfig &>(setup) = config;
+        offset += sizeof(DeviceConfig);
+
+        if (version < 3) {
+            /* Older clients leave these bytes as uninitialized padding */
+            setup.debounce_ms = 0;
+        }
+        if (version < 7) {
+            setup.remap_count = 0;
+        }
+
+        const size_t remap_bytes = setup.remap_count * sizeof(RemapEntry);
+        if (payload.size() - offset < remap_bytes) {
+            throw std::runtime_error("Truncated remap table in CONFIG_LIST");
+        }
+        setup.remap.resize(setup.remap_count);
+        std::memcpy(setup.remap.data(), payload.data() + offset, remap_bytes);
+        offset += remap_bytes;
+    }
+    return setups;
+}
+
 inline std::string channel_to_string(uint16_t ch) {
     switch (static_cast<Channel>(ch)) {
         case Channel::Control: return "Control";
@@ -62,6 +191,10 @@ inline std::string control_type_to_string(uint16_t type) {
         case ControlType::ERROR: return "ERROR";
         case ControlType::PING: return "PING";
         case ControlType::PONG: return "PONG";
+        case ControlType::BYE: return "BYE";
+        case ControlType::STATS: return "STATS";
+        case ControlType::DEVICE_LIST: return "DEVICE_LIST";
+        case ControlType::DEVICE_WATCH: return "DEVICE_WATCH";
         default: return "Unknown(" + std::to_string(type) + ")";
     }
 }
@@ -69,31 +202,104 @@ inline std::string control_type_to_string(uint16_t type) {
 inline std::string event_type_to_string(uint16_t type) {
     switch (static_cast<EventType>(type)) {
         case EventType::KEY_EVENT: return "KEY_EVENT";
+        case EventType::KEY_EVENT_V2: return "KEY_EVENT_V2";
+        case EventType::DEVICE_KEY: return "DEVICE_KEY";
         default: return "Unknown(" + std::to_string(type) + ")";
     }
 }
 
-inline int connect_to_server() {
+/**
+ *  Splits "host:port" or "[v6-host]:port". Returns false if there is no port.
+ */
+inline bool split_host_port(const std::string &address, std::string &host, std::string &port) {
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size()) return false;
+
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    return true;
+}
+
+inline int open_unix_connection() {
     sockaddr_un addr{};
     addr.sun_family = AF_UNIX;
     strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
 
-    while (true) {
-        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        Utility::error("socket() failed: " + std::string(strerror(errno)));
+        return -1;
+    }
+
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+        return fd;
+    }
+
+    const int err = errno;
+    close(fd);
+    Utility::error("connect() failed: " + std::string(strerror(err)) + " — retrying...");
+    return -1;
+}
+
+/**
+ *  Connects to a "host:port" TCP listener with Nagle's algorithm off, so every key packet leaves at once.
+ */
+inline int open_tcp_connection(const std::string &address) {
+    std::string host, port;
+    if (!split_host_port(address, host, port)) {
+        Utility::error("Invalid server address '" + address + "', expected host:port");
+        return -1;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    if (const int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &result); err != 0) {
+        Utility::error("Can't resolve " + address + ": " + gai_strerror(err) + " — retrying...");
+        return -1;
+    }
+
+    int fd = -1;
+    int err = 0;
+    for (const addrinfo *ai = result; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
         if (fd < 0) {
-            Utility::error("socket() failed: " + std::string(strerror(errno)));
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+            err = errno;
             continue;
         }
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        err = errno;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        Utility::error("connect() to " + address + " failed: " + std::string(strerror(err)) + " — retrying...");
+        return -1;
+    }
+
+    constexpr int nodelay = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0) {
+        Utility::error("Failed to set TCP_NODELAY: " + std::string(strerror(errno)));
+    }
+    return fd;
+}
 
-        if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+/**
+ *  Connects to the local server socket, or to a TCP listener when an address is given,
+ *  retrying every second until it succeeds.
+ */
+inline int connect_to_server(const std::string &address = {}) {
+    while (true) {
+        if (const int fd = address.empty() ? open_unix_connection() : open_tcp_connection(address); fd >= 0) {
             Utility::debugPrint("Connected to the server");
             return fd;
         }
-
-        const int err = errno;
-        close(fd);
-        Utility::error("connect() failed: " + std::string(strerror(err)) + " — retrying...");
         std::this_thread::sleep_for(std::chrono::seconds(1));
     }
 }
@@ -153,17 +359,17 @@ inline bool write_packet(const int fd, Channel ch, const uint16_t type,
     return true;
 }
 
-inline bool write_packet_safe(int &fd, const Channel ch, const uint16_t type, const void *data, const uint32_t len,
-                              const uint16_t flags = 0) {
+inline bool write_packet_safe(int &fd, const std::string &address, const Channel ch, const uint16_t type,
+                              const void *data, const uint32_t len, const uint16_t flags = 0) {
     if (fd < 0) {
-        fd = connect_to_server();
+        fd = connect_to_server(address);
         if (fd < 0) return false;
     }
 
     if (!write_packet(fd, ch, type, data, len, flags)) {
         Utility::error("write_packet failed, trying to reconnect...");
         close(fd);
-        fd = connect_to_server();
+        fd = connect_to_server(address);
         if (fd < 0) return false;
         return write_packet(fd, ch, type, data, len, flags);
     }
@@ -208,22 +414,47 @@ inline bool read_packet(const int fd, PacketHeader &hdr, std::vector<uint8_t> &p
     return true;
 }
 
-inline void send_ack(int fd) {
-    Utility::debugPrint("Sending ACK to fd=" + std::to_string(fd));
-    write_packet_safe(fd, Channel::Control, static_cast<uint16_t>(ControlType::ACK), nullptr, 0);
-}
+/**
+ *  Reassembles packets from a non-blocking stream.
+ *  Bytes are fed as they arrive; complete packets are extracted with next().
+ */
+class PacketReader {
+public:
+    void feed(const uint8_t *data, const size_t len) {
+        if (offset_ > 0) {
+            buffer_.erase(buffer_.begin(), buffer_.begin() + static_cast<std::ptrdiff_t>(offset_));
+            offset_ = 0;
+        }
+        buffer_.insert(buffer_.end(), data, data + len);
+    }
 
-inline void send_error(int fd, const std::string &msg) {
-    Utility::debugPrint("Sending ERROR to fd=" + std::to_string(fd) +
-                        " msg=" + msg);
-    write_packet_safe(fd, Channel::Control, static_cast<uint16_t>(ControlType::ERROR),
-                      msg.data(), static_cast<uint32_t>(msg.size()));
-}
+    /**
+     *  Extracts the next complete packet.
+     *  Returns false if more data is needed, throws on a malformed header.
+     */
+    bool next(PacketHeader &hdr, std::vector<uint8_t> &payload) {
+        if (buffer_.size() - offset_ < sizeof(PacketHeader)) return false;
+
+        PacketHeader h{};
+        std::memcpy(&h, buffer_.data() + offset_, sizeof(h));
+        if (h.length > MAX_PACKET_PAYLOAD) {
+            throw std::runtime_error("Packet payload too large: " + std::to_string(h.length));
+        }
+        if (buffer_.size() - offset_ < sizeof(PacketHeader) + h.length) return false;
 
-inline void send_key_event(int fd, const int key, const bool state) {
-    Utility::debugPrint("Sending KEY_EVENT to fd=" + std::to_string(fd) +
-                        " key=" + std::to_string(key) +
-                        " state=" + std::to_string(state));
-    const KeyEventPayload p{key, static_cast<uint8_t>(state ? 1 : 0)};
-    write_packet_safe(fd, Channel::Events, static_cast<uint16_t>(EventType::KEY_EVENT), &p, sizeof(p));
-}
+        hdr = h;
+        const auto begin = buffer_.begin() + static_cast<std::ptrdiff_t>(offset_ + sizeof(PacketHeader));
+        payload.assign(begin, begin + h.length);
+        offset_ += sizeof(PacketHeader) + h.length;
+
+        if (offset_ == buffer_.size()) {
+            buffer_.clear();
+            offset_ = 0;
+        }
+        return true;
+    }
+
+private:
+    std::vector<uint8_t> buffer_;
+    size_t offset_ = 0;
+};
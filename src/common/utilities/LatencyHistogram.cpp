@@ -0,0 +1,76 @@
+#include "LatencyHistogram.h"
+
+#include <bit>
+#include <ctime>
+
+void LatencyHistogram::record(const uint64_t micros) {
+    size_t index = micros == 0 ? 0 : static_cast<size_t>(std::bit_width(micros));
+    if (index >= LATENCY_HISTOGRAM_BUCKETS) index = LATENCY_HISTOGRAM_BUCKETS - 1;
+
+    buckets_[index].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t current = max_.load(std::memory_order_relaxed);
+    while (micros > current && !max_.compare_exchange_weak(current, micros, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (auto &bucket: buckets_) bucket.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+    return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::max() const {
+    return max_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(const double pct) const {
+    const uint64_t total = count();
+    if (total == 0) return 0;
+
+    const auto target = static_cast<uint64_t>(static_cast<double>(total) * pct / 100.0 + 0.5);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i) {
+        seen += bucket(i);
+        if (seen >= target && seen > 0) return bucket_upper_bound(i);
+    }
+    return bucket_upper_bound(LATENCY_HISTOGRAM_BUCKETS - 1);
+}
+
+uint64_t LatencyHistogram::bucket(const size_t index) const {
+    return buckets_[index].load(std::memory_order_relaxed);
+}
+
+std::string LatencyHistogram::summary() const {
+    return "n=" + std::to_string(count()) +
+           " p50<=" + std::to_string(percentile(50)) + "us" +
+           " p90<=" + std::to_string(percentile(90)) + "us" +
+           " p99<=" + std::to_string(percentile(99)) + "us" +
+           " max=" + std::to_string(max()) + "us";
+}
+
+std::string LatencyHistogram::buckets_string() const {
+    std::string out;
+    for (size_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i) {
+        const uint64_t n = bucket(i);
+        if (n == 0) continue;
+        if (!out.empty()) out += ",";
+        out += std::to_string(bucket_upper_bound(i)) + ":" + std::to_string(n);
+    }
+    return out.empty() ? "-" : out;
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(const size_t index) {
+    return (uint64_t{1} << index) - 1;
+}
+
+uint64_t monotonic_micros() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
@@ -0,0 +1,57 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define LATENCY_HISTOGRAM_BUCKETS 32
+
+/**
+ * Lock-free latency histogram with power-of-two microsecond buckets.
+ *
+ * Bucket i counts samples in [2^(i-1), 2^i) us, bucket 0 counts samples below 1 us.
+ * Recording is a couple of relaxed atomic increments, cheap enough for hot paths.
+ */
+class LatencyHistogram {
+public:
+    void record(uint64_t micros);
+
+    void reset();
+
+    [[nodiscard]] uint64_t count() const;
+
+    [[nodiscard]] uint64_t max() const;
+
+    /**
+     *  Upper bound of the bucket containing the given percentile (0-100), in microseconds.
+     */
+    [[nodiscard]] uint64_t percentile(double pct) const;
+
+    [[nodiscard]] uint64_t bucket(size_t index) const;
+
+    /**
+     *  One-line summary, e.g. "n=42 p50<=128us p99<=1024us max=900us".
+     */
+    [[nodiscard]] std::string summary() const;
+
+    /**
+     *  Non-empty buckets as "upper_bound:count" pairs, e.g. "127:3,255:40".
+     */
+    [[nodiscard]] std::string buckets_string() const;
+
+    static uint64_t bucket_upper_bound(size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, LATENCY_HISTOGRAM_BUCKETS> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+/**
+ *  Current CLOCK_MONOTONIC time in microseconds, the clock evdev timestamps are switched to.
+ */
+uint64_t monotonic_micros();
+
+#endif // LATENCYHISTOGRAM_H
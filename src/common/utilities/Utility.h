@@ -12,6 +12,32 @@ struct DeviceConfig {
     uint32_t uid;
     int target_key;
     bool exclusive;
+    /* RemapEntry items following this config in CONFIG_LIST (protocol >= 7) */
+    uint8_t remap_count = 0;
+    /* Edges of target_key closer than this to the previous one are held back, 0 disables (protocol >= 3) */
+    uint16_t debounce_ms = 0;
+};
+
+static_assert(sizeof(DeviceConfig) == 16, "DeviceConfig is sent over the wire");
+
+/* RemapEntry.to values besides plain key codes */
+#define REMAP_DROP 0
+#define REMAP_TO_PTT 0xFFFF
+/* Most RemapEntry items a single DeviceConfig can carry */
+#define MAX_REMAP_ENTRIES 255
+
+/* Rewrites a key code of an exclusive device before it reaches the virtual device */
+struct RemapEntry {
+    uint16_t from;
+    /* Key code, REMAP_DROP to swallow the key, or REMAP_TO_PTT to make it act as target_key */
+    uint16_t to;
+};
+
+static_assert(sizeof(RemapEntry) == 4, "RemapEntry is sent over the wire");
+
+/* A DeviceConfig together with its remap table, as sessions hand it to the server */
+struct DeviceSetup : DeviceConfig {
+    std::vector<RemapEntry> remap;
 };
 
 struct InitParams {
@@ -1,29 +1,194 @@
 #include "InputProxyServer.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <fcntl.h>
 #include <grp.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <cstring>
+#include <fstream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <ranges>
 #include <stdexcept>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <sys/stat.h>
 
 #include "common/utilities/Utility.h"
-#include "device/VirtualInputProxy.h"
+#include "common/utilities/numbers/Conversion.h"
 #include "common/protocol/Packets.h"
+#include "device/PreloadConfig.h"
+#include "stats/ServerStats.h"
 
 #define CONTROL_GROUP "ptt"
+#define SESSION_RESUME_GRACE_MS 10000
+/* First fd passed by systemd socket activation (SD_LISTEN_FDS_START) */
+#define LISTEN_FDS_START 3
+#define SHARED_SECRET_PATH "/etc/ptt/secret"
+
+std::atomic<std::chrono::seconds> InputProxyServer::idle_timeout_{std::chrono::seconds(0)};
+std::atomic<bool> InputProxyServer::preload_{false};
+std::string InputProxyServer::tcp_address_;
+
+void InputProxyServer::set_idle_timeout(const std::chrono::seconds timeout) {
+    idle_timeout_ = timeout;
+}
+
+void InputProxyServer::set_preload(const bool enabled) {
+    preload_ = enabled;
+}
+
+void InputProxyServer::set_tcp_address(const std::string &address) {
+    tcp_address_ = address;
+}
 
 void InputProxyServer::run() {
-    setup_socket();
-    accept_connections();
+    socket_activated_ = adopt_activated_socket();
+    if (!socket_activated_) {
+        setup_socket();
+    }
+    load_shared_secret();
+    if (!tcp_address_.empty()) {
+        setup_tcp_socket();
+    }
+    proxy_.start();
+    if (preload_) {
+        preload_devices();
+    }
+    if (!loop_.add(sock_fd_, EPOLLIN, [this](uint32_t) { accept_connections(sock_fd_); })) {
+        throw std::runtime_error("Failed to watch listening socket");
+    }
+    if (tcp_fd_ >= 0 && !loop_.add(tcp_fd_, EPOLLIN, [this](uint32_t) { accept_connections(tcp_fd_); })) {
+        throw std::runtime_error("Failed to watch TCP listening socket");
+    }
+
+    if (idle_timeout_.load().count() > 0 && !socket_activated_) {
+        Utility::print("Ignoring the idle timeout, it only applies to a socket-activated server");
+    }
+    on_sessions_changed();
+    loop_.run();
+}
+
+bool InputProxyServer::adopt_activated_socket() {
+    const char *listen_pid = getenv("LISTEN_PID");
+    const char *listen_fds = getenv("LISTEN_FDS");
+    if (!listen_pid || !listen_fds) return false;
+
+    const IntConversionResult pid = safeStrToInt(listen_pid);
+    const IntConversionResult fds = safeStrToInt(listen_fds);
+    /* Don't let children pick the variables up again */
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    if (!pid.success || pid.value != getpid()) return false;
+    if (!fds.success || fds.value < 1) return false;
+    if (fds.value > 1) {
+        Utility::print("Got " + std::to_string(fds.value) + " activated sockets, using the first one");
+    }
+
+    const int fd = LISTEN_FDS_START;
+    int type = 0;
+    int listening = 0;
+    socklen_t len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0 || type != SOCK_STREAM) {
+        Utility::error("Activated fd is not a stream socket, creating " SOCKET_PATH " instead");
+        return false;
+    }
+    len = sizeof(listening);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening) {
+        Utility::error("Activated socket is not listening, creating " SOCKET_PATH " instead");
+        return false;
+    }
+
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+        throw std::runtime_error("Failed to set up activated socket: " + std::string(strerror(errno)));
+    }
+    sock_fd_ = fd;
+    Utility::print("Listening on socket passed by systemd");
+    return true;
+}
+
+void InputProxyServer::preload_devices() {
+    preload_subscriber_ = proxy_.add_subscriber([](int, bool, uint64_t) {
+    });
+    preloaded_ = PreloadConfig::load();
+    proxy_.add_devices(preloaded_, preload_subscriber_);
+}
+
+void InputProxyServer::update_preload() {
+    if (!preload_subscriber_) return;
+
+    std::vector<DeviceSetup> wanted;
+    const auto collect = [&wanted](const ClientSession &session) {
+        for (const auto &config: session.configs()) {
+            if (std::ranges::none_of(wanted, [&](const DeviceSetup &c) {
+                return PreloadConfig::same_config(c, config);
+            })) {
+                wanted.push_back(config);
+            }
+        }
+    };
+    for (const auto &session: sessions_ | std::views::values) collect(*session);
+    for (const auto &parked: parked_ | std::views::values) collect(*parked.session);
+
+    /* Every wanted config is also bound by a session, so dropping first never releases a device in use */
+    for (const auto &config: preloaded_) {
+        if (std::ranges::none_of(wanted, [&](const DeviceSetup &c) {
+            return PreloadConfig::same_config(c, config);
+        })) {
+            proxy_.remove_device(config, preload_subscriber_);
+        }
+    }
+    for (const auto &config: wanted) {
+        if (std::ranges::none_of(preloaded_, [&](const DeviceSetup &c) {
+            return PreloadConfig::same_config(c, config);
+        })) {
+            proxy_.add_device(config, preload_subscriber_);
+        }
+    }
+
+    preloaded_ = std::move(wanted);
+    PreloadConfig::save(preloaded_);
+}
+
+void InputProxyServer::on_sessions_changed() {
+    ServerStats &stats = ServerStats::instance();
+    stats.sessions_active.store(sessions_.size(), std::memory_order_relaxed);
+    stats.sessions_parked.store(parked_.size(), std::memory_order_relaxed);
+    update_idle_timer();
+}
+
+void InputProxyServer::update_idle_timer() {
+    const std::chrono::seconds timeout = idle_timeout_;
+    if (!socket_activated_ || timeout.count() <= 0) return;
+
+    const bool idle = sessions_.empty() && parked_.empty();
+    if (!idle) {
+        loop_.remove_timer(idle_timer_);
+        idle_timer_ = -1;
+        return;
+    }
+    if (idle_timer_ >= 0) return;
+
+    idle_timer_ = loop_.add_timer(timeout, [this] {
+        loop_.remove_timer(idle_timer_);
+        idle_timer_ = -1;
+        if (!sessions_.empty() || !parked_.empty()) return;
+
+        /* systemd keeps the socket open and starts us again on the next connection */
+        Utility::print("No sessions for " + std::to_string(idle_timeout_.load().count()) + "s, exiting");
+        loop_.stop();
+    });
 }
 
 void InputProxyServer::setup_socket() {
     sockaddr_un addr = {};
 
-    if ((sock_fd_ = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    if ((sock_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
         throw std::runtime_error("Socket creation failed: " + std::string(strerror(errno)));
     }
 
@@ -60,120 +225,178 @@ void InputProxyServer::setup_socket() {
         throw std::runtime_error("chmod failed: " + std::string(strerror(errno)));
     }
 
-    if (listen(sock_fd_, 5) < 0) {
+    if (listen(sock_fd_, SOMAXCONN) < 0) {
         close(sock_fd_);
         throw std::runtime_error("Listen failed: " + std::string(strerror(errno)));
     }
     Utility::print("Listening on " SOCKET_PATH);
 }
 
-[[noreturn]] void InputProxyServer::accept_connections() const {
-    while (true) {
-        sockaddr_un client_addr{};
-        socklen_t client_len = sizeof(client_addr);
+void InputProxyServer::load_shared_secret() {
+    std::ifstream file(SHARED_SECRET_PATH);
+    if (!file.is_open() || !std::getline(file, shared_secret_) || shared_secret_.empty()) {
+        shared_secret_.clear();
+        Utility::debugPrint("No shared secret in " SHARED_SECRET_PATH ", TCP clients will be refused");
+        return;
+    }
+    if (shared_secret_.size() > HANDSHAKE_SECRET_SIZE) {
+        Utility::print("Shared secret is longer than " + std::to_string(HANDSHAKE_SECRET_SIZE) +
+                       " bytes, only the beginning is used");
+        shared_secret_.resize(HANDSHAKE_SECRET_SIZE);
+    }
+}
 
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(sock_fd_, &read_fds);
+void InputProxyServer::setup_tcp_socket() {
+    if (shared_secret_.empty()) {
+        throw std::runtime_error("Listening on TCP needs a shared secret in " SHARED_SECRET_PATH);
+    }
 
-        if (const int result = select(sock_fd_ + 1, &read_fds, nullptr, nullptr, nullptr); result < 0) {
-            Utility::error("select() failed: " + std::string(strerror(errno)));
+    std::string host, port;
+    if (!split_host_port(tcp_address_, host, port)) {
+        throw std::runtime_error("Invalid TCP address '" + tcp_address_ + "', expected host:port");
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *result = nullptr;
+    if (const int err = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result); err != 0) {
+        throw std::runtime_error("Can't resolve " + tcp_address_ + ": " + gai_strerror(err));
+    }
+
+    std::string error = "no usable address";
+    for (const addrinfo *ai = result; ai && tcp_fd_ < 0; ai = ai->ai_next) {
+        const int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            error = strerror(errno);
             continue;
         }
 
-        if (FD_ISSET(sock_fd_, &read_fds)) {
-            const int client_fd = accept(sock_fd_,
-                                         reinterpret_cast<struct sockaddr *>(&client_addr),
-                                         &client_len);
-            if (client_fd < 0) {
-                continue;
-            }
-
-            handle_client(client_fd);
-            close(client_fd);
+        constexpr int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(fd, SOMAXCONN) < 0) {
+            error = strerror(errno);
+            close(fd);
+            continue;
         }
+        tcp_fd_ = fd;
     }
-}
+    freeaddrinfo(result);
 
-void InputProxyServer::handle_client(int client_fd) {
-    try {
-        ucred cred{};
-        socklen_t len = sizeof(cred);
+    if (tcp_fd_ < 0) {
+        throw std::runtime_error("Can't listen on " + tcp_address_ + ": " + error);
+    }
+    Utility::print("Listening on TCP " + tcp_address_);
+}
 
-        if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
-            throw std::runtime_error("Failed to get client credentials: " + std::string(strerror(errno)));
-        }
+void InputProxyServer::accept_connections(const int listen_fd) {
+    while (true) {
+        sockaddr_storage client_addr{};
+        socklen_t client_len = sizeof(client_addr);
 
-        PacketHeader hdr{};
-        std::vector<uint8_t> payload;
-        if (!read_packet(client_fd, hdr, payload)) {
-            throw std::runtime_error("Failed to read HAND_SHAKE packet");
-        }
-        if (hdr.channel != static_cast<uint16_t>(Channel::Control) ||
-            hdr.type != static_cast<uint16_t>(ControlType::HAND_SHAKE)) {
-            throw std::runtime_error("Expected HAND_SHAKE packet");
+        const int client_fd = accept4(listen_fd,
+                                      reinterpret_cast<struct sockaddr *>(&client_addr),
+                                      &client_len, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Utility::error("accept() failed: " + std::string(strerror(errno)));
+            }
+            return;
         }
 
-        send_ack(client_fd);
-
-        if (!read_packet(client_fd, hdr, payload)) {
-            throw std::runtime_error("Failed to read CONFIG_LIST packet");
-        }
-        if (hdr.channel != static_cast<uint16_t>(Channel::Control) ||
-            hdr.type != static_cast<uint16_t>(ControlType::CONFIG_LIST)) {
-            throw std::runtime_error("Expected CONFIG_LIST packet");
+        if (client_addr.ss_family == AF_INET || client_addr.ss_family == AF_INET6) {
+            /* Key packets are tiny, don't let Nagle hold them back for an ACK */
+            constexpr int nodelay = 1;
+            setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
         }
 
-        if (payload.size() % sizeof(DeviceConfig) != 0) {
-            throw std::runtime_error("Invalid CONFIG_LIST payload size");
+        try {
+            auto session = std::make_unique<ClientSession>(client_fd, loop_, proxy_,
+                                                           [this](const uint64_t token, const uid_t uid) {
+                                                               return resume_session(token, uid);
+                                                           },
+                                                           [this] { update_preload(); }, shared_secret_);
+            const auto on_data = [this, client_fd](const uint8_t *data, const ssize_t bytes) {
+                const auto it = sessions_.find(client_fd);
+                if (it != sessions_.end() && !it->second->on_received(data, bytes)) {
+                    close_session(client_fd);
+                }
+            };
+            const auto on_writable = [this, client_fd](uint32_t) {
+                const auto it = sessions_.find(client_fd);
+                if (it != sessions_.end() && !it->second->on_writable()) {
+                    close_session(client_fd);
+                }
+            };
+            if (!loop_.add_reader(client_fd, SESSION_EPOLL_EVENTS, on_data, on_writable)) {
+                continue;
+            }
+            sessions_[client_fd] = std::move(session);
+            ServerStats::add(ServerStats::instance().sessions_accepted);
+            on_sessions_changed();
+            Utility::debugPrint("Active sessions: " + std::to_string(sessions_.size()));
+        } catch (const std::exception &e) {
+            Utility::error("Client handling error: " + std::string(e.what()));
+            close(client_fd);
         }
+    }
+}
 
-        std::vector<DeviceConfig> configs(payload.size() / sizeof(DeviceConfig));
-        std::memcpy(configs.data(), payload.data(), payload.size());
+void InputProxyServer::close_session(const int client_fd) {
+    loop_.remove(client_fd);
+    if (auto node = sessions_.extract(client_fd); node && node.mapped()->can_resume()) {
+        park_session(std::move(node.mapped()));
+    }
+    on_sessions_changed();
+    Utility::debugPrint("Active sessions: " + std::to_string(sessions_.size()));
+}
 
-        for (const auto &[vendor_id, product_id, uid, target_key, exclusive]: configs) {
-            Utility::debugPrint("Config:");
-            Utility::debugPrint("vendor_id: " + std::to_string(vendor_id));
-            Utility::debugPrint("product_id: " + std::to_string(product_id));
-            Utility::debugPrint("uid: " + std::to_string(uid));
-            Utility::debugPrint("target_key: " + std::to_string(target_key));
-            Utility::debugPrint("exclusive: " + std::to_string(exclusive));
-        }
+void InputProxyServer::park_session(std::unique_ptr<ClientSession> session) {
+    const uint64_t token = session->resume_token();
+    session->detach();
 
-        send_ack(client_fd);
+    ParkedSession parked;
+    parked.session = std::move(session);
+    parked.expiry_timer = loop_.add_timer(std::chrono::milliseconds(SESSION_RESUME_GRACE_MS), [this, token] {
+        expire_session(token);
+    });
+    if (parked.expiry_timer < 0) return;
+    parked_[token] = std::move(parked);
+    on_sessions_changed();
+    Utility::debugPrint("Parked sessions: " + std::to_string(parked_.size()));
+}
 
-        VirtualInputProxy proxy;
-        for (const auto &config: configs) {
-            proxy.add_device(config);
+std::unique_ptr<ClientSession> InputProxyServer::resume_session(const uint64_t token, const uid_t uid) {
+    /* The reconnect may be handled before the old socket's hangup, take over the live session then */
+    for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+        if (it->second->resume_token() == token && it->second->can_resume() && it->second->peer_uid() == uid) {
+            loop_.remove(it->first);
+            auto session = std::move(it->second);
+            sessions_.erase(it);
+            session->detach();
+            on_sessions_changed();
+            return session;
         }
-        proxy.set_callback([client_fd](const int key, const bool state) {
-            send_key_event(client_fd, key, state);
-        });
-        proxy.start();
-
-        while (true) {
-            if (!read_packet(client_fd, hdr, payload)) {
-                Utility::print("Client disconnected");
-                break;
-            }
+    }
 
-            if (hdr.channel == static_cast<uint16_t>(Channel::Control)) {
-                switch (static_cast<ControlType>(hdr.type)) {
-                    case ControlType::PING:
-                        write_packet(client_fd, Channel::Control, static_cast<uint16_t>(ControlType::PONG),
-                                     nullptr, 0);
-                        break;
-                    default:
-                        Utility::debugPrint("Unhandled control packet: " + std::to_string(hdr.type));
-                        break;
-                }
-            }
-        }
+    const auto it = parked_.find(token);
+    if (it == parked_.end() || it->second.session->peer_uid() != uid) return nullptr;
 
-        shutdown(client_fd, SHUT_RDWR);
-    } catch (const std::exception &e) {
-        Utility::error("Client handling error: " + std::string(e.what()));
-    }
+    loop_.remove_timer(it->second.expiry_timer);
+    auto session = std::move(it->second.session);
+    parked_.erase(it);
+    on_sessions_changed();
+    return session;
+}
+
+void InputProxyServer::expire_session(const uint64_t token) {
+    const auto it = parked_.find(token);
+    if (it == parked_.end()) return;
 
-    close(client_fd);
+    Utility::debugPrint("Resume grace period over, releasing devices of a disconnected client");
+    loop_.remove_timer(it->second.expiry_timer);
+    parked_.erase(it);
+    on_sessions_changed();
 }
@@ -1,13 +1,103 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "device/EventLoop.h"
+#include "device/VirtualInputProxy.h"
+#include "session/ClientSession.h"
+
 class InputProxyServer {
 public:
     void run();
 
+    /**
+     *  Makes a socket-activated server exit once it has had no sessions for the given time.
+     *  Zero (the default) keeps it running forever.
+     */
+    static void set_idle_timeout(std::chrono::seconds timeout);
+
+    /**
+     *  Pre-grabs the devices from PRELOAD_CONFIG_PATH at startup and keeps that file
+     *  up to date with the configs of connected clients.
+     */
+    static void set_preload(bool enabled);
+
+    /**
+     *  Also accepts clients on a TCP "host:port", e.g. from a VM. They must present the
+     *  shared secret stored in SHARED_SECRET_PATH. Empty (the default) disables TCP.
+     */
+    static void set_tcp_address(const std::string &address);
+
 private:
+    static std::atomic<std::chrono::seconds> idle_timeout_;
+    static std::atomic<bool> preload_;
+    static std::string tcp_address_;
+
     int sock_fd_ = -1;
+    int tcp_fd_ = -1;
+    /* Required from TCP clients, empty if none is configured */
+    std::string shared_secret_;
+    /* Listening socket passed in by systemd rather than created here */
+    bool socket_activated_ = false;
+    int idle_timer_ = -1;
+    EventLoop loop_;
+    /* Shared by all sessions, must outlive them */
+    VirtualInputProxy proxy_{loop_};
+    std::unordered_map<int, std::unique_ptr<ClientSession> > sessions_;
+    /* Holds the preloaded devices open while no client is bound to them */
+    VirtualInputProxy::SubscriberId preload_subscriber_ = 0;
+    std::vector<DeviceSetup> preloaded_;
+
+    /* Sessions whose client disconnected, kept for a grace period keyed by resume token */
+    struct ParkedSession {
+        std::unique_ptr<ClientSession> session;
+        int expiry_timer = -1;
+    };
+
+    std::unordered_map<uint64_t, ParkedSession> parked_;
 
     void setup_socket();
-    [[noreturn]] void accept_connections() const;
-    static void handle_client(int client_fd);
+
+    void setup_tcp_socket();
+
+    /**
+     *  Reads the first line of SHARED_SECRET_PATH, if it exists.
+     */
+    void load_shared_secret();
+
+    /**
+     *  Takes over a listening socket passed through LISTEN_FDS/LISTEN_PID.
+     *  Returns false when the server was not socket activated.
+     */
+    bool adopt_activated_socket();
+
+    /**
+     *  Publishes session counts to ServerStats and re-evaluates the idle timer.
+     */
+    void on_sessions_changed();
+
+    /**
+     *  Arms the idle exit timer when no session is left, disarms it otherwise.
+     */
+    void update_idle_timer();
+
+    void preload_devices();
+
+    /**
+     *  Rebinds the preload subscriber to the configs of all sessions and persists them.
+     */
+    void update_preload();
+    void accept_connections(int listen_fd);
+    void close_session(int client_fd);
+
+    void park_session(std::unique_ptr<ClientSession> session);
+
+    std::unique_ptr<ClientSession> resume_session(uint64_t token, uid_t uid);
+
+    void expire_session(uint64_t token);
 };
@@ -1,22 +1,170 @@
 #include "CommandLine.h"
 
+#include "common/device/DeviceCapabilities.h"
+#include "common/protocol/Packets.h"
 #include "common/utilities/Utility.h"
+#include "common/utilities/numbers/Conversion.h"
+#include "server/InputProxyServer.h"
+#include "server/device/EventLoop.h"
 #include "server/device/VirtualInputProxy.h"
 
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <functional>
 
+#define IO_ENGINE_OPTION "--io-engine="
+#define IDLE_EXIT_OPTION "--idle-exit="
+#define LISTEN_TCP_OPTION "--listen-tcp="
+#define STATS_POLL_INTERVAL_MS 2000
+
 void CommandLine::handle(const int argc, char *argv[]) {
     const std::unordered_map<std::string, std::function<void()> > commands = {
         {"--debug", [] { Utility::set_debug(true); }},
-        {"--detect", [] { VirtualInputProxy::detect_devices(); }}
+        {"--detect", [] { detect(); }},
+        {"--stats", [] { poll_stats(); }},
+        {"--preload", [] { InputProxyServer::set_preload(true); }}
     };
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         if (auto it = commands.find(arg); it != commands.end()) {
             it->second();
+        } else if (arg.starts_with(IO_ENGINE_OPTION)) {
+            const std::string name = arg.substr(std::string(IO_ENGINE_OPTION).size());
+            if (IoEngine engine; parse_io_engine(name, engine)) {
+                EventLoop::set_io_engine(engine);
+            } else {
+                Utility::error("Unknown I/O engine '" + name + "', expected epoll or io_uring");
+            }
+        } else if (arg.starts_with(LISTEN_TCP_OPTION)) {
+            InputProxyServer::set_tcp_address(arg.substr(std::string(LISTEN_TCP_OPTION).size()));
+        } else if (arg.starts_with(IDLE_EXIT_OPTION)) {
+            const std::string value = arg.substr(std::string(IDLE_EXIT_OPTION).size());
+            if (const IntConversionResult seconds = safeStrToInt(value); seconds.success && seconds.value >= 0) {
+                InputProxyServer::set_idle_timeout(std::chrono::seconds(seconds.value));
+            } else {
+                Utility::error("Invalid idle timeout '" + value + "', expected a number of seconds");
+            }
         }
     }
 }
+
+int CommandLine::connect_to_running_server(const uint16_t min_version) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        Utility::debugPrint("Can't connect to the server at " SOCKET_PATH ": " + std::string(strerror(errno)));
+        close(fd);
+        return -1;
+    }
+
+    HandshakePayload hello{};
+    hello.version = PROTOCOL_VERSION;
+    PacketHeader hdr{};
+    std::vector<uint8_t> payload;
+    if (!write_packet(fd, Channel::Control, static_cast<uint16_t>(ControlType::HAND_SHAKE), &hello, sizeof(hello)) ||
+        !read_packet(fd, hdr, payload)) {
+        close(fd);
+        return -1;
+    }
+
+    HandshakePayload reply{};
+    std::memcpy(&reply, payload.data(), std::min(payload.size(), sizeof(reply)));
+    if (hdr.type != static_cast<uint16_t>(ControlType::ACK) || payload.size() < HANDSHAKE_PAYLOAD_V2_SIZE ||
+        reply.version < min_version) {
+        Utility::debugPrint("The server speaks protocol " + std::to_string(reply.version) + ", " +
+                            std::to_string(min_version) + " is needed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool CommandLine::read_control_reply(const int fd, const ControlType type, std::vector<uint8_t> &payload) {
+    PacketHeader hdr{};
+    do {
+        if (!read_packet(fd, hdr, payload)) return false;
+    } while (hdr.channel != static_cast<uint16_t>(Channel::Control) || hdr.type != static_cast<uint16_t>(type));
+    return true;
+}
+
+void CommandLine::poll_stats() {
+    const int fd = connect_to_running_server(5);
+    if (fd < 0) {
+        Utility::error("Can't get stats, is a current ptt-server running?");
+        exit(1);
+    }
+
+    std::vector<uint8_t> payload;
+    while (true) {
+        if (!write_packet(fd, Channel::Control, static_cast<uint16_t>(ControlType::STATS), nullptr, 0) ||
+            !read_control_reply(fd, ControlType::STATS, payload)) {
+            exit(1);
+        }
+
+        std::cout << std::string(payload.begin(), payload.end()) << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(STATS_POLL_INTERVAL_MS));
+    }
+}
+
+void CommandLine::detect() {
+    const int fd = connect_to_running_server(6);
+    if (fd < 0) {
+        /* No server to ask, read the devices directly (needs root); this only returns on errors */
+        VirtualInputProxy::detect_devices();
+        exit(1);
+    }
+
+    std::vector<uint8_t> payload;
+    if (!write_packet(fd, Channel::Control, static_cast<uint16_t>(ControlType::DEVICE_LIST), nullptr, 0) ||
+        !read_control_reply(fd, ControlType::DEVICE_LIST, payload)) {
+        exit(1);
+    }
+
+    /* id -> {path, name} */
+    std::unordered_map<std::string, std::pair<std::string, std::string> > devices;
+    std::istringstream list(std::string(payload.begin(), payload.end()));
+    std::string line;
+    Utility::print("Input devices known to the server:");
+    while (std::getline(list, line)) {
+        Utility::print("  " + line);
+        std::istringstream fields(line);
+        std::string id, path, capabilities, name;
+        std::getline(fields, id, '\t');
+        std::getline(fields, path, '\t');
+        std::getline(fields, capabilities, '\t');
+        std::getline(fields, name);
+        devices[id] = {path, name};
+    }
+
+    if (!write_packet(fd, Channel::Control, static_cast<uint16_t>(ControlType::DEVICE_WATCH), nullptr, 0) ||
+        !read_control_reply(fd, ControlType::ACK, payload)) {
+        exit(1);
+    }
+    Utility::print("Press keys to see their device info (Ctrl+C to exit)\n");
+
+    PacketHeader hdr{};
+    while (read_packet(fd, hdr, payload)) {
+        if (hdr.channel != static_cast<uint16_t>(Channel::Events) ||
+            hdr.type != static_cast<uint16_t>(EventType::DEVICE_KEY) || payload.size() < sizeof(DeviceKeyPayload)) {
+            continue;
+        }
+        DeviceKeyPayload key{};
+        std::memcpy(&key, payload.data(), sizeof(key));
+
+        const std::string id = DeviceUtils::format_device_id(key.vendor_id, key.product_id, key.uid);
+        const auto it = devices.find(id);
+        VirtualInputProxy::print_detected_key(key.key, it != devices.end() ? it->second.first : "?",
+                                              it != devices.end() ? it->second.second : "?", id);
+    }
+    exit(1);
+}
@@ -1,6 +1,33 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
+#include "common/protocol/Packets.h"
+
 class CommandLine {
 public:
     static void handle(int argc, char* argv[]);
+
+private:
+    /**
+     *  Connects and handshakes with a running server speaking at least min_version.
+     *  Returns the socket, or -1 if there is no such server.
+     */
+    static int connect_to_running_server(uint16_t min_version);
+
+    /**
+     *  Reads packets until a control packet of the given type arrives. Returns false on a read error.
+     */
+    static bool read_control_reply(int fd, ControlType type, std::vector<uint8_t> &payload);
+
+    /**
+     *  Lists devices and reports key presses through the server, or reads the devices directly without one.
+     */
+    static void detect();
+
+    /**
+     *  Prints the server's STATS report every few seconds until interrupted.
+     */
+    static void poll_stats();
 };
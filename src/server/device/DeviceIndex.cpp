@@ -0,0 +1,301 @@
+#include "DeviceIndex.h"
+
+#include <climits>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <ranges>
+#include <sstream>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+#include "common/device/DeviceCapabilities.h"
+#include "common/utilities/Utility.h"
+
+using namespace DeviceUtils;
+
+DeviceIndex &DeviceIndex::instance() {
+    static DeviceIndex index;
+    return index;
+}
+
+DeviceIndex::DeviceIndex() {
+    std::ifstream boot_id_file("/proc/sys/kernel/random/boot_id");
+    std::getline(boot_id_file, boot_id_);
+    load();
+}
+
+std::string DeviceIndex::find(const uint16_t vendor_id, const uint16_t product_id, const uint32_t uid) {
+    std::lock_guard lock(mutex_);
+    if (!synced_) {
+        sync_locked();
+    }
+
+    const DeviceIndexEntry *entry = lookup_locked(vendor_id, product_id, uid);
+    if (entry && read_fingerprint(entry->event_name) != entry->fingerprint) {
+        /* The node was reused by another device since it was indexed */
+        const std::string event_name = entry->event_name;
+        erase_locked(event_name);
+        dirty_ = true;
+        index_node_locked(event_name);
+        entry = lookup_locked(vendor_id, product_id, uid);
+    }
+    if (!entry) {
+        sync_locked();
+        entry = lookup_locked(vendor_id, product_id, uid);
+    }
+
+    std::string dev_path = entry ? entry->dev_path() : "";
+    save_locked();
+    return dev_path;
+}
+
+std::optional<DeviceIndexEntry> DeviceIndex::on_added(const std::string &event_name) {
+    std::lock_guard lock(mutex_);
+    if (const auto it = entries_.find(event_name);
+        it != entries_.end() && it->second.fingerprint == read_fingerprint(event_name)) {
+        return it->second;
+    }
+
+    auto entry = index_node_locked(event_name);
+    save_locked();
+    return entry;
+}
+
+void DeviceIndex::on_removed(const std::string &event_name) {
+    std::lock_guard lock(mutex_);
+    if (entries_.contains(event_name)) {
+        erase_locked(event_name);
+        dirty_ = true;
+        save_locked();
+    }
+}
+
+void DeviceIndex::sync() {
+    std::lock_guard lock(mutex_);
+    sync_locked();
+    save_locked();
+}
+
+std::vector<DeviceIndexEntry> DeviceIndex::entries() {
+    std::lock_guard lock(mutex_);
+    if (!synced_) {
+        sync_locked();
+        save_locked();
+    }
+
+    std::vector<DeviceIndexEntry> result;
+    result.reserve(entries_.size());
+    for (const auto &entry: entries_ | std::views::values) {
+        result.push_back(entry);
+    }
+    return result;
+}
+
+void DeviceIndex::sync_locked() {
+    DIR *dir = opendir("/sys/class/input/");
+    if (!dir) {
+        Utility::error("Can't open input devices directory");
+        return;
+    }
+
+    std::unordered_map<std::string, DeviceIndexEntry> previous;
+    previous.swap(entries_);
+    by_identity_.clear();
+
+    dirent *entry;
+    while ((entry = readdir(dir))) {
+        std::string name(entry->d_name);
+        if (name.substr(0, 5) != "event") continue;
+
+        if (const auto it = previous.find(name);
+            it != previous.end() && it->second.fingerprint == read_fingerprint(name)) {
+            insert_locked(std::move(it->second));
+            previous.erase(it);
+            continue;
+        }
+        index_node_locked(name);
+    }
+    closedir(dir);
+
+    if (!previous.empty()) {
+        dirty_ = true;
+    }
+    synced_ = true;
+}
+
+std::optional<DeviceIndexEntry> DeviceIndex::index_node_locked(const std::string &event_name) {
+    auto entry = probe(event_name, read_fingerprint(event_name));
+    if (!entry) return std::nullopt;
+
+    Utility::debugPrint("Indexed " + entry->dev_path() + " (" + entry->name + ")");
+    insert_locked(*entry);
+    dirty_ = true;
+    return entry;
+}
+
+void DeviceIndex::insert_locked(DeviceIndexEntry entry) {
+    /* A re-indexed node may have changed identity */
+    erase_locked(entry.event_name);
+    by_identity_[identity_key(entry.vendor_id, entry.product_id, entry.uid)].insert(entry.event_name);
+    std::string event_name = entry.event_name;
+    entries_[std::move(event_name)] = std::move(entry);
+}
+
+void DeviceIndex::erase_locked(const std::string &event_name) {
+    const auto it = entries_.find(event_name);
+    if (it == entries_.end()) return;
+
+    const DeviceIndexEntry &entry = it->second;
+    if (const auto id = by_identity_.find(identity_key(entry.vendor_id, entry.product_id, entry.uid));
+        id != by_identity_.end()) {
+        id->second.erase(event_name);
+        if (id->second.empty()) {
+            by_identity_.erase(id);
+        }
+    }
+    entries_.erase(it);
+}
+
+const DeviceIndexEntry *DeviceIndex::lookup_locked(const uint16_t vendor_id, const uint16_t product_id,
+                                                   const uint32_t uid) const {
+    const auto id = by_identity_.find(identity_key(vendor_id, product_id, uid));
+    if (id == by_identity_.end() || id->second.empty()) return nullptr;
+
+    const auto it = entries_.find(*id->second.begin());
+    return it != entries_.end() ? &it->second : nullptr;
+}
+
+bool DeviceIndex::EventNodeLess::operator()(const std::string &a, const std::string &b) const {
+    /* Both names start with "event", a shorter number is a smaller one */
+    if (a.size() != b.size()) return a.size() < b.size();
+    return a < b;
+}
+
+uint64_t DeviceIndex::identity_key(const uint16_t vendor_id, const uint16_t product_id, const uint32_t uid) {
+    return static_cast<uint64_t>(vendor_id) << 48 | static_cast<uint64_t>(product_id) << 32 | uid;
+}
+
+void DeviceIndex::load() {
+    std::ifstream file(DEVICE_INDEX_CACHE_PATH);
+    if (!file.is_open()) return;
+
+    std::string cached_header;
+    if (!std::getline(file, cached_header) || cached_header != cache_header()) {
+        Utility::debugPrint("Discarding device index cache from a previous boot or version");
+        return;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+        DeviceIndexEntry entry;
+        if (!(iss >> entry.event_name >> entry.fingerprint >> entry.vendor_id >> entry.product_id >> entry.uid >>
+              entry.capabilities)) {
+            continue;
+        }
+        std::getline(iss >> std::ws, entry.name);
+        insert_locked(std::move(entry));
+    }
+    Utility::debugPrint("Loaded " + std::to_string(entries_.size()) + " cached device index entries");
+}
+
+void DeviceIndex::save_locked() {
+    if (!dirty_) return;
+    dirty_ = false;
+
+    const std::string cache_path = DEVICE_INDEX_CACHE_PATH;
+    const std::string cache_dir = cache_path.substr(0, cache_path.rfind('/'));
+    if (mkdir(cache_dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        Utility::debugPrint("Can't create " + cache_dir + ", device index will not be persisted");
+        return;
+    }
+
+    const std::string tmp_path = cache_path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file.is_open()) {
+            Utility::debugPrint("Can't write " + tmp_path);
+            return;
+        }
+        file << cache_header() << "\n";
+        for (const auto &entry: entries_ | std::views::values) {
+            file << entry.event_name << " " << entry.fingerprint << " " << entry.vendor_id << " "
+                    << entry.product_id << " " << entry.uid << " " << entry.capabilities << " " << entry.name << "\n";
+        }
+    }
+    if (rename(tmp_path.c_str(), cache_path.c_str()) < 0) {
+        Utility::debugPrint("Can't replace " + cache_path);
+    }
+}
+
+std::string DeviceIndex::cache_header() const {
+    return boot_id_ + " " + std::to_string(DEVICE_INDEX_CACHE_VERSION);
+}
+
+std::string DeviceIndex::read_fingerprint(const std::string &event_name) {
+    char resolved[PATH_MAX];
+    const std::string link = "/sys/class/input/" + event_name + "/device";
+    if (!realpath(link.c_str(), resolved)) return "";
+
+    /* devtmpfs recreates the node on every add, so its ctime tells reused event numbers apart */
+    struct stat st{};
+    const std::string dev_path = "/dev/input/" + event_name;
+    if (stat(dev_path.c_str(), &st) < 0) return "";
+
+    return std::string(resolved) + "@" + std::to_string(st.st_ctim.tv_sec) + "." +
+           std::to_string(st.st_ctim.tv_nsec);
+}
+
+std::string DeviceIndex::summarize_capabilities(const int fd) {
+    CapabilityBits<EV_CNT> ev_bits;
+    CapabilityBits<KEY_CNT> key_bits;
+    ev_bits.read(fd, 0);
+    key_bits.read(fd, EV_KEY);
+
+    std::string summary = "keys=" + std::to_string(key_bits.count());
+    if (ev_bits.test(EV_REL)) summary += ",rel";
+    if (ev_bits.test(EV_ABS)) summary += ",abs";
+    if (ev_bits.test(EV_SW)) summary += ",sw";
+    if (ev_bits.test(EV_LED)) summary += ",led";
+    return summary;
+}
+
+std::optional<DeviceIndexEntry> DeviceIndex::probe(const std::string &event_name, const std::string &fingerprint) {
+    if (fingerprint.empty()) return std::nullopt;
+
+    try {
+        const std::string sysfs_path = "/sys/class/input/" + event_name + "/device/";
+
+        DeviceIndexEntry entry;
+        entry.event_name = event_name;
+        entry.fingerprint = fingerprint;
+        entry.vendor_id = read_id_from_file(sysfs_path + "id/vendor");
+        entry.product_id = read_id_from_file(sysfs_path + "id/product");
+
+        const int tmp_fd = open(entry.dev_path().c_str(), O_RDONLY | O_CLOEXEC);
+        if (tmp_fd < 0) return std::nullopt;
+
+        char name[256] = {};
+        if (ioctl(tmp_fd, EVIOCGNAME(sizeof(name)), name) >= 0) {
+            name[sizeof(name) - 1] = '\0';
+            entry.name = name;
+        }
+
+        try {
+            entry.uid = generate_uid(tmp_fd);
+            entry.capabilities = summarize_capabilities(tmp_fd);
+        } catch (...) {
+            close(tmp_fd);
+            throw;
+        }
+        close(tmp_fd);
+        return entry;
+    } catch (...) {
+        /* Skip problematic devices */
+        return std::nullopt;
+    }
+}
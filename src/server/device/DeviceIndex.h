@@ -0,0 +1,105 @@
+#ifndef DEVICEINDEX_H
+#define DEVICEINDEX_H
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define DEVICE_INDEX_CACHE_PATH "/run/ptt/device-index"
+/* Bumped whenever the cache line format changes, older caches are discarded */
+#define DEVICE_INDEX_CACHE_VERSION 2
+
+struct DeviceIndexEntry {
+    std::string event_name;
+    /* Parent input device sysfs path plus node ctime, changes whenever the node is reused */
+    std::string fingerprint;
+    uint16_t vendor_id = 0;
+    uint16_t product_id = 0;
+    uint32_t uid = 0;
+    /* e.g. "keys=104,rel,abs", without spaces */
+    std::string capabilities;
+    std::string name;
+
+    [[nodiscard]] std::string dev_path() const { return "/dev/input/" + event_name; }
+};
+
+/**
+ * In-memory index of /dev/input/event* nodes keyed by (vendor, product, uid).
+ *
+ * Each node is probed (opened, capabilities read, UID computed) only once
+ * per fingerprint. The index is kept current by hotplug events and a cheap
+ * readlink()-only resync, and is persisted under /run so a restarted server
+ * starts warm.
+ */
+class DeviceIndex {
+public:
+    static DeviceIndex &instance();
+
+    /**
+     *  Returns the device node for the given identity, or an empty string if no such device is present.
+     */
+    std::string find(uint16_t vendor_id, uint16_t product_id, uint32_t uid);
+
+    /**
+     *  Indexes a newly added node and returns its entry, if it could be probed.
+     */
+    std::optional<DeviceIndexEntry> on_added(const std::string &event_name);
+
+    void on_removed(const std::string &event_name);
+
+    /**
+     *  Re-reads the fingerprint of every node and probes only the ones that changed.
+     */
+    void sync();
+
+    [[nodiscard]] std::vector<DeviceIndexEntry> entries();
+
+private:
+    std::mutex mutex_;
+    bool synced_ = false;
+    bool dirty_ = false;
+    std::string boot_id_;
+    /* Keyed by event node name */
+    std::unordered_map<std::string, DeviceIndexEntry> entries_;
+    /* Orders event node names by their number, so "event9" comes before "event10" */
+    struct EventNodeLess {
+        bool operator()(const std::string &a, const std::string &b) const;
+    };
+
+    /* identity_key() -> every event node with that identity, kept in step with entries_.
+     * Identical devices share an identity, lookups pick the lowest node. */
+    std::unordered_map<uint64_t, std::set<std::string, EventNodeLess>> by_identity_;
+
+    DeviceIndex();
+
+    void sync_locked();
+
+    std::optional<DeviceIndexEntry> index_node_locked(const std::string &event_name);
+
+    void insert_locked(DeviceIndexEntry entry);
+
+    void erase_locked(const std::string &event_name);
+
+    [[nodiscard]] const DeviceIndexEntry *lookup_locked(uint16_t vendor_id, uint16_t product_id, uint32_t uid) const;
+
+    void load();
+
+    void save_locked();
+
+    /* First cache line, ties the cache to this boot and format */
+    [[nodiscard]] std::string cache_header() const;
+
+    static uint64_t identity_key(uint16_t vendor_id, uint16_t product_id, uint32_t uid);
+
+    static std::string read_fingerprint(const std::string &event_name);
+
+    static std::string summarize_capabilities(int fd);
+
+    static std::optional<DeviceIndexEntry> probe(const std::string &event_name, const std::string &fingerprint);
+};
+
+#endif // DEVICEINDEX_H
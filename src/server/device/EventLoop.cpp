@@ -0,0 +1,285 @@
+#include "EventLoop.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "common/utilities/Utility.h"
+
+#define MAX_POLLER_EVENTS 64
+/* Bytes a reader gets per read, matches the io_uring provided buffers */
+#define READ_BUFFER_SIZE 4096
+/* Readiness a reader is called for instead of its handler */
+#define READ_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)
+/* Poller id of the wakeup eventfd, registrations start at 1 */
+#define WAKE_ID 0
+
+std::atomic<IoEngine> EventLoop::io_engine_{IoEngine::Epoll};
+
+void EventLoop::set_io_engine(const IoEngine engine) {
+    io_engine_ = engine;
+}
+
+EventLoop::EventLoop() : poller_(Poller::create(io_engine_)) {
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        throw std::runtime_error("eventfd failed: " + std::string(strerror(errno)));
+    }
+
+    if (!poller_->add(wake_fd_, EPOLLIN, WAKE_ID)) {
+        close(wake_fd_);
+        throw std::runtime_error("Failed to register wake_fd: " + std::string(strerror(errno)));
+    }
+    Utility::debugPrint("Event loop uses " + std::string(poller_->name()));
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    for (const auto &[fd, id]: fd_ids_) {
+        poller_->remove(fd);
+    }
+    poller_->remove(wake_fd_);
+    close(wake_fd_);
+}
+
+bool EventLoop::add(const int fd, const uint32_t events, Handler handler) {
+    return register_fd(fd, events, std::move(handler), {});
+}
+
+bool EventLoop::add_reader(const int fd, const uint32_t events, Reader reader, Handler handler) {
+    return register_fd(fd, events, std::move(handler), std::move(reader));
+}
+
+bool EventLoop::register_fd(const int fd, const uint32_t events, Handler handler, Reader reader) {
+    {
+        std::lock_guard lock(mutex_);
+        if (fd_ids_.contains(fd)) {
+            Utility::error("EventLoop: fd " + std::to_string(fd) + " already registered");
+            return false;
+        }
+
+        const uint64_t id = next_id_++;
+        auto registration = std::make_shared<Registration>();
+        registration->fd = fd;
+        registration->handler = std::move(handler);
+        registration->reader = std::move(reader);
+
+        if (!(registration->reader ? poller_->add_reader(fd, events, id) : poller_->add(fd, events, id))) {
+            Utility::error(std::string(poller_->name()) + ": failed to add fd " + std::to_string(fd) + ": " +
+                           strerror(errno));
+            return false;
+        }
+
+        registrations_[id] = std::move(registration);
+        fd_ids_[fd] = id;
+    }
+    notify_poller();
+    return true;
+}
+
+bool EventLoop::modify(const int fd, const uint32_t events) {
+    {
+        std::lock_guard lock(mutex_);
+        const auto it = fd_ids_.find(fd);
+        if (it == fd_ids_.end()) return false;
+
+        if (!poller_->modify(fd, events, it->second)) {
+            Utility::error(std::string(poller_->name()) + ": failed to modify fd " + std::to_string(fd) + ": " +
+                           strerror(errno));
+            return false;
+        }
+    }
+    notify_poller();
+    return true;
+}
+
+void EventLoop::remove(const int fd) {
+    std::lock_guard lock(mutex_);
+    const auto it = fd_ids_.find(fd);
+    if (it == fd_ids_.end()) return;
+
+    poller_->remove(fd);
+    if (const auto registration = registrations_.find(it->second); registration != registrations_.end()) {
+        registration->second->removed = true;
+        registrations_.erase(registration);
+    }
+    fd_ids_.erase(it);
+}
+
+int EventLoop::add_timer(const std::chrono::milliseconds interval, Task task) {
+    const int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd < 0) {
+        Utility::error("timerfd_create failed: " + std::string(strerror(errno)));
+        return -1;
+    }
+
+    itimerspec spec{};
+    spec.it_interval.tv_sec = interval.count() / 1000;
+    spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(tfd, 0, &spec, nullptr) < 0) {
+        Utility::error("timerfd_settime failed: " + std::string(strerror(errno)));
+        close(tfd);
+        return -1;
+    }
+
+    const bool added = add(tfd, EPOLLIN, [tfd, task = std::move(task)](uint32_t) {
+        uint64_t expirations = 0;
+        if (read(tfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            task();
+        }
+    });
+    if (!added) {
+        close(tfd);
+        return -1;
+    }
+    return tfd;
+}
+
+void EventLoop::remove_timer(const int timer_id) {
+    if (timer_id < 0) return;
+    remove(timer_id);
+    close(timer_id);
+}
+
+void EventLoop::post(Task task) {
+    {
+        std::lock_guard lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    wake();
+}
+
+void EventLoop::run_in_loop(const Task &task) {
+    if (!running_ || in_loop_thread()) {
+        task();
+        return;
+    }
+
+    auto done = std::make_shared<std::promise<void> >();
+    std::future<void> finished = done->get_future();
+    post([&task, done] {
+        task();
+        done->set_value();
+    });
+    finished.wait();
+}
+
+void EventLoop::run() {
+    running_ = true;
+    loop();
+}
+
+void EventLoop::loop() {
+    loop_thread_id_ = std::this_thread::get_id();
+
+    Poller::Event events[MAX_POLLER_EVENTS];
+    while (running_) {
+        const int n = poller_->wait(events, MAX_POLLER_EVENTS);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            Utility::error(std::string(poller_->name()) + " wait failed: " + std::string(strerror(errno)));
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].id == WAKE_ID) {
+                uint64_t value = 0;
+                [[maybe_unused]] const ssize_t r = read(wake_fd_, &value, sizeof(value));
+                drain_tasks();
+                continue;
+            }
+            dispatch(events[i]);
+        }
+    }
+
+    drain_tasks();
+    loop_thread_id_ = std::thread::id{};
+    running_ = false;
+}
+
+void EventLoop::start() {
+    if (running_ || thread_.joinable()) return;
+    running_ = true;
+    thread_ = std::thread([this] { loop(); });
+}
+
+void EventLoop::stop() {
+    running_ = false;
+    wake();
+    if (thread_.joinable() && std::this_thread::get_id() != thread_.get_id()) {
+        thread_.join();
+    }
+}
+
+bool EventLoop::in_loop_thread() const {
+    return loop_thread_id_.load() == std::this_thread::get_id();
+}
+
+void EventLoop::notify_poller() const {
+    /* io_uring only submits queued registrations from wait(), so kick a loop blocked in it */
+    if (poller_->submits_lazily() && running_ && !in_loop_thread()) {
+        wake();
+    }
+}
+
+void EventLoop::wake() const {
+    constexpr uint64_t one = 1;
+    [[maybe_unused]] const ssize_t w = write(wake_fd_, &one, sizeof(one));
+}
+
+void EventLoop::drain_tasks() {
+    std::vector<Task> pending;
+    {
+        std::lock_guard lock(mutex_);
+        pending.swap(tasks_);
+    }
+    for (const auto &task: pending) {
+        task();
+    }
+}
+
+void EventLoop::dispatch(const Poller::Event &event) {
+    std::shared_ptr<Registration> registration;
+    {
+        std::lock_guard lock(mutex_);
+        if (const auto it = registrations_.find(event.id); it != registrations_.end()) {
+            registration = it->second;
+        }
+    }
+
+    if (registration && event.read) {
+        registration->reader(event.data, event.result);
+    } else if (registration && !registration->reader) {
+        registration->handler(event.events);
+    } else if (registration) {
+        if (event.events & READ_EVENTS) {
+            read_ready(*registration);
+        }
+        if (event.events & ~READ_EVENTS && registration->handler && !registration->removed) {
+            registration->handler(event.events);
+        }
+    }
+    /* The data of a read event goes back to the backend even if its fd was removed meanwhile */
+    poller_->release(event);
+}
+
+void EventLoop::read_ready(Registration &registration) {
+    alignas(std::max_align_t) uint8_t buffer[READ_BUFFER_SIZE];
+    while (!registration.removed) {
+        const ssize_t bytes = read(registration.fd, buffer, sizeof(buffer));
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+
+        registration.reader(buffer, bytes < 0 ? -errno : bytes);
+        /* A short read emptied the fd, and after EOF or an error the reader is done with it */
+        if (bytes < static_cast<ssize_t>(sizeof(buffer))) return;
+    }
+}
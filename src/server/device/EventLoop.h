@@ -0,0 +1,140 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+#include "Poller.h"
+
+/**
+ * Single-threaded reactor over a Poller backend (epoll by default, io_uring on request).
+ *
+ * File descriptors and periodic timers are registered with a handler that is
+ * invoked on the loop thread whenever the fd becomes ready, or with a reader
+ * that is handed the data of the fd as it arrives. Registration can
+ * happen from any thread; handlers always run on the loop thread, so state that
+ * is only touched from handlers needs no locking.
+ */
+class EventLoop {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+    using Task = std::function<void()>;
+    /* Gets one read's worth of data; bytes is 0 at EOF and -errno on a read error */
+    using Reader = std::function<void(const uint8_t *data, ssize_t bytes)>;
+
+    EventLoop();
+
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    bool add(int fd, uint32_t events, Handler handler);
+
+    /**
+     *  Registers fd for its data: the loop reads it and hands every chunk to reader.
+     *  With io_uring this is a multishot read that needs no read() call, with epoll
+     *  the loop reads on EPOLLIN. handler, if any, gets the other events of the mask
+     *  (EPOLLOUT). The reader must remove the fd once it sees EOF or an error.
+     */
+    bool add_reader(int fd, uint32_t events, Reader reader, Handler handler = {});
+
+    bool modify(int fd, uint32_t events);
+
+    void remove(int fd);
+
+    /**
+     *  Registers a periodic timer backed by a timerfd.
+     *  Returns the timer id on success, -1 on error.
+     */
+    int add_timer(std::chrono::milliseconds interval, Task task);
+
+    void remove_timer(int timer_id);
+
+    /**
+     *  Queues a task to run on the loop thread.
+     */
+    void post(Task task);
+
+    /**
+     *  Runs the task on the loop thread and waits for it to finish.
+     *  Executes inline when called from the loop thread or when the loop is not running.
+     */
+    void run_in_loop(const Task &task);
+
+    /**
+     *  Runs the loop on the calling thread until stop() is called.
+     */
+    void run();
+
+    /**
+     *  Runs the loop on a dedicated thread.
+     */
+    void start();
+
+    void stop();
+
+    [[nodiscard]] bool is_running() const { return running_; }
+
+    [[nodiscard]] bool in_loop_thread() const;
+
+    /**
+     *  Name of the backend in use, which may be epoll even though io_uring was requested.
+     */
+    [[nodiscard]] const char *backend() const { return poller_->name(); }
+
+    /**
+     *  Selects the backend of loops constructed afterwards.
+     */
+    static void set_io_engine(IoEngine engine);
+
+private:
+    struct Registration {
+        int fd = -1;
+        Handler handler;
+        Reader reader;
+        std::atomic<bool> removed{false};
+    };
+
+    static std::atomic<IoEngine> io_engine_;
+
+    std::unique_ptr<Poller> poller_;
+    int wake_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::atomic<std::thread::id> loop_thread_id_{};
+    std::thread thread_;
+
+    std::mutex mutex_;
+    uint64_t next_id_ = 1;
+    std::unordered_map<uint64_t, std::shared_ptr<Registration> > registrations_;
+    std::unordered_map<int, uint64_t> fd_ids_;
+    std::vector<Task> tasks_;
+
+    bool register_fd(int fd, uint32_t events, Handler handler, Reader reader);
+
+    void loop();
+
+    void wake() const;
+
+    void notify_poller() const;
+
+    void drain_tasks();
+
+    void dispatch(const Poller::Event &event);
+
+    /**
+     *  Reads a ready fd on behalf of its reader, for backends that only report readiness.
+     */
+    static void read_ready(Registration &registration);
+};
+
+#endif // EVENTLOOP_H
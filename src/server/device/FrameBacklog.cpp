@@ -0,0 +1,65 @@
+#include "FrameBacklog.h"
+
+#include <algorithm>
+
+size_t FrameBacklog::push(const input_event *events, const size_t count, const bool coalescable) {
+    if (!coalescable || coalesce_from_ == NO_COALESCE) {
+        coalesce_from_ = coalescable ? events_.size() : NO_COALESCE;
+        events_.insert(events_.end(), events, events + count);
+        return 0;
+    }
+
+    /* Merge into the trailing frame, keeping its SYN_REPORT last */
+    size_t merged = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const input_event &ev = events[i];
+        if (ev.type == EV_SYN) continue;
+
+        const auto frame_end = events_.end() - 1;
+        const auto it = std::find_if(events_.begin() + static_cast<std::ptrdiff_t>(coalesce_from_), frame_end,
+                                     [&](const input_event &queued) {
+                                         return queued.type == ev.type && queued.code == ev.code;
+                                     });
+        if (it == frame_end) {
+            events_.insert(frame_end, ev);
+            continue;
+        }
+        if (ev.type == EV_REL) {
+            it->value += ev.value;
+        } else {
+            it->value = ev.value;
+        }
+        ++merged;
+    }
+    return merged;
+}
+
+void FrameBacklog::consume(const size_t count) {
+    events_.erase(events_.begin(), events_.begin() + static_cast<std::ptrdiff_t>(count));
+    if (coalesce_from_ != NO_COALESCE) {
+        coalesce_from_ = count > coalesce_from_ ? NO_COALESCE : coalesce_from_ - count;
+    }
+}
+
+void FrameBacklog::clear() {
+    events_.clear();
+    coalesce_from_ = NO_COALESCE;
+}
+
+bool FrameBacklog::is_motion_frame(const std::vector<input_event> &frame) {
+    return std::ranges::all_of(frame, [](const input_event &ev) {
+        switch (ev.type) {
+            case EV_SYN:
+                return ev.code == SYN_REPORT;
+            case EV_REL:
+                return true;
+            case EV_ABS:
+                /* Multitouch values only make sense relative to their slot */
+                return ev.code < ABS_MT_SLOT;
+            case EV_MSC:
+                return ev.code == MSC_TIMESTAMP;
+            default:
+                return false;
+        }
+    });
+}
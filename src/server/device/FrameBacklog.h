@@ -0,0 +1,50 @@
+#ifndef FRAMEBACKLOG_H
+#define FRAMEBACKLOG_H
+
+#include <cstddef>
+#include <vector>
+#include <linux/input.h>
+
+/**
+ * Complete frames a backpressured virtual device has not accepted yet, oldest first.
+ *
+ * Motion-only frames queued back to back are merged into one: REL deltas are
+ * summed and ABS values replaced, so a stalled device catches up with the
+ * pointer's current position instead of replaying every intermediate one.
+ * Frames with key events are never merged.
+ */
+class FrameBacklog {
+public:
+    /**
+     *  Queues a frame ending in SYN_REPORT. Returns the number of its events that were
+     *  merged into the trailing frame instead of being appended.
+     */
+    size_t push(const input_event *events, size_t count, bool coalescable);
+
+    /**
+     *  Drops the first count events, which the device has taken.
+     */
+    void consume(size_t count);
+
+    void clear();
+
+    [[nodiscard]] bool empty() const { return events_.empty(); }
+
+    [[nodiscard]] size_t size() const { return events_.size(); }
+
+    [[nodiscard]] const input_event *data() const { return events_.data(); }
+
+    /**
+     *  True if the frame only moves axes, i.e. merging it with its neighbours loses nothing.
+     */
+    static bool is_motion_frame(const std::vector<input_event> &frame);
+
+private:
+    static constexpr size_t NO_COALESCE = static_cast<size_t>(-1);
+
+    std::vector<input_event> events_;
+    /* Start of the trailing motion-only frame that later motion merges into */
+    size_t coalesce_from_ = NO_COALESCE;
+};
+
+#endif // FRAMEBACKLOG_H
@@ -0,0 +1,117 @@
+#include "HotplugMonitor.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "common/utilities/Utility.h"
+
+#define UEVENT_BUFFER_SIZE 8192
+#define UEVENT_KERNEL_GROUP 1
+
+HotplugMonitor::HotplugMonitor(EventLoop &loop) : loop_(loop) {
+}
+
+HotplugMonitor::~HotplugMonitor() {
+    stop();
+}
+
+bool HotplugMonitor::start(Callback callback) {
+    if (sock_fd_ >= 0) return true;
+
+    const int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        Utility::error("Failed to open uevent socket: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    sockaddr_nl addr{};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_KERNEL_GROUP;
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        Utility::error("Failed to bind uevent socket: " + std::string(strerror(errno)));
+        close(fd);
+        return false;
+    }
+
+    callback_ = std::move(callback);
+    if (!loop_.add(fd, EPOLLIN, [this](uint32_t) { on_readable(); })) {
+        close(fd);
+        return false;
+    }
+
+    sock_fd_ = fd;
+    Utility::debugPrint("Hotplug monitor listening for input uevents");
+    return true;
+}
+
+void HotplugMonitor::stop() {
+    if (sock_fd_ < 0) return;
+    loop_.remove(sock_fd_);
+    close(sock_fd_);
+    sock_fd_ = -1;
+}
+
+void HotplugMonitor::on_readable() const {
+    char buffer[UEVENT_BUFFER_SIZE];
+    while (true) {
+        sockaddr_nl sender{};
+        iovec iov{buffer, sizeof(buffer) - 1};
+        msghdr msg{};
+        msg.msg_name = &sender;
+        msg.msg_namelen = sizeof(sender);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        const ssize_t len = recvmsg(sock_fd_, &msg, 0);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS) {
+                Utility::error("uevent socket overflowed, some hotplug events were lost");
+                continue;
+            }
+            return;
+        }
+
+        /* Only trust messages sent by the kernel itself */
+        if (sender.nl_pid != 0) continue;
+
+        buffer[len] = '\0';
+        handle_uevent(buffer, static_cast<size_t>(len));
+    }
+}
+
+void HotplugMonitor::handle_uevent(const char *data, const size_t len) const {
+    std::string_view action;
+    std::string_view subsystem;
+    std::string_view dev_name;
+
+    /* Payload is "action@devpath\0KEY=VALUE\0KEY=VALUE\0..." */
+    for (size_t offset = strnlen(data, len) + 1; offset < len;) {
+        const std::string_view entry(data + offset, strnlen(data + offset, len - offset));
+        offset += entry.size() + 1;
+
+        if (entry.starts_with("ACTION=")) {
+            action = entry.substr(7);
+        } else if (entry.starts_with("SUBSYSTEM=")) {
+            subsystem = entry.substr(10);
+        } else if (entry.starts_with("DEVNAME=")) {
+            dev_name = entry.substr(8);
+        }
+    }
+
+    if (subsystem != "input" || !dev_name.starts_with("input/event") || !callback_) return;
+
+    const std::string dev_path = "/dev/" + std::string(dev_name);
+    if (action == "add") {
+        Utility::debugPrint("Hotplug: added " + dev_path);
+        callback_(Action::Add, dev_path);
+    } else if (action == "remove") {
+        Utility::debugPrint("Hotplug: removed " + dev_path);
+        callback_(Action::Remove, dev_path);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef HOTPLUGMONITOR_H
+#define HOTPLUGMONITOR_H
+
+#include <functional>
+#include <string>
+
+#include "EventLoop.h"
+
+/**
+ * Listens for kernel uevents (NETLINK_KOBJECT_UEVENT) on the event loop and
+ * reports evdev nodes appearing and disappearing under /dev/input.
+ */
+class HotplugMonitor {
+public:
+    enum class Action {
+        Add,
+        Remove,
+    };
+
+    using Callback = std::function<void(Action action, const std::string &dev_path)>;
+
+    explicit HotplugMonitor(EventLoop &loop);
+
+    ~HotplugMonitor();
+
+    HotplugMonitor(const HotplugMonitor &) = delete;
+
+    HotplugMonitor &operator=(const HotplugMonitor &) = delete;
+
+    /**
+     *  Opens the uevent socket and starts delivering events to the callback.
+     *  Returns false if netlink is unavailable, in which case callers should fall back to polling.
+     */
+    bool start(Callback callback);
+
+    void stop();
+
+    [[nodiscard]] bool is_running() const { return sock_fd_ >= 0; }
+
+private:
+    EventLoop &loop_;
+    int sock_fd_ = -1;
+    Callback callback_;
+
+    void on_readable() const;
+
+    void handle_uevent(const char *data, size_t len) const;
+};
+
+#endif // HOTPLUGMONITOR_H
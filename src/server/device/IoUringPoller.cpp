@@ -0,0 +1,405 @@
+#include "IoUringPoller.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "common/utilities/Utility.h"
+
+#define IO_URING_ENTRIES 256
+/* user_data of internal requests (poll removal) whose completions carry no event */
+#define INTERNAL_USER_DATA 0
+/* IORING_OP_READ_MULTISHOT, newer (6.7) than the kernel headers this may be built against */
+#define OP_READ_MULTISHOT 49
+/* Provided buffers of the multishot reads, each read fills at most one; a power of two */
+#define READ_BUFFER_COUNT 128
+#define READ_BUFFER_SIZE 4096
+#define READ_BUFFER_GROUP 0
+/* Opcodes io_uring_probe is asked about */
+#define PROBE_OPS 256
+
+static int sys_io_uring_setup(const unsigned entries, io_uring_params *params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int sys_io_uring_register(const int ring_fd, const unsigned opcode, void *arg, const unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+static int sys_io_uring_enter(const int ring_fd, const unsigned to_submit, const unsigned min_complete,
+                              const unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+std::unique_ptr<IoUringPoller> IoUringPoller::create() {
+    std::unique_ptr<IoUringPoller> poller(new IoUringPoller());
+    if (!poller->setup()) return nullptr;
+    return poller;
+}
+
+bool IoUringPoller::setup() {
+    io_uring_params params{};
+    ring_fd_ = sys_io_uring_setup(IO_URING_ENTRIES, &params);
+    if (ring_fd_ < 0) {
+        Utility::debugPrint("io_uring_setup failed: " + std::string(strerror(errno)));
+        return false;
+    }
+    /* Multishot poll arrived in 5.13 together with resource tags */
+    if (!(params.features & IORING_FEAT_RSRC_TAGS)) {
+        Utility::debugPrint("Kernel io_uring lacks multishot poll");
+        return false;
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                    IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        sq_ring_ = nullptr;
+        return false;
+    }
+    if (single_mmap) {
+        cq_ring_ = sq_ring_;
+    } else {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                        IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            cq_ring_ = nullptr;
+            return false;
+        }
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                      IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+    auto *sq = static_cast<uint8_t *>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sq_entries_ = params.sq_entries;
+
+    auto *cq = static_cast<uint8_t *>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    if (!setup_read_buffers()) {
+        Utility::debugPrint("io_uring multishot reads unavailable, readers are polled instead");
+    }
+    return true;
+}
+
+bool IoUringPoller::setup_read_buffers() {
+    if (!supports(OP_READ_MULTISHOT)) return false;
+
+    buf_ring_size_ = READ_BUFFER_COUNT * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) return false;
+    buf_ring_ = static_cast<io_uring_buf_ring *>(ring);
+
+    buffers_size_ = static_cast<size_t>(READ_BUFFER_COUNT) * READ_BUFFER_SIZE;
+    void *buffers = mmap(nullptr, buffers_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        munmap(buf_ring_, buf_ring_size_);
+        buf_ring_ = nullptr;
+        return false;
+    }
+    buffers_ = static_cast<uint8_t *>(buffers);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = READ_BUFFER_COUNT;
+    reg.bgid = READ_BUFFER_GROUP;
+    if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        Utility::debugPrint("io_uring buffer ring registration failed: " + std::string(strerror(errno)));
+        munmap(buffers_, buffers_size_);
+        munmap(buf_ring_, buf_ring_size_);
+        buffers_ = nullptr;
+        buf_ring_ = nullptr;
+        return false;
+    }
+
+    for (uint16_t buffer = 0; buffer < READ_BUFFER_COUNT; ++buffer) {
+        recycle_buffer(buffer);
+    }
+    return true;
+}
+
+bool IoUringPoller::supports(const uint8_t opcode) const {
+    std::vector<uint8_t> storage(sizeof(io_uring_probe) + PROBE_OPS * sizeof(io_uring_probe_op));
+    auto *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+    if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PROBE, probe, PROBE_OPS) < 0) return false;
+    return opcode <= probe->last_op && probe->ops[opcode].flags & IO_URING_OP_SUPPORTED;
+}
+
+void IoUringPoller::recycle_buffer(const uint16_t buffer) {
+    /* Not buf_ring_->bufs: in C++ the header's flexible array wrapper moves it off the start of the ring */
+    io_uring_buf &slot = reinterpret_cast<io_uring_buf *>(buf_ring_)[buf_tail_ & (READ_BUFFER_COUNT - 1)];
+    slot.addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(buffer) * READ_BUFFER_SIZE);
+    slot.len = READ_BUFFER_SIZE;
+    slot.bid = buffer;
+    __atomic_store_n(&buf_ring_->tail, ++buf_tail_, __ATOMIC_RELEASE);
+}
+
+IoUringPoller::~IoUringPoller() {
+    if (buffers_) munmap(buffers_, buffers_size_);
+    if (buf_ring_) munmap(buf_ring_, buf_ring_size_);
+    if (sqes_) munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ >= 0) close(ring_fd_);
+}
+
+bool IoUringPoller::add(const int fd, const uint32_t events, const uint64_t id) {
+    std::lock_guard lock(mutex_);
+    if (registered_.contains(fd)) return false;
+
+    Registered &registered = registered_[fd] = {events, id, false};
+    if (!arm_locked(fd, registered)) {
+        registered_.erase(fd);
+        return false;
+    }
+    return true;
+}
+
+bool IoUringPoller::add_reader(const int fd, const uint32_t events, const uint64_t id) {
+    std::lock_guard lock(mutex_);
+    if (registered_.contains(fd)) return false;
+
+    Registered &registered = registered_[fd] = {events, id, true};
+    registered.polled_reads = !buf_ring_;
+    if (!arm_locked(fd, registered)) {
+        cancel_locked(registered.read_token);
+        registered_.erase(fd);
+        return false;
+    }
+    return true;
+}
+
+bool IoUringPoller::modify(const int fd, const uint32_t events, const uint64_t id) {
+    std::lock_guard lock(mutex_);
+    const auto it = registered_.find(fd);
+    if (it == registered_.end()) return false;
+
+    /* A reader's multishot read stays armed, only its poll changes */
+    Registered &registered = it->second;
+    registered.events = events;
+    registered.id = id;
+    cancel_locked(registered.poll_token);
+    return arm_poll_locked(fd, registered);
+}
+
+void IoUringPoller::remove(const int fd) {
+    std::lock_guard lock(mutex_);
+    const auto it = registered_.find(fd);
+    if (it == registered_.end()) return;
+
+    const bool reading = it->second.read_token;
+    cancel_locked(it->second.poll_token);
+    cancel_locked(it->second.read_token);
+    registered_.erase(it);
+
+    /* Stop the read right away, the caller may close the fd or read it itself next */
+    if (reading) {
+        sys_io_uring_enter(ring_fd_, *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE), 0, 0);
+    }
+}
+
+void IoUringPoller::release(const Event &event) {
+    if (event.read && event.data) {
+        recycle_buffer(event.buffer);
+    }
+}
+
+int IoUringPoller::wait(Event *events, const int max) {
+    while (true) {
+        unsigned to_submit;
+        {
+            std::lock_guard lock(mutex_);
+            to_submit = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        }
+        const bool completions_ready = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) != *cq_head_;
+
+        /* One syscall submits every queued (re)registration and waits for the next completion */
+        if (to_submit > 0 || !completions_ready) {
+            if (sys_io_uring_enter(ring_fd_, to_submit, completions_ready ? 0 : 1,
+                                   completions_ready ? 0 : IORING_ENTER_GETEVENTS) < 0 &&
+                errno != EBUSY && errno != EAGAIN) {
+                return -1;
+            }
+        }
+
+        int n = 0;
+        std::lock_guard lock(mutex_);
+        unsigned head = *cq_head_;
+        const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        while (head != tail && n < max) {
+            const io_uring_cqe cqe = cqes_[head & *cq_mask_];
+            ++head;
+
+            if (cqe.user_data == INTERNAL_USER_DATA) continue;
+            const auto it = armed_.find(cqe.user_data);
+            /* Completion of a request that was removed or re-armed since */
+            if (it == armed_.end()) {
+                if (cqe.flags & IORING_CQE_F_BUFFER) {
+                    recycle_buffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+                }
+                continue;
+            }
+
+            const Armed armed = it->second;
+            Registered &registered = registered_.at(armed.fd);
+            /* The kernel ended the multishot request: on error, EOF or e.g. CQ overflow */
+            const bool ended = !(cqe.flags & IORING_CQE_F_MORE);
+            if (ended) {
+                armed_.erase(it);
+                (armed.read ? registered.read_token : registered.poll_token) = 0;
+            }
+
+            if (armed.read) {
+                if (cqe.res == -ENOBUFS) {
+                    /* Every buffer is still with the caller, they are back by the time this is submitted */
+                    if (ended) arm_read_locked(armed.fd, registered);
+                    continue;
+                }
+                if (cqe.res == -EINVAL || cqe.res == -EBADFD || cqe.res == -EOPNOTSUPP) {
+                    Utility::debugPrint("io_uring can't read fd " + std::to_string(armed.fd) + ", polling it instead");
+                    cancel_locked(registered.read_token);
+                    cancel_locked(registered.poll_token);
+                    registered.polled_reads = true;
+                    arm_poll_locked(armed.fd, registered);
+                    continue;
+                }
+
+                Event &event = events[n++];
+                event = {registered.id, EPOLLIN, true, cqe.res};
+                if (cqe.flags & IORING_CQE_F_BUFFER) {
+                    event.buffer = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                    event.data = buffers_ + static_cast<size_t>(event.buffer) * READ_BUFFER_SIZE;
+                }
+                if (ended && cqe.res > 0) arm_read_locked(armed.fd, registered);
+                continue;
+            }
+
+            if (cqe.res < 0) {
+                Utility::error("io_uring poll failed for fd " + std::to_string(armed.fd) + ": " +
+                               strerror(-cqe.res));
+                cancel_locked(registered.poll_token);
+                events[n++] = {registered.id, EPOLLERR};
+                continue;
+            }
+
+            auto ready = static_cast<uint32_t>(cqe.res);
+            if (registered.reader && !registered.polled_reads) {
+                /* Data, EOF and errors of a reader arrive in order through its read */
+                ready &= ~(EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+            }
+            if (ready) {
+                events[n++] = {registered.id, ready};
+            }
+            if (ended) arm_poll_locked(armed.fd, registered);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+        if (n > 0) return n;
+    }
+}
+
+io_uring_sqe *IoUringPoller::next_sqe_locked() {
+    const unsigned tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        /* Ring full: submit right away instead of waiting for the loop thread */
+        sys_io_uring_enter(ring_fd_, sq_entries_, 0, 0);
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            Utility::error("io_uring submission queue is full");
+            return nullptr;
+        }
+    }
+
+    io_uring_sqe *sqe = &sqes_[tail & *sq_mask_];
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void IoUringPoller::publish_sqe_locked() {
+    const unsigned tail = *sq_tail_;
+    sq_array_[tail & *sq_mask_] = tail & *sq_mask_;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+}
+
+bool IoUringPoller::arm_locked(const int fd, Registered &registered) {
+    if (registered.reader && !registered.polled_reads && !arm_read_locked(fd, registered)) return false;
+    return arm_poll_locked(fd, registered);
+}
+
+bool IoUringPoller::arm_poll_locked(const int fd, Registered &registered) {
+    uint32_t events = registered.events;
+    if (registered.reader && !registered.polled_reads) {
+        events &= ~(EPOLLIN | EPOLLRDHUP);
+    }
+    /* A reader that only wants its data needs no poll */
+    if (!events) return true;
+
+    io_uring_sqe *sqe = next_sqe_locked();
+    if (!sqe) return false;
+
+    const uint64_t token = next_token_++;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = token;
+    publish_sqe_locked();
+
+    armed_[token] = {fd, false};
+    registered.poll_token = token;
+    return true;
+}
+
+bool IoUringPoller::arm_read_locked(const int fd, Registered &registered) {
+    io_uring_sqe *sqe = next_sqe_locked();
+    if (!sqe) return false;
+
+    const uint64_t token = next_token_++;
+    sqe->opcode = OP_READ_MULTISHOT;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = READ_BUFFER_GROUP;
+    sqe->user_data = token;
+    publish_sqe_locked();
+
+    armed_[token] = {fd, true};
+    registered.read_token = token;
+    return true;
+}
+
+void IoUringPoller::cancel_locked(uint64_t &token) {
+    if (!token) return;
+    const auto it = armed_.find(token);
+    const bool read = it != armed_.end() && it->second.read;
+    if (it != armed_.end()) armed_.erase(it);
+
+    if (io_uring_sqe *sqe = next_sqe_locked()) {
+        sqe->opcode = read ? IORING_OP_ASYNC_CANCEL : IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = token;
+        sqe->user_data = INTERNAL_USER_DATA;
+        publish_sqe_locked();
+    }
+    token = 0;
+}
@@ -0,0 +1,134 @@
+#ifndef IOURINGPOLLER_H
+#define IOURINGPOLLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <linux/io_uring.h>
+
+#include "Poller.h"
+
+/**
+ * io_uring backend: every registration is a multishot IORING_OP_POLL_ADD that
+ * stays armed across events, so steady-state operation needs no syscall per
+ * registration and a single io_uring_enter() both submits queued changes and
+ * waits for completions.
+ *
+ * Readers get a multishot read instead (kernel 6.7+): the kernel reads into a
+ * ring of provided buffers as data arrives and the completion carries the
+ * bytes, so evdev and socket reads cost no read() call at all. On older
+ * kernels, or for a file the kernel can't read that way, the reader falls
+ * back to a poll and the caller reads.
+ *
+ * Like EPOLLET, a multishot poll reports new readiness rather than a level, so
+ * handlers must drain their fd until EAGAIN (all of them already do).
+ *
+ * Talks to the kernel through raw syscalls, liburing is not required.
+ */
+class IoUringPoller final : public Poller {
+public:
+    /**
+     *  Returns nullptr if the kernel lacks io_uring or multishot poll, or io_uring is disabled.
+     */
+    static std::unique_ptr<IoUringPoller> create();
+
+    ~IoUringPoller() override;
+
+    bool add(int fd, uint32_t events, uint64_t id) override;
+
+    bool add_reader(int fd, uint32_t events, uint64_t id) override;
+
+    bool modify(int fd, uint32_t events, uint64_t id) override;
+
+    void remove(int fd) override;
+
+    void release(const Event &event) override;
+
+    int wait(Event *events, int max) override;
+
+    [[nodiscard]] const char *name() const override { return "io_uring"; }
+
+    [[nodiscard]] bool submits_lazily() const override { return true; }
+
+private:
+    struct Registered {
+        uint32_t events;
+        uint64_t id;
+        bool reader;
+        /* The kernel can't multishot-read this fd, it is polled for EPOLLIN instead */
+        bool polled_reads = false;
+        uint64_t poll_token = 0;
+        uint64_t read_token = 0;
+    };
+
+    struct Armed {
+        int fd;
+        bool read;
+    };
+
+    int ring_fd_ = -1;
+
+    void *sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void *cq_ring_ = nullptr;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe *sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned *sq_head_ = nullptr;
+    unsigned *sq_tail_ = nullptr;
+    unsigned *sq_mask_ = nullptr;
+    unsigned *sq_array_ = nullptr;
+    unsigned sq_entries_ = 0;
+
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned *cq_mask_ = nullptr;
+    io_uring_cqe *cqes_ = nullptr;
+
+    /* Provided buffer ring of the multishot reads, null if they are unsupported; only touched by the loop thread */
+    io_uring_buf_ring *buf_ring_ = nullptr;
+    size_t buf_ring_size_ = 0;
+    uint8_t *buffers_ = nullptr;
+    size_t buffers_size_ = 0;
+    uint16_t buf_tail_ = 0;
+
+    /* Guards the submission ring and the maps below */
+    std::mutex mutex_;
+    /* user_data of each armed request; re-arming picks a new token so stale completions are ignored */
+    uint64_t next_token_ = 1;
+    std::unordered_map<uint64_t, Armed> armed_;
+    std::unordered_map<int, Registered> registered_;
+
+    IoUringPoller() = default;
+
+    bool setup();
+
+    /**
+     *  Registers the provided buffer ring if the kernel supports multishot reads.
+     */
+    bool setup_read_buffers();
+
+    [[nodiscard]] bool supports(uint8_t opcode) const;
+
+    void recycle_buffer(uint16_t buffer);
+
+    io_uring_sqe *next_sqe_locked();
+
+    void publish_sqe_locked();
+
+    /**
+     *  Arms what the registration needs: a multishot read for readers, a multishot poll for the rest of the mask.
+     */
+    bool arm_locked(int fd, Registered &registered);
+
+    bool arm_poll_locked(int fd, Registered &registered);
+
+    bool arm_read_locked(int fd, Registered &registered);
+
+    void cancel_locked(uint64_t &token);
+};
+
+#endif // IOURINGPOLLER_H
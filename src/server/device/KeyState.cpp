@@ -0,0 +1,33 @@
+#include "KeyState.h"
+
+#include <numeric>
+
+void KeyState::add_remap(std::vector<uint16_t> &table, const std::vector<RemapEntry> &entries, const int ptt_key) {
+    for (const auto &[from, to]: entries) {
+        const int code = to == REMAP_TO_PTT ? ptt_key : to;
+        if (from >= KEY_CNT || code < 0 || code >= KEY_CNT) continue;
+
+        if (table.empty()) {
+            table.resize(KEY_CNT);
+            std::iota(table.begin(), table.end(), 0);
+        }
+        table[from] = static_cast<uint16_t>(code);
+    }
+}
+
+KeyBits KeyState::apply_remap(const KeyBits &state, const std::vector<uint16_t> &remap) {
+    if (remap.empty()) return state;
+
+    KeyBits mapped;
+    state.for_each([&](const int code) { mapped.set(remap[code]); });
+    mapped.reset(REMAP_DROP);
+    return mapped;
+}
+
+KeyBits KeyState::lost_transitions(const KeyBits &state, const KeyBits &keys_down, const KeyBits &target_keys) {
+    KeyBits changed;
+    for (size_t w = 0; w < KeyBits::WORDS; ++w) {
+        changed.words[w] = (state.words[w] ^ keys_down.words[w]) & ~target_keys.words[w];
+    }
+    return changed;
+}
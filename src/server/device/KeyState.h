@@ -0,0 +1,39 @@
+#ifndef KEYSTATE_H
+#define KEYSTATE_H
+
+#include <cstdint>
+#include <vector>
+#include <linux/input.h>
+
+#include "common/device/DeviceCapabilities.h"
+#include "common/utilities/Utility.h"
+
+using KeyBits = CapabilityBits<KEY_CNT>;
+
+/**
+ * Key code arithmetic of exclusive devices: remap tables and recovering from
+ * SYN_DROPPED. Kept free of any device or proxy state so it can be exercised
+ * without evdev.
+ */
+namespace KeyState {
+    /**
+     *  Merges one subscription's remap entries into a lookup table indexed by the physical code.
+     *  REMAP_TO_PTT resolves to ptt_key, entries with codes past KEY_MAX are ignored and later
+     *  entries win. The table stays empty, i.e. the identity, until the first entry lands.
+     */
+    void add_remap(std::vector<uint16_t> &table, const std::vector<RemapEntry> &entries, int ptt_key);
+
+    /**
+     *  Translates the physical key state into the codes the bindings and the virtual device see.
+     *  Keys remapped to REMAP_DROP vanish; an empty table leaves the state untouched.
+     */
+    KeyBits apply_remap(const KeyBits &state, const std::vector<uint16_t> &remap);
+
+    /**
+     *  Keys whose state differs from what the virtual device was last told, excluding
+     *  the bound PTT keys, which never reach the virtual device.
+     */
+    KeyBits lost_transitions(const KeyBits &state, const KeyBits &keys_down, const KeyBits &target_keys);
+}
+
+#endif // KEYSTATE_H
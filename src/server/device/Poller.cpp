@@ -0,0 +1,81 @@
+#include "Poller.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "common/utilities/Utility.h"
+#include "IoUringPoller.h"
+
+#define MAX_EPOLL_EVENTS 64
+
+std::unique_ptr<Poller> Poller::create(const IoEngine engine) {
+    if (engine == IoEngine::IoUring) {
+        if (auto poller = IoUringPoller::create()) {
+            return poller;
+        }
+        Utility::print("io_uring is unavailable, falling back to epoll");
+    }
+    return std::make_unique<EpollPoller>();
+}
+
+bool parse_io_engine(const std::string &name, IoEngine &engine) {
+    if (name == "epoll") {
+        engine = IoEngine::Epoll;
+        return true;
+    }
+    if (name == "io_uring" || name == "uring") {
+        engine = IoEngine::IoUring;
+        return true;
+    }
+    return false;
+}
+
+EpollPoller::EpollPoller() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        throw std::runtime_error("epoll_create1 failed: " + std::string(strerror(errno)));
+    }
+}
+
+EpollPoller::~EpollPoller() {
+    close(epoll_fd_);
+}
+
+bool EpollPoller::add(const int fd, const uint32_t events, const uint64_t id) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.u64 = id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        Utility::error("epoll_ctl(ADD) failed for fd " + std::to_string(fd) + ": " + strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool EpollPoller::modify(const int fd, const uint32_t events, const uint64_t id) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.u64 = id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        Utility::error("epoll_ctl(MOD) failed for fd " + std::to_string(fd) + ": " + strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void EpollPoller::remove(const int fd) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int EpollPoller::wait(Event *events, const int max) {
+    epoll_event ready[MAX_EPOLL_EVENTS];
+    const int n = epoll_wait(epoll_fd_, ready, std::min(max, MAX_EPOLL_EVENTS), -1);
+    for (int i = 0; i < n; ++i) {
+        events[i] = {ready[i].data.u64, ready[i].events};
+    }
+    return n;
+}
@@ -0,0 +1,100 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+enum class IoEngine {
+    Epoll,
+    IoUring,
+};
+
+/**
+ * Readiness notification backend of the EventLoop.
+ *
+ * Registrations are identified by an opaque 64-bit id chosen by the caller and
+ * handed back with every event. Event masks use the EPOLL* bits for every
+ * backend. add/modify/remove may be called from any thread, wait() only from
+ * the loop thread.
+ */
+class Poller {
+public:
+    struct Event {
+        uint64_t id;
+        uint32_t events;
+        /* Set when the backend already read for a reader registration, see add_reader() */
+        bool read = false;
+        /* Bytes read (0 at EOF, -errno on error) and where they are, valid until release() */
+        int32_t result = 0;
+        const uint8_t *data = nullptr;
+        uint16_t buffer = 0;
+    };
+
+    virtual ~Poller() = default;
+
+    virtual bool add(int fd, uint32_t events, uint64_t id) = 0;
+
+    virtual bool modify(int fd, uint32_t events, uint64_t id) = 0;
+
+    virtual void remove(int fd) = 0;
+
+    /**
+     *  Registers an fd whose data the caller wants rather than its readiness.
+     *  Backends that can read by themselves return the data as read events and
+     *  report only the remaining bits of the mask (e.g. EPOLLOUT) as readiness.
+     *  Otherwise, as with add(), EPOLLIN is reported and the caller reads.
+     */
+    virtual bool add_reader(const int fd, const uint32_t events, const uint64_t id) { return add(fd, events, id); }
+
+    /**
+     *  Hands the buffer of a read event back once the caller is done with its data.
+     */
+    virtual void release(const Event &) {
+    }
+
+    /**
+     *  Blocks until at least one event is ready and stores up to max of them.
+     *  Returns the number of events, or -1 with errno set.
+     */
+    virtual int wait(Event *events, int max) = 0;
+
+    [[nodiscard]] virtual const char *name() const = 0;
+
+    /**
+     *  Whether registrations only take effect once the loop thread next enters wait().
+     */
+    [[nodiscard]] virtual bool submits_lazily() const { return false; }
+
+    /**
+     *  Creates the requested backend, falling back to epoll if it is unavailable.
+     */
+    static std::unique_ptr<Poller> create(IoEngine engine);
+};
+
+class EpollPoller final : public Poller {
+public:
+    EpollPoller();
+
+    ~EpollPoller() override;
+
+    bool add(int fd, uint32_t events, uint64_t id) override;
+
+    bool modify(int fd, uint32_t events, uint64_t id) override;
+
+    void remove(int fd) override;
+
+    int wait(Event *events, int max) override;
+
+    [[nodiscard]] const char *name() const override { return "epoll"; }
+
+private:
+    int epoll_fd_ = -1;
+};
+
+/**
+ *  Parses an --io-engine value ("epoll" or "io_uring"). Returns false on unknown names.
+ */
+bool parse_io_engine(const std::string &name, IoEngine &engine);
+
+#endif // POLLER_H
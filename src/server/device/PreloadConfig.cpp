@@ -0,0 +1,75 @@
+#include "PreloadConfig.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+
+std::vector<DeviceSetup> PreloadConfig::load() {
+    std::vector<DeviceSetup> configs;
+    std::ifstream file(PRELOAD_CONFIG_PATH);
+    if (!file.is_open()) return configs;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+        DeviceSetup config{};
+        int exclusive = 0;
+        if (!(iss >> config.vendor_id >> config.product_id >> config.uid >> config.target_key >> exclusive >>
+              config.debounce_ms)) {
+            continue;
+        }
+        config.exclusive = exclusive != 0;
+
+        std::string pair;
+        while (iss >> pair && config.remap.size() < MAX_REMAP_ENTRIES) {
+            unsigned from = 0, to = 0;
+            if (sscanf(pair.c_str(), "%u:%u", &from, &to) == 2) {
+                config.remap.push_back({static_cast<uint16_t>(from), static_cast<uint16_t>(to)});
+            }
+        }
+        configs.push_back(std::move(config));
+    }
+    Utility::debugPrint("Loaded " + std::to_string(configs.size()) + " preload device configs");
+    return configs;
+}
+
+void PreloadConfig::save(const std::vector<DeviceSetup> &configs) {
+    const std::string path = PRELOAD_CONFIG_PATH;
+    const std::string dir = path.substr(0, path.rfind('/'));
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        Utility::error("Can't create " + dir + ", preload configs will not be persisted");
+        return;
+    }
+
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file.is_open()) {
+            Utility::error("Can't write " + tmp_path);
+            return;
+        }
+        for (const auto &config: configs) {
+            file << config.vendor_id << " " << config.product_id << " " << config.uid << " " << config.target_key
+                    << " " << (config.exclusive ? 1 : 0) << " " << config.debounce_ms;
+            for (const auto &[from, to]: config.remap) {
+                file << " " << from << ":" << to;
+            }
+            file << "\n";
+        }
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+        Utility::error("Can't replace " + path);
+    }
+}
+
+bool PreloadConfig::same_config(const DeviceSetup &a, const DeviceSetup &b) {
+    return a.vendor_id == b.vendor_id && a.product_id == b.product_id && a.uid == b.uid &&
+           a.target_key == b.target_key && a.exclusive == b.exclusive && a.debounce_ms == b.debounce_ms &&
+           std::ranges::equal(a.remap, b.remap, [](const RemapEntry &x, const RemapEntry &y) {
+               return x.from == y.from && x.to == y.to;
+           });
+}
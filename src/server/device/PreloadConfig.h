@@ -0,0 +1,25 @@
+#ifndef PRELOADCONFIG_H
+#define PRELOADCONFIG_H
+
+#include <vector>
+
+#include "common/utilities/Utility.h"
+
+#define PRELOAD_CONFIG_PATH "/var/lib/ptt/preload"
+
+/**
+ * Device configs the server opens and grabs at startup, before any client connects.
+ *
+ * Stored as one "vendor product uid key exclusive debounce_ms [from:to ...]" line per config and
+ * rewritten with the configs of all connected clients whenever one of them sends
+ * its CONFIG_LIST, so the next boot pre-grabs what was last in use.
+ */
+namespace PreloadConfig {
+    std::vector<DeviceSetup> load();
+
+    void save(const std::vector<DeviceSetup> &configs);
+
+    bool same_config(const DeviceSetup &a, const DeviceSetup &b);
+}
+
+#endif // PRELOADCONFIG_H
@@ -0,0 +1,244 @@
+#include "VirtualDevicePool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+#include <zlib.h>
+
+#include "common/utilities/Utility.h"
+
+using namespace DeviceUtils;
+
+/* Virtual devices are created from add_devices() worker threads as well as the loop thread */
+static std::atomic<uint16_t> vendor_counter{0};
+static std::atomic<uint16_t> product_counter{0};
+
+VirtualDevicePool &VirtualDevicePool::instance() {
+    static VirtualDevicePool pool;
+    return pool;
+}
+
+VirtualDevicePool::~VirtualDevicePool() {
+    for (const auto &device: idle_) {
+        destroy(device.ufd);
+    }
+}
+
+int VirtualDevicePool::acquire(const DeviceCapabilities &caps) {
+    const uint64_t key = fingerprint(caps);
+    {
+        std::lock_guard lock(mutex_);
+        if (const auto it = std::ranges::find_if(idle_, [&](const PooledDevice &d) { return d.fingerprint == key; });
+            it != idle_.end()) {
+            const int ufd = it->ufd;
+            idle_.erase(it);
+            in_use_[ufd] = key;
+            Utility::debugPrint("Reusing pooled virtual device fd=" + std::to_string(ufd));
+            return ufd;
+        }
+    }
+
+    const int ufd = create_virtual_device(caps);
+    if (ufd >= 0) {
+        std::lock_guard lock(mutex_);
+        in_use_[ufd] = key;
+    }
+    return ufd;
+}
+
+void VirtualDevicePool::release(const int ufd, const CapabilityBits<KEY_CNT> &keys_down) {
+    if (ufd < 0) return;
+
+    /* Never park a device with keys held, the next owner would inherit a stuck key */
+    if (keys_down.any()) {
+        std::vector<input_event> events;
+        keys_down.for_each([&](const int code) {
+            input_event ev{};
+            ev.type = EV_KEY;
+            ev.code = static_cast<uint16_t>(code);
+            ev.value = 0;
+            events.push_back(ev);
+        });
+        input_event syn{};
+        syn.type = EV_SYN;
+        syn.code = SYN_REPORT;
+        events.push_back(syn);
+        Utility::safe_write(ufd, events.data(), events.size() * sizeof(input_event));
+    }
+
+    std::lock_guard lock(mutex_);
+    const auto it = in_use_.find(ufd);
+    if (it == in_use_.end()) {
+        destroy(ufd);
+        return;
+    }
+
+    idle_.push_back({ufd, it->second, std::chrono::steady_clock::now()});
+    in_use_.erase(it);
+
+    while (idle_.size() > VIRTUAL_DEVICE_POOL_MAX_IDLE) {
+        const auto oldest = std::ranges::min_element(idle_, {}, &PooledDevice::released_at);
+        destroy(oldest->ufd);
+        idle_.erase(oldest);
+    }
+    Utility::debugPrint("Parked virtual device fd=" + std::to_string(ufd) +
+                        ", idle devices: " + std::to_string(idle_.size()));
+}
+
+uint64_t VirtualDevicePool::fingerprint(const DeviceCapabilities &caps) {
+    uLong crc = crc32(0, nullptr, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(caps.ev_bits.words), sizeof(caps.ev_bits.words));
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(caps.msc_bits.words), sizeof(caps.msc_bits.words));
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(caps.led_bits.words), sizeof(caps.led_bits.words));
+
+    uint32_t uid = 0;
+    try {
+        uid = generate_uid(caps);
+    } catch (...) {
+        /* Devices with unreadable axes are still pooled by their bitmaps */
+    }
+    return static_cast<uint64_t>(uid) << 32 | static_cast<uint32_t>(crc);
+}
+
+void VirtualDevicePool::destroy(const int ufd) {
+    ioctl(ufd, UI_DEV_DESTROY);
+    close(ufd);
+}
+
+int VirtualDevicePool::create_virtual_device(const DeviceCapabilities &caps) {
+    const int ufd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (ufd < 0) {
+        Utility::error("Failed to open /dev/uinput");
+        return -1;
+    }
+
+    bool has_ff = false;
+    try {
+        has_ff = setup_capabilities(caps, ufd);
+    } catch (const std::exception &e) {
+        std::cerr << "setup_capabilities failed: " << e.what() << std::endl;
+        close(ufd);
+        return -1;
+    }
+
+    uinput_user_dev uidev = {};
+    const std::string dev_name = "PTT Virtual Device " + std::to_string(ufd);
+    strncpy(uidev.name, dev_name.c_str(), UINPUT_MAX_NAME_SIZE - 1);
+    uidev.name[UINPUT_MAX_NAME_SIZE - 1] = '\0';
+
+    uidev.id.bustype = BUS_USB;
+
+    uidev.id.vendor = 0x1234 + vendor_counter.fetch_add(1, std::memory_order_relaxed);
+    uidev.id.product = 0x5678 + product_counter.fetch_add(1, std::memory_order_relaxed);
+    uidev.id.version = 1;
+
+    if (has_ff) {
+        uidev.ff_effects_max = 16;
+    }
+
+    if (Utility::safe_write(ufd, &uidev, sizeof(uidev)) != sizeof(uidev)) {
+        Utility::error("Failed to write uinput_user_dev struct");
+        close(ufd);
+        return -1;
+    }
+
+    if (ioctl(ufd, UI_DEV_CREATE) < 0) {
+        Utility::error("Failed to create virtual uinput device");
+        close(ufd);
+        return -1;
+    }
+
+    std::cout << "Successfully created virtual device: " << dev_name << std::endl;
+    return ufd;
+}
+
+bool VirtualDevicePool::setup_capabilities(const DeviceCapabilities &caps, const int ufd) {
+    if (!caps.ev_bits.any()) {
+        Utility::error("Failed to get event types from physical device");
+        throw std::runtime_error("Failed to get event types");
+    }
+
+    bool has_ff = false;
+
+    caps.ev_bits.for_each([&](const int ev) {
+        if (ev >= EV_MAX) return;
+
+        Utility::debugPrint("Setting event type: " + std::to_string(ev) + "\n");
+        if (ioctl(ufd, UI_SET_EVBIT, ev) < 0) {
+            Utility::error("UI_SET_EVBIT failed for event type " + std::to_string(ev) + ": " +
+                           std::string(strerror(errno)));
+            throw std::runtime_error(
+                "UI_SET_EVBIT failed for event type " + std::to_string(ev) + ": " +
+                std::string(strerror(errno)));
+        }
+        if (ev == EV_FF) {
+            has_ff = true;
+        }
+        setup_event_codes(caps, ufd, ev);
+    });
+
+    return has_ff;
+}
+
+void VirtualDevicePool::setup_event_codes(const DeviceCapabilities &caps, const int ufd, const int ev_type) {
+    switch (ev_type) {
+        case EV_KEY:
+            caps.key_bits.for_each([ufd](const int code) { ioctl(ufd, UI_SET_KEYBIT, code); });
+            break;
+        case EV_REL:
+            caps.rel_bits.for_each([ufd](const int code) { ioctl(ufd, UI_SET_RELBIT, code); });
+            break;
+        case EV_ABS:
+            caps.abs_bits.for_each([&](const int code) { setup_abs_axis(caps, ufd, code); });
+            break;
+        case EV_MSC:
+            caps.msc_bits.for_each([ufd](const int code) { ioctl(ufd, UI_SET_MSCBIT, code); });
+            break;
+        case EV_LED:
+            caps.led_bits.for_each([ufd](const int code) { ioctl(ufd, UI_SET_LEDBIT, code); });
+            break;
+        default:
+            break;
+    }
+}
+
+void VirtualDevicePool::setup_abs_axis(const DeviceCapabilities &caps, const int ufd, const int code) {
+    if (ioctl(ufd, UI_SET_ABSBIT, code) < 0) {
+        Utility::error("Failed to set ABS bit for code: " + std::to_string(code));
+        return;
+    }
+
+    uinput_abs_setup abs = {};
+    abs.code = code;
+    if (caps.abs_info_valid.test(code)) {
+        abs.absinfo = caps.abs_info[code];
+
+        Utility::debugPrint("ABS[" + std::to_string(code) + "] - min: " + std::to_string(abs.absinfo.minimum) +
+                            ", max: " + std::to_string(abs.absinfo.maximum) +
+                            ", flat: " + std::to_string(abs.absinfo.flat) +
+                            ", fuzz: " + std::to_string(abs.absinfo.fuzz) +
+                            ", resolution: " + std::to_string(abs.absinfo.resolution));
+
+        if (ioctl(ufd, UI_ABS_SETUP, &abs) < 0) {
+            Utility::error("Failed UI_ABS_SETUP for ABS[" + std::to_string(code) + "]: " +
+                           std::string(strerror(errno)));
+        }
+    } else {
+        Utility::error("Failed fallback EVIOCGABS for ABS[" + std::to_string(code) + "]");
+
+        abs.absinfo.minimum = 0;
+        abs.absinfo.maximum = 255;
+
+        if (ioctl(ufd, UI_ABS_SETUP, &abs) < 0) {
+            Utility::error("Failed fallback UI_ABS_SETUP for ABS[" + std::to_string(code) + "]: " +
+                           std::string(strerror(errno)));
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef VIRTUALDEVICEPOOL_H
+#define VIRTUALDEVICEPOOL_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "common/device/DeviceCapabilities.h"
+
+#define VIRTUAL_DEVICE_POOL_MAX_IDLE 8
+
+/**
+ * Keeps uinput clones of physical devices alive across client sessions.
+ *
+ * Devices are keyed by a fingerprint of the capabilities they were cloned
+ * from, so a reconnecting client gets back the same virtual device instead
+ * of making games and compositors see it vanish and reappear.
+ */
+class VirtualDevicePool {
+public:
+    static VirtualDevicePool &instance();
+
+    ~VirtualDevicePool();
+
+    /**
+     *  Returns a virtual device matching the capabilities, reusing an idle one when possible.
+     *  Returns -1 on error.
+     */
+    int acquire(const DeviceCapabilities &caps);
+
+    /**
+     *  Releases every key still held down on the device and parks it for reuse.
+     */
+    void release(int ufd, const CapabilityBits<KEY_CNT> &keys_down);
+
+private:
+    struct PooledDevice {
+        int ufd = -1;
+        uint64_t fingerprint = 0;
+        std::chrono::steady_clock::time_point released_at;
+    };
+
+    std::mutex mutex_;
+    std::vector<PooledDevice> idle_;
+    std::unordered_map<int, uint64_t> in_use_;
+
+    VirtualDevicePool() = default;
+
+    static uint64_t fingerprint(const DeviceCapabilities &caps);
+
+    static void destroy(int ufd);
+
+    [[nodiscard]] static int create_virtual_device(const DeviceCapabilities &caps);
+
+    static bool setup_capabilities(const DeviceCapabilities &caps, int ufd);
+
+    static void setup_event_codes(const DeviceCapabilities &caps, int ufd, int ev_type);
+
+    static void setup_abs_axis(const DeviceCapabilities &caps, int ufd, int code);
+};
+
+#endif // VIRTUALDEVICEPOOL_H
@@ -4,241 +4,750 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <chrono>
 #include <cstring>
+#include <future>
 #include <stdexcept>
 #include <utility>
 #include <iomanip>
 #include <iostream>
+#include <ranges>
 #include <sstream>
 #include <linux/uinput.h>
 
 #include "common/utilities/Utility.h"
 #include "common/device/DeviceCapabilities.h"
+#include "common/utilities/LatencyHistogram.h"
+#include "DeviceIndex.h"
+#include "KeyState.h"
+#include "VirtualDevicePool.h"
+#include "server/stats/ServerStats.h"
 
 using namespace DeviceUtils;
 
-static uint16_t vendor_counter = 0;
-static uint16_t product_counter = 0;
+#define THROUGHPUT_REPORT_INTERVAL_MS 10000
+#define BACKLOG_RETRY_INTERVAL_MS 1
+/* Events a stalled virtual device may fall behind by, about 100 KiB per device */
+#define BACKLOG_MAX_EVENTS 4096
 
-void VirtualInputProxy::add_failed_config(const DeviceConfig &config) {
-    const auto already_failed = std::ranges::any_of(failed_configs,
-                                                    [&](const DeviceConfig &dc) {
-                                                        return dc.vendor_id == config.vendor_id &&
-                                                               dc.product_id == config.product_id &&
-                                                               dc.uid == config.uid &&
-                                                               dc.target_key == config.target_key;
-                                                    });
-    if (!already_failed) {
-        failed_configs.push_back(config);
+static uint64_t event_micros(const input_event &ev) {
+    return static_cast<uint64_t>(ev.input_event_sec) * 1000000 + ev.input_event_usec;
+}
+
+VirtualInputProxy::VirtualInputProxy() : owned_loop_(std::make_unique<EventLoop>()), loop_(*owned_loop_) {
+}
+
+VirtualInputProxy::VirtualInputProxy(EventLoop &loop) : loop_(loop) {
+}
+
+void VirtualInputProxy::add_failed_config(const DeviceSetup &config, const SubscriberId subscriber,
+                                          const bool present) {
+    const auto already_failed = std::ranges::find_if(failed_configs,
+                                                     [&](const PendingConfig &pc) {
+                                                         return pc.subscriber == subscriber &&
+                                                                pc.config.vendor_id == config.vendor_id &&
+                                                                pc.config.product_id == config.product_id &&
+                                                                pc.config.uid == config.uid &&
+                                                                pc.config.target_key == config.target_key;
+                                                     });
+    if (already_failed == failed_configs.end()) {
+        failed_configs.push_back({config, subscriber, present});
+    } else {
+        already_failed->present = present;
+    }
+
+    if (present) {
+        update_retry_loop();
     }
 }
 
-void VirtualInputProxy::remove_failed_config(const DeviceConfig &config) {
+void VirtualInputProxy::remove_failed_config(const DeviceConfig &config, const SubscriberId subscriber) {
     std::erase_if(failed_configs,
-                  [&](const DeviceConfig &dc) {
-                      return dc.vendor_id == config.vendor_id &&
-                             dc.product_id == config.product_id &&
-                             dc.uid == config.uid &&
-                             dc.target_key == config.target_key;
+                  [&](const PendingConfig &pc) {
+                      return pc.subscriber == subscriber &&
+                             pc.config.vendor_id == config.vendor_id &&
+                             pc.config.product_id == config.product_id &&
+                             pc.config.uid == config.uid &&
+                             pc.config.target_key == config.target_key;
                   });
 }
 
 void VirtualInputProxy::retry_failed_configs() {
-    for (const auto configs_copy = failed_configs; const auto &config: configs_copy) {
-        remove_failed_config(config);
-        add_device(config);
+    ServerStats::add(ServerStats::instance().retry_attempts, failed_configs.size());
+    for (const auto configs_copy = failed_configs; const auto &[config, subscriber, present]: configs_copy) {
+        remove_failed_config(config, subscriber);
+        add_device(config, subscriber);
     }
+    update_retry_loop();
 }
 
+void VirtualInputProxy::update_retry_loop() {
+    const bool hotplug_running = hotplug_ && hotplug_->is_running();
+    const bool present_failed = std::ranges::any_of(failed_configs,
+                                                    [](const PendingConfig &pc) { return pc.present; });
+    if (started_ && (!hotplug_running || present_failed)) {
+        start_retry_loop();
+    } else {
+        stop_retry_loop();
+    }
+}
 
-void VirtualInputProxy::add_device(const DeviceConfig &config) {
-    const auto &[vendor_id, product_id, uid, target_key, exclusive] = config;
-    const std::string device_path = find_device_path(vendor_id, product_id, uid);
-    if (device_path.empty()) {
-        add_failed_config(config);
 
-        Utility::error(
-            "Failed to find input device: " + std::to_string(vendor_id) + ":" + std::to_string(product_id) + ":" +
-            std::to_string(uid)
-        );
-        return;
+VirtualInputProxy::SubscriberId VirtualInputProxy::add_subscriber(Callback callback) {
+    SubscriberId subscriber = 0;
+    loop_.run_in_loop([&] {
+        subscriber = next_subscriber_++;
+        subscribers_[subscriber] = std::move(callback);
+    });
+    return subscriber;
+}
+
+void VirtualInputProxy::set_subscriber_callback(const SubscriberId subscriber, Callback callback) {
+    loop_.run_in_loop([&] {
+        if (const auto it = subscribers_.find(subscriber); it != subscribers_.end()) {
+            it->second = std::move(callback);
+        }
+    });
+}
+
+void VirtualInputProxy::remove_subscriber(const SubscriberId subscriber) {
+    loop_.run_in_loop([&] {
+        std::vector<DeviceContext *> affected;
+        for (const auto &ctx: contexts_) {
+            std::vector<int> keys;
+            for (const auto &binding: ctx->bindings) {
+                if (std::ranges::any_of(binding.subscriptions,
+                                        [&](const Subscription &sub) { return sub.subscriber == subscriber; })) {
+                    keys.push_back(binding.key);
+                }
+            }
+            for (const int key: keys) {
+                unsubscribe(*ctx, key, subscriber);
+            }
+            if (!keys.empty()) {
+                affected.push_back(ctx.get());
+            }
+        }
+        for (DeviceContext *ctx: affected) {
+            update_device(*ctx);
+        }
+
+        std::erase_if(failed_configs, [&](const PendingConfig &pc) { return pc.subscriber == subscriber; });
+        subscribers_.erase(subscriber);
+    });
+}
+
+void VirtualInputProxy::add_device(const DeviceSetup &config, const SubscriberId subscriber) {
+    loop_.run_in_loop([&] {
+        const auto &[vendor_id, product_id, uid, target_key, exclusive, remap_count, debounce_ms] =
+                static_cast<const DeviceConfig &>(config);
+        const std::string device_path = find_device_path(vendor_id, product_id, uid);
+        if (device_path.empty()) {
+            add_failed_config(config, subscriber);
+
+            Utility::error(
+                "Failed to find input device: " + std::to_string(vendor_id) + ":" + std::to_string(product_id) + ":" +
+                std::to_string(uid)
+            );
+            return;
+        }
+
+        attach_device(config, subscriber, device_path);
+    });
+}
+
+void VirtualInputProxy::add_devices(const std::vector<DeviceSetup> &configs, const SubscriberId subscriber) {
+    loop_.run_in_loop([&] {
+        const uint64_t started_us = monotonic_micros();
+
+        /* Lookups are answered from the DeviceIndex, which serializes them anyway */
+        std::vector<std::pair<std::string, std::vector<DeviceSetup> > > by_path;
+        for (const auto &config: configs) {
+            const std::string device_path = find_device_path(config.vendor_id, config.product_id, config.uid);
+            if (device_path.empty()) {
+                add_failed_config(config, subscriber);
+
+                Utility::error(
+                    "Failed to find input device: " + std::to_string(config.vendor_id) + ":" +
+                    std::to_string(config.product_id) + ":" + std::to_string(config.uid)
+                );
+                continue;
+            }
+
+            auto group = std::ranges::find_if(by_path, [&](const auto &g) { return g.first == device_path; });
+            if (group == by_path.end()) {
+                group = by_path.insert(by_path.end(), {device_path, {}});
+            }
+            group->second.push_back(config);
+        }
+        const uint64_t resolved_us = monotonic_micros();
+
+        std::vector<std::future<PreparedDevice> > pending;
+        for (const auto &[device_path, path_configs]: by_path) {
+            if (std::ranges::any_of(contexts_, [&](const auto &ctx) { return ctx->device_path == device_path; })) {
+                continue;
+            }
+            const bool exclusive = std::ranges::any_of(path_configs, [](const DeviceSetup &c) { return c.exclusive; });
+            pending.push_back(std::async(std::launch::async, prepare_device, device_path, exclusive));
+        }
+
+        for (auto &future: pending) {
+            PreparedDevice prepared = future.get();
+            Utility::debugPrint("Prepared " + prepared.device_path + ": open " + std::to_string(prepared.open_us) +
+                                " us, virtual device " + std::to_string(prepared.virtual_device_us) + " us");
+            if (prepared.fd_physical < 0) {
+                /* attach_device() retries the open and reports the failure */
+                continue;
+            }
+
+            auto ctx = std::make_unique<DeviceContext>();
+            ctx->device_path = prepared.device_path;
+            ctx->fd_physical = prepared.fd_physical;
+            ctx->prepared_ufd = prepared.ufd;
+            contexts_.push_back(std::move(ctx));
+        }
+
+        for (const auto &[device_path, path_configs]: by_path) {
+            for (const auto &config: path_configs) {
+                attach_device(config, subscriber, device_path);
+            }
+        }
+
+        /* Clones nobody ended up grabbing for go back to the pool */
+        for (const auto &ctx: contexts_) {
+            if (ctx->prepared_ufd >= 0) {
+                VirtualDevicePool::instance().release(std::exchange(ctx->prepared_ufd, -1), {});
+            }
+        }
+
+        Utility::debugPrint("Attached " + std::to_string(by_path.size()) + " devices in " +
+                            std::to_string(monotonic_micros() - started_us) + " us (lookup " +
+                            std::to_string(resolved_us - started_us) + " us, " + std::to_string(pending.size()) +
+                            " opened concurrently)");
+    });
+}
+
+VirtualInputProxy::PreparedDevice VirtualInputProxy::prepare_device(const std::string &device_path,
+                                                                    const bool exclusive) {
+    PreparedDevice prepared;
+    prepared.device_path = device_path;
+
+    const uint64_t started_us = monotonic_micros();
+    prepared.fd_physical = open_device(device_path);
+    const uint64_t opened_us = monotonic_micros();
+    prepared.open_us = opened_us - started_us;
+
+    if (prepared.fd_physical >= 0 && exclusive) {
+        prepared.ufd = VirtualDevicePool::instance().acquire(get_device_capabilities(prepared.fd_physical));
+        prepared.virtual_device_us = monotonic_micros() - opened_us;
     }
+    return prepared;
+}
 
+int VirtualInputProxy::open_device(const std::string &device_path) {
     const int fd_physical = open(device_path.c_str(), O_RDONLY | O_NONBLOCK);
-    if (fd_physical < 0) {
-        add_failed_config(config);
+    if (fd_physical < 0) return -1;
 
-        Utility::error("Failed to open input device: " + device_path);
-        return;
+    /* Timestamps are compared against clients' CLOCK_MONOTONIC, not wall time */
+    if (constexpr int clock_id = CLOCK_MONOTONIC; ioctl(fd_physical, EVIOCSCLOCKID, &clock_id) < 0) {
+        Utility::debugPrint("EVIOCSCLOCKID not supported for " + device_path + ", event timestamps use wall time");
     }
+    return fd_physical;
+}
 
-    int ufd = -1;
-    if (exclusive) {
-        if (ioctl(fd_physical, EVIOCGRAB, 1) < 0) {
-            add_failed_config(config);
-            close(fd_physical);
-            Utility::error("Failed to grab physical device: " + device_path);
+void VirtualInputProxy::attach_device(const DeviceSetup &config, const SubscriberId subscriber,
+                                      const std::string &device_path) {
+    auto it = std::ranges::find_if(contexts_,
+                                   [&](const std::unique_ptr<DeviceContext> &ctx) {
+                                       return ctx->device_path == device_path;
+                                   });
+    if (it == contexts_.end()) {
+        const int fd_physical = open_device(device_path);
+        if (fd_physical < 0) {
+            add_failed_config(config, subscriber, true);
+            ServerStats::add(ServerStats::instance().open_failures);
+
+            Utility::error("Failed to open input device: " + device_path);
             return;
         }
 
-        ufd = create_virtual_device(fd_physical);
-        if (ufd < 0) {
-            add_failed_config(config);
-            ioctl(fd_physical, EVIOCGRAB, 0);
-            close(fd_physical);
-            Utility::error("Failed to create virtual device for: " + device_path);
-            return;
+        auto ctx = std::make_unique<DeviceContext>();
+        ctx->device_path = device_path;
+        ctx->fd_physical = fd_physical;
+        contexts_.push_back(std::move(ctx));
+        it = contexts_.end() - 1;
+    }
+    DeviceContext &ctx = **it;
+
+    KeyBinding *binding = ctx.find_binding(config.target_key);
+    if (!binding) {
+        binding = &ctx.bindings.emplace_back();
+        binding->key = config.target_key;
+        ctx.target_keys.set(config.target_key);
+    }
+    const auto sub = std::ranges::find_if(binding->subscriptions,
+                                          [&](const Subscription &s) { return s.subscriber == subscriber; });
+    const bool new_subscription = sub == binding->subscriptions.end();
+    if (new_subscription) {
+        binding->subscriptions.push_back({subscriber, config});
+    } else {
+        sub->config = config;
+    }
+    update_binding(*binding);
+
+    if (!apply_bindings(ctx)) {
+        add_failed_config(config, subscriber, true);
+        unsubscribe(ctx, config.target_key, subscriber);
+        update_device(ctx);
+        return;
+    }
+
+    remove_failed_config(config, subscriber);
+    if (started_) {
+        register_device(ctx);
+    }
+
+    /* A late subscriber still needs to hear about a key that is already held */
+    if (new_subscription && binding->down) {
+        if (const auto cb = subscribers_.find(subscriber); cb != subscribers_.end() && cb->second) {
+            cb->second(binding->key, true, monotonic_micros());
         }
     }
+}
 
-    remove_failed_config(config);
+void VirtualInputProxy::unsubscribe(DeviceContext &ctx, const int key, const SubscriberId subscriber) {
+    KeyBinding *binding = ctx.find_binding(key);
+    if (!binding) return;
 
-    DeviceContext ctx;
-    ctx.fd_physical = fd_physical;
-    ctx.ufd = ufd;
-    ctx.target_key = target_key;
-    ctx.running = false;
-    ctx.exclusive = exclusive;
+    std::erase_if(binding->subscriptions, [&](const Subscription &sub) { return sub.subscriber == subscriber; });
+    if (!binding->subscriptions.empty()) {
+        update_binding(*binding);
+        return;
+    }
 
-    contexts_.push_back(std::move(ctx));
+    cancel_debounce(*binding);
+    std::erase_if(ctx.bindings, [&](const KeyBinding &b) { return b.key == key; });
+    ctx.target_keys.reset(key);
+}
+
+void VirtualInputProxy::update_device(DeviceContext &ctx) {
+    if (!ctx.bindings.empty()) {
+        apply_bindings(ctx);
+        return;
+    }
+
+    if (ctx.registered) {
+        loop_.remove(ctx.fd_physical);
+        ctx.registered = false;
+    }
+    release_device(ctx);
+    std::erase_if(contexts_, [&](const std::unique_ptr<DeviceContext> &c) { return c.get() == &ctx; });
+}
+
+void VirtualInputProxy::update_binding(KeyBinding &binding) {
+    binding.exclusive = false;
+    binding.debounce_ms = 0;
+    for (const auto &[subscriber, config]: binding.subscriptions) {
+        binding.exclusive |= config.exclusive;
+        binding.debounce_ms = std::max(binding.debounce_ms, config.debounce_ms);
+    }
 }
 
-void VirtualInputProxy::remove_device(const DeviceConfig &config) {
-    const auto it = std::ranges::find_if(contexts_,
-                                         [&](const DeviceContext &ctx) {
-                                             return ctx.target_key == config.target_key;
-                                         });
+bool VirtualInputProxy::apply_bindings(DeviceContext &ctx) {
+    const bool exclusive = std::ranges::any_of(ctx.bindings, [](const KeyBinding &b) { return b.exclusive; });
 
-    if (it != contexts_.end()) {
-        it->running = false;
-        if (it->listener_thread.joinable()) {
-            it->listener_thread.join();
+    if (exclusive && !ctx.exclusive) {
+        if (ioctl(ctx.fd_physical, EVIOCGRAB, 1) < 0) {
+            ServerStats::add(ServerStats::instance().grab_failures);
+            Utility::error("Failed to grab physical device: " + ctx.device_path);
+            return false;
         }
-        if (it->fd_physical >= 0) {
-            ioctl(it->fd_physical, EVIOCGRAB, 0);
-            close(it->fd_physical);
+
+        ctx.ufd = ctx.prepared_ufd >= 0
+                      ? std::exchange(ctx.prepared_ufd, -1)
+                      : VirtualDevicePool::instance().acquire(get_device_capabilities(ctx.fd_physical));
+        if (ctx.ufd < 0) {
+            ioctl(ctx.fd_physical, EVIOCGRAB, 0);
+            Utility::error("Failed to create virtual device for: " + ctx.device_path);
+            return false;
+        }
+        /* Everything but the bound keys is forwarded to the virtual device now */
+        apply_event_mask(ctx, false);
+        ctx.exclusive = true;
+    } else if (!exclusive && ctx.exclusive) {
+        release_virtual_device(ctx);
+        ioctl(ctx.fd_physical, EVIOCGRAB, 0);
+        ctx.exclusive = false;
+    }
+
+    if (!ctx.exclusive && !apply_event_mask(ctx, true)) {
+        Utility::debugPrint("EVIOCSMASK not supported for " + ctx.device_path + ", filtering events in userspace");
+    }
+    compile_remap(ctx);
+    return true;
+}
+
+void VirtualInputProxy::compile_remap(DeviceContext &ctx) {
+    ctx.remap.clear();
+    if (!ctx.exclusive) return;
+
+    for (const auto &binding: ctx.bindings) {
+        for (const auto &[subscriber, config]: binding.subscriptions) {
+            KeyState::add_remap(ctx.remap, config.remap, binding.key);
+        }
+    }
+}
+
+VirtualInputProxy::KeyBinding *VirtualInputProxy::DeviceContext::find_binding(const int key) {
+    for (auto &binding: bindings) {
+        if (binding.key == key) return &binding;
+    }
+    return nullptr;
+}
+
+void VirtualInputProxy::on_hotplug(const HotplugMonitor::Action action, const std::string &dev_path) {
+    const std::string event_name = dev_path.substr(strlen("/dev/input/"));
+    if (action == HotplugMonitor::Action::Remove) {
+        const auto it = std::ranges::find_if(contexts_,
+                                             [&](const std::unique_ptr<DeviceContext> &ctx) {
+                                                 return ctx->device_path == dev_path;
+                                             });
+        if (it != contexts_.end()) {
+            Utility::print("Input device unplugged: " + dev_path);
+            detach_device(**it);
         }
-        if (it->ufd >= 0) {
-            ioctl(it->ufd, UI_DEV_DESTROY);
-            close(it->ufd);
+        DeviceIndex::instance().on_removed(event_name);
+        unwatch_device(dev_path);
+        return;
+    }
+
+    const auto entry = DeviceIndex::instance().on_added(event_name);
+    if (!entry) return;
+    if (!watchers_.empty()) {
+        watch_device(*entry);
+    }
+
+    for (const auto configs_copy = failed_configs; const auto &[config, subscriber, present]: configs_copy) {
+        if (entry->vendor_id == config.vendor_id && entry->product_id == config.product_id &&
+            entry->uid == config.uid) {
+            Utility::print("Input device plugged in: " + dev_path);
+            attach_device(config, subscriber, dev_path);
         }
-        contexts_.erase(it);
     }
+}
+
+void VirtualInputProxy::remove_device(const DeviceConfig &config, const SubscriberId subscriber) {
+    loop_.run_in_loop([&] {
+        for (const auto &ctx: contexts_) {
+            const KeyBinding *binding = ctx->find_binding(config.target_key);
+            if (!binding) continue;
 
-    remove_failed_config(config);
+            const bool subscribed = std::ranges::any_of(binding->subscriptions, [&](const Subscription &sub) {
+                return sub.subscriber == subscriber && sub.config.vendor_id == config.vendor_id &&
+                       sub.config.product_id == config.product_id && sub.config.uid == config.uid;
+            });
+            if (!subscribed) continue;
+
+            unsubscribe(*ctx, config.target_key, subscriber);
+            update_device(*ctx);
+            break;
+        }
+
+        remove_failed_config(config, subscriber);
+    });
 }
 
 VirtualInputProxy::~VirtualInputProxy() {
     stop();
     for (const auto &ctx: contexts_) {
-        if (ctx.ufd >= 0) {
-            ioctl(ctx.ufd, UI_DEV_DESTROY);
-            close(ctx.ufd);
+        release_device(*ctx);
+    }
+    unwatch_all();
+}
+
+
+VirtualInputProxy::WatcherId VirtualInputProxy::add_watcher(WatchCallback callback) {
+    WatcherId watcher = 0;
+    loop_.run_in_loop([&] {
+        watcher = next_watcher_++;
+        watchers_[watcher] = std::move(callback);
+        if (watchers_.size() == 1) {
+            for (const auto &entry: DeviceIndex::instance().entries()) {
+                watch_device(entry);
+            }
+            Utility::debugPrint("Watching " + std::to_string(watched_.size()) + " input devices for key presses");
         }
-        if (ctx.fd_physical >= 0) {
-            ioctl(ctx.fd_physical, EVIOCGRAB, 0);
-            close(ctx.fd_physical);
+    });
+    return watcher;
+}
+
+void VirtualInputProxy::remove_watcher(const WatcherId watcher) {
+    loop_.run_in_loop([&] {
+        if (watchers_.erase(watcher) > 0 && watchers_.empty()) {
+            unwatch_all();
+        }
+    });
+}
+
+void VirtualInputProxy::watch_device(const DeviceIndexEntry &entry) {
+    const std::string dev_path = entry.dev_path();
+    if (std::ranges::any_of(watched_, [&](const auto &w) { return w->entry.event_name == entry.event_name; })) return;
+
+    auto device = std::make_unique<WatchedDevice>();
+    device->entry = entry;
+    device->fd = open(dev_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (device->fd < 0) {
+        Utility::debugPrint("Can't open " + dev_path + " for watching");
+        return;
+    }
+
+    /* Only key events are of interest, don't wake up for motion */
+    CapabilityBits<EV_CNT> types;
+    types.set(EV_KEY);
+    input_mask mask{};
+    mask.type = 0;
+    mask.codes_size = sizeof(types.words);
+    mask.codes_ptr = reinterpret_cast<uint64_t>(types.words);
+    ioctl(device->fd, EVIOCSMASK, &mask);
+
+    WatchedDevice &watched = *device;
+    if (!loop_.add_reader(device->fd, EPOLLIN, [this, &watched](const uint8_t *data, const ssize_t bytes) {
+        on_watched_data(watched, data, bytes);
+    })) {
+        close(device->fd);
+        return;
+    }
+    watched_.push_back(std::move(device));
+}
+
+void VirtualInputProxy::unwatch_device(const std::string &dev_path) {
+    std::erase_if(watched_, [&](const std::unique_ptr<WatchedDevice> &device) {
+        if (device->entry.dev_path() != dev_path) return false;
+        loop_.remove(device->fd);
+        close(device->fd);
+        return true;
+    });
+}
+
+void VirtualInputProxy::unwatch_all() {
+    for (const auto &device: watched_) {
+        loop_.remove(device->fd);
+        close(device->fd);
+    }
+    watched_.clear();
+}
+
+void VirtualInputProxy::on_watched_data(const WatchedDevice &device, const uint8_t *data, const ssize_t bytes) {
+    if (bytes <= 0) {
+        /* Unplugged; the hotplug monitor may not have said so yet */
+        unwatch_device(device.entry.dev_path());
+        return;
+    }
+
+    const auto *events = reinterpret_cast<const input_event *>(data);
+    const size_t count = static_cast<size_t>(bytes) / sizeof(input_event);
+    for (size_t i = 0; i < count; ++i) {
+        if (events[i].type == EV_KEY && events[i].value == 1) {
+            notify_watchers(device.entry.dev_path(), events[i].code);
         }
     }
 }
 
-void VirtualInputProxy::set_callback(Callback callback) {
-    callback_ = std::move(callback);
+void VirtualInputProxy::notify_watchers(const std::string &dev_path, const int key) {
+    const auto it = std::ranges::find_if(watched_, [&](const auto &w) { return w->entry.dev_path() == dev_path; });
+    if (it == watched_.end()) return;
+
+    const DeviceIndexEntry &entry = (*it)->entry;
+    for (const auto &callback: watchers_ | std::views::values) {
+        callback(entry, key);
+    }
 }
 
 void VirtualInputProxy::start_retry_loop() {
-    if (running) return;
-    running = true;
-    retry_thread = std::thread([this]() {
-        while (running) {
+    loop_.run_in_loop([this] {
+        if (retry_timer_ >= 0) return;
+        retry_timer_ = loop_.add_timer(std::chrono::seconds(5), [this] {
             retry_failed_configs();
-            for (int i = 0; i < 50 && running; ++i) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            }
-        }
+        });
     });
 }
 
 
 void VirtualInputProxy::stop_retry_loop() {
-    running = false;
-    if (retry_thread.joinable())
-        retry_thread.join();
+    loop_.run_in_loop([this] {
+        loop_.remove_timer(retry_timer_);
+        retry_timer_ = -1;
+    });
 }
 
 void VirtualInputProxy::start() {
-    start_retry_loop();
-    for (auto &ctx: contexts_) {
-        if (ctx.running) continue;
+    loop_.run_in_loop([this] {
+        started_ = true;
+        for (const auto &ctx: contexts_) {
+            register_device(*ctx);
+        }
 
-        ctx.running = true;
-        ctx.listener_thread = std::thread([this, &ctx]() {
-            input_event ev{};
-            while (ctx.running) {
-                if (const ssize_t bytes = Utility::safe_read(ctx.fd_physical, &ev, sizeof(ev)); bytes == sizeof(ev)) {
-                    handle_event(ctx, ev);
-                } else if (bytes < 0) {
-                    if (errno != EAGAIN && errno != EINTR) break;
-                }
-            }
-        });
+        if (!hotplug_) {
+            hotplug_ = std::make_unique<HotplugMonitor>(loop_);
+        }
+        if (!hotplug_->start([this](const HotplugMonitor::Action action, const std::string &dev_path) {
+            on_hotplug(action, dev_path);
+        })) {
+            Utility::print("Hotplug monitor unavailable, falling back to periodic device rescans");
+        }
+        update_retry_loop();
+
+        if (throughput_timer_ < 0 && Utility::is_debug_enabled()) {
+            throughput_timer_ = loop_.add_timer(std::chrono::milliseconds(THROUGHPUT_REPORT_INTERVAL_MS), [this] {
+                report_throughput();
+            });
+        }
+    });
+    if (owned_loop_) {
+        owned_loop_->start();
     }
 }
 
 void VirtualInputProxy::stop() {
-    for (auto &ctx: contexts_) {
-        ctx.running = false;
+    stop_retry_loop();
+    loop_.run_in_loop([this] {
+        if (hotplug_) {
+            hotplug_->stop();
+        }
+        loop_.remove_timer(throughput_timer_);
+        throughput_timer_ = -1;
+    });
+    if (owned_loop_) {
+        owned_loop_->stop();
     }
-    for (auto &ctx: contexts_) {
-        if (ctx.listener_thread.joinable()) {
-            ctx.listener_thread.join();
+    loop_.run_in_loop([this] {
+        for (const auto &ctx: contexts_) {
+            if (ctx->registered) {
+                loop_.remove(ctx->fd_physical);
+                ctx->registered = false;
+            }
+            cancel_debounce(*ctx);
         }
+        started_ = false;
+    });
+}
+
+void VirtualInputProxy::register_device(DeviceContext &ctx) {
+    if (ctx.registered) return;
+
+    ctx.registered = loop_.add_reader(ctx.fd_physical, EPOLLIN, [this, &ctx](const uint8_t *data, const ssize_t bytes) {
+        on_device_data(ctx, data, bytes);
+    });
+    if (!ctx.registered) {
+        Utility::error("Failed to watch input device: " + ctx.device_path);
     }
-    stop_retry_loop();
 }
 
-std::string VirtualInputProxy::find_device_path(const uint16_t vendor_id, const uint16_t product_id,
-                                                const uint32_t expected_uid) {
-    std::cout << std::hex << vendor_id << ":" << std::hex << product_id << ":" << std::hex << expected_uid << std::endl;
-    DIR *dir = opendir("/sys/class/input/");
-    if (!dir) {
-        Utility::error("Can't open input devices directory");
-        return "";
+void VirtualInputProxy::on_device_data(DeviceContext &ctx, const uint8_t *data, const ssize_t bytes) {
+    if (bytes <= 0) {
+        Utility::error("Input device went away: " + ctx.device_path);
+        detach_device(ctx);
+        return;
     }
 
-    std::string found_path;
-    dirent *entry;
+    const auto *events = reinterpret_cast<const input_event *>(data);
+    const size_t count = static_cast<size_t>(bytes) / sizeof(input_event);
+    ServerStats &stats = ServerStats::instance();
+    ServerStats::add(stats.read_calls);
+    ServerStats::add(stats.events_read, count);
+    ctx.stats.events_read += count;
+    if (count > 0) {
+        stats.read_latency.record(monotonic_micros() - event_micros(events[0]));
+    }
 
-    while ((entry = readdir(dir))) {
-        std::string name(entry->d_name);
-        if (name.substr(0, 5) != "event") continue;
+    for (size_t i = 0; i < count; ++i) {
+        handle_event(ctx, events[i]);
+    }
+}
 
-        try {
-            std::string sysfs_path = "/sys/class/input/" + name + "/device/";
-            std::string dev_path = "/dev/input/" + name;
+void VirtualInputProxy::detach_device(DeviceContext &ctx) {
+    for (const auto &binding: ctx.bindings) {
+        for (const auto &[subscriber, config]: binding.subscriptions) {
+            add_failed_config(config, subscriber);
+        }
+    }
 
-            const uint16_t vendor = read_id_from_file(sysfs_path + "id/vendor");
-            // ReSharper disable once CppTooWideScopeInitStatement
-            const uint16_t product = read_id_from_file(sysfs_path + "id/product");
-            if (vendor != vendor_id || product != product_id) continue;
+    if (ctx.registered) {
+        loop_.remove(ctx.fd_physical);
+        ctx.registered = false;
+    }
+    cancel_debounce(ctx);
+    release_device(ctx);
+    std::erase_if(contexts_, [&](const std::unique_ptr<DeviceContext> &c) { return c.get() == &ctx; });
+}
 
-            const int tmp_fd = open(dev_path.c_str(), O_RDONLY);
-            if (tmp_fd < 0) continue;
+void VirtualInputProxy::release_device(DeviceContext &ctx) {
+    release_virtual_device(ctx);
+    if (ctx.fd_physical >= 0) {
+        if (ctx.exclusive) {
+            ioctl(ctx.fd_physical, EVIOCGRAB, 0);
+            ctx.exclusive = false;
+        }
+        close(ctx.fd_physical);
+        ctx.fd_physical = -1;
+    }
+}
 
-            DeviceCapabilities caps = get_device_capabilities(tmp_fd);
-            close(tmp_fd);
+void VirtualInputProxy::release_virtual_device(DeviceContext &ctx) {
+    loop_.remove_timer(ctx.backlog_timer);
+    ctx.backlog_timer = -1;
+    ctx.backlog.clear();
+    ctx.resync_pending = false;
 
-            if (generate_uid(caps) == expected_uid) {
-                found_path = dev_path;
-                break;
-            }
-        } catch (...) {
-            /* Skip problematic devices */
-        }
+    if (ctx.prepared_ufd >= 0) {
+        VirtualDevicePool::instance().release(std::exchange(ctx.prepared_ufd, -1), {});
+    }
+    if (ctx.ufd >= 0) {
+        VirtualDevicePool::instance().release(ctx.ufd, ctx.keys_down);
+        ctx.keys_down.clear();
+        ctx.frame.clear();
+        ctx.ufd = -1;
     }
+}
 
-    closedir(dir);
+bool VirtualInputProxy::apply_event_mask(const DeviceContext &ctx, const bool enable) {
+    /* EV_SYN is never filtered, and the kernel drops SYN_REPORTs left empty by the mask */
+    CapabilityBits<EV_CNT> types;
+    CapabilityBits<KEY_CNT> keys = ctx.target_keys;
+    if (enable) {
+        types.set(EV_KEY);
+    } else {
+        for (auto &word: types.words) word = ~0UL;
+        for (auto &word: keys.words) word = ~0UL;
+    }
+
+    input_mask mask{};
+    mask.type = 0; /* type 0 selects the event type mask */
+    mask.codes_size = sizeof(types.words);
+    mask.codes_ptr = reinterpret_cast<uintptr_t>(types.words);
+    if (ioctl(ctx.fd_physical, EVIOCSMASK, &mask) < 0) return false;
+
+    mask.type = EV_KEY;
+    mask.codes_size = sizeof(keys.words);
+    mask.codes_ptr = reinterpret_cast<uintptr_t>(keys.words);
+    if (ioctl(ctx.fd_physical, EVIOCSMASK, &mask) < 0) {
+        /* Don't leave the fd with only the type mask applied: restore full delivery */
+        for (auto &word: types.words) word = ~0UL;
+        mask.type = 0;
+        mask.codes_size = sizeof(types.words);
+        mask.codes_ptr = reinterpret_cast<uintptr_t>(types.words);
+        ioctl(ctx.fd_physical, EVIOCSMASK, &mask);
+        return false;
+    }
+    return true;
+}
+
+std::string VirtualInputProxy::find_device_path(const uint16_t vendor_id, const uint16_t product_id,
+                                                const uint32_t expected_uid) {
+    std::cout << std::hex << vendor_id << ":" << std::hex << product_id << ":" << std::hex << expected_uid << std::endl;
+    std::string found_path = DeviceIndex::instance().find(vendor_id, product_id, expected_uid);
     if (found_path.empty()) {
         Utility::error("Device not found");
         return "";
@@ -246,192 +755,312 @@ std::string VirtualInputProxy::find_device_path(const uint16_t vendor_id, const
     return found_path;
 }
 
-int VirtualInputProxy::create_virtual_device(const int physical_fd) {
-    const int ufd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
-    if (ufd < 0) {
-        Utility::error("Failed to open /dev/uinput");
-        return -1;
+void VirtualInputProxy::handle_event(DeviceContext &ctx, input_event ev) {
+    if (ctx.exclusive && !watchers_.empty() && ev.type == EV_KEY && ev.value == 1) {
+        notify_watchers(ctx.device_path, ev.code);
     }
-
-    bool has_ff = false;
-    try {
-        has_ff = setup_capabilities(physical_fd, ufd);
-    } catch (const std::exception &e) {
-        std::cerr << "setup_capabilities failed: " << e.what() << std::endl;
-        close(ufd);
-        return -1;
+    if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+        ServerStats::add(ServerStats::instance().syn_dropped);
+        ++ctx.stats.syn_dropped;
+        Utility::debugPrint("SYN_DROPPED on " + ctx.device_path + ", resyncing");
+        ctx.frame.clear();
+        ctx.dropping = true;
+        return;
+    }
+    if (ctx.dropping) {
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+            ctx.dropping = false;
+            resync_device(ctx);
+        }
+        return;
     }
 
-    uinput_user_dev uidev = {};
-    const std::string dev_name = "PTT Virtual Device " + std::to_string(ufd);
-    strncpy(uidev.name, dev_name.c_str(), UINPUT_MAX_NAME_SIZE - 1);
-    uidev.name[UINPUT_MAX_NAME_SIZE - 1] = '\0';
+    if (!ctx.remap.empty() && ev.type == EV_KEY && ev.code < KEY_CNT) {
+        ev.code = ctx.remap[ev.code];
+        if (ev.code == REMAP_DROP) return;
+    }
 
-    uidev.id.bustype = BUS_USB;
+    if (ev.type == EV_KEY && ctx.target_keys.test(ev.code)) {
+        /* Autorepeat (value 2) is not an edge */
+        if (ev.value == 2) return;
 
-    uidev.id.vendor = 0x1234 + (vendor_counter++);
-    uidev.id.product = 0x5678 + (product_counter++);
-    uidev.id.version = 1;
+        KeyBinding *binding = ctx.find_binding(ev.code);
+        binding->raw = ev.value != 0;
+        if (binding->raw == binding->down || binding->debounce_timer >= 0) return;
 
-    if (has_ff) {
-        uidev.ff_effects_max = 16;
+        const uint64_t timestamp_us = event_micros(ev);
+        if (binding->debounce_ms && binding->last_edge_us &&
+            timestamp_us < binding->last_edge_us + binding->debounce_ms * 1000ULL) {
+            ServerStats::add(ServerStats::instance().edges_debounced);
+            schedule_debounce(ctx, *binding, timestamp_us);
+            return;
+        }
+        report_key(ctx, *binding, binding->raw, timestamp_us);
+    } else if (ctx.ufd >= 0) {
+        if (ev.type == EV_KEY) {
+            if (ev.value) ctx.keys_down.set(ev.code);
+            else ctx.keys_down.reset(ev.code);
+        }
+        ctx.frame.push_back(ev);
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+            flush_frame(ctx);
+        }
     }
+}
 
-    if (Utility::safe_write(ufd, &uidev, sizeof(uidev)) != sizeof(uidev)) {
-        Utility::error("Failed to write uinput_user_dev struct");
-        close(ufd);
-        return -1;
+void VirtualInputProxy::flush_frame(DeviceContext &ctx) {
+    if (ctx.frame.empty()) return;
+
+    bool queued = false;
+    if (!ctx.backlog.empty()) {
+        /* Keep ordering: anything new goes behind what the device has not taken yet */
+        enqueue_frame(ctx, ctx.frame.data(), ctx.frame.size(), FrameBacklog::is_motion_frame(ctx.frame));
+        queued = true;
+    } else if (const size_t written = write_events(ctx, ctx.frame.data(), ctx.frame.size());
+        written < ctx.frame.size()) {
+        /* A partially written frame can't be merged with anything */
+        enqueue_frame(ctx, ctx.frame.data() + written, ctx.frame.size() - written,
+                      written == 0 && FrameBacklog::is_motion_frame(ctx.frame));
+        queued = true;
     }
-
-    if (ioctl(ufd, UI_DEV_CREATE) < 0) {
-        Utility::error("Failed to create virtual uinput device");
-        close(ufd);
-        return -1;
+    /* Cleared first, draining may resync and build a new frame */
+    ctx.frame.clear();
+    if (queued) {
+        drain_backlog(ctx);
     }
-
-    std::cout << "Successfully created virtual device: " << dev_name << std::endl;
-    return ufd;
 }
 
-bool VirtualInputProxy::setup_capabilities(const int physical_fd, const int ufd) {
-    unsigned long evtypes[EV_MAX / (sizeof(long) * 8) + 1] = {0};
-    if (ioctl(physical_fd, EVIOCGBIT(0, sizeof(evtypes)), evtypes) < 0) {
-        close(ufd);
-        Utility::error("Failed to get event types from physical_fd: " + std::string(strerror(errno)));
-        throw std::runtime_error("Failed to get event types: " + std::string(strerror(errno)));
+size_t VirtualInputProxy::write_events(DeviceContext &ctx, const input_event *events, const size_t count) {
+    ServerStats &stats = ServerStats::instance();
+    size_t written = 0;
+    bool failed = false;
+    while (written < count) {
+        ServerStats::add(stats.write_calls);
+        const ssize_t bytes = write(ctx.ufd, events + written, (count - written) * sizeof(input_event));
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            Utility::pError("Failed to forward frame to virtual device");
+            ServerStats::add(stats.events_dropped, count - written);
+            failed = true;
+            break;
+        }
+        written += static_cast<size_t>(bytes) / sizeof(input_event);
     }
+    ServerStats::add(stats.events_written, written);
+
+    /* A frame counts as forwarded once the device took its SYN_REPORT */
+    uint64_t now = 0;
+    for (size_t i = 0; i < written; ++i) {
+        if (events[i].type != EV_SYN || events[i].code != SYN_REPORT) continue;
+        if (!now) now = monotonic_micros();
+        ServerStats::add(stats.frames_forwarded);
+        ++ctx.stats.frames_forwarded;
+        stats.forward_latency.record(now - event_micros(events[i]));
+    }
+    return failed ? count : written;
+}
 
-    bool has_ff = false;
-
-    for (int ev = 0; ev < EV_MAX; ++ev) {
-        if (test_bit(ev, evtypes)) {
-            Utility::debugPrint("Setting event type: " + std::to_string(ev) + "\n");
-            if (ioctl(ufd, UI_SET_EVBIT, ev) < 0) {
-                close(ufd);
-                Utility::error("UI_SET_EVBIT failed for event type " + std::to_string(ev) + ": " +
-                               std::string(strerror(errno)));
-                throw std::runtime_error(
-                    "UI_SET_EVBIT failed for event type " + std::to_string(ev) + ": " +
-                    std::string(strerror(errno)));
-            }
-            if (ev == EV_FF) {
-                has_ff = true;
-            }
-            setup_event_codes(physical_fd, ufd, ev);
+void VirtualInputProxy::enqueue_frame(DeviceContext &ctx, const input_event *events, const size_t count,
+                                      const bool coalescable) {
+    if (ctx.backlog.size() + count > BACKLOG_MAX_EVENTS) {
+        /* Drop the frame rather than grow without bound, the device is resynced once it caught up.
+         * The keys the frame would have changed keep their old state on the virtual device. */
+        for (size_t i = 0; i < count; ++i) {
+            if (events[i].type != EV_KEY) continue;
+            if (events[i].value == 1) ctx.keys_down.reset(events[i].code);
+            else if (events[i].value == 0) ctx.keys_down.set(events[i].code);
         }
+        ServerStats::add(ServerStats::instance().backlog_events_dropped, count);
+        ++ctx.stats.backlog_overruns;
+        ctx.resync_pending = true;
+        return;
     }
 
-    return has_ff;
+    if (const size_t merged = ctx.backlog.push(events, count, coalescable)) {
+        ServerStats::add(ServerStats::instance().events_coalesced, merged);
+    }
 }
 
-void VirtualInputProxy::setup_event_codes(const int physical_fd, const int ufd, const int ev_type) {
-    const int max_code = get_max_code(ev_type);
-    unsigned long codes[(max_code + sizeof(long) * 8 - 1) / (sizeof(long) * 8)] = {0};
+void VirtualInputProxy::drain_backlog(DeviceContext &ctx) {
+    ctx.backlog.consume(write_events(ctx, ctx.backlog.data(), ctx.backlog.size()));
 
-    if (ioctl(physical_fd, EVIOCGBIT(ev_type, sizeof(codes)), codes) < 0) {
-        throw std::runtime_error(
-            "Failed to get event codes for ev_type " + std::to_string(ev_type) + ": " +
-            std::string(strerror(errno)));
+    if (ctx.backlog.empty()) {
+        loop_.remove_timer(ctx.backlog_timer);
+        ctx.backlog_timer = -1;
+        if (ctx.resync_pending) {
+            ctx.resync_pending = false;
+            resync_device(ctx);
+        }
+    } else if (ctx.backlog_timer < 0) {
+        /* uinput always polls writable, so retry on a short timer instead of EPOLLOUT */
+        ctx.backlog_timer = loop_.add_timer(std::chrono::milliseconds(BACKLOG_RETRY_INTERVAL_MS),
+                                            [this, &ctx] { drain_backlog(ctx); });
     }
+}
 
-    for (int code = 0; code < max_code; ++code) {
-        if (test_bit(code, codes)) {
-            set_virtual_bit(ufd, ev_type, code, physical_fd);
+void VirtualInputProxy::report_key(DeviceContext &ctx, KeyBinding &binding, const bool down,
+                                   const uint64_t timestamp_us) {
+    ServerStats &stats = ServerStats::instance();
+    ServerStats::add(stats.key_edges);
+    ++ctx.stats.key_edges;
+    const uint64_t latency_us = monotonic_micros() - timestamp_us;
+    stats.dispatch_latency.record(latency_us);
+    ctx.stats.dispatch_latency.record(latency_us);
+
+    binding.down = down;
+    binding.last_edge_us = timestamp_us;
+    for (const auto &sub: binding.subscriptions) {
+        if (const auto it = subscribers_.find(sub.subscriber); it != subscribers_.end() && it->second) {
+            it->second(binding.key, down, timestamp_us);
         }
     }
 }
 
-int VirtualInputProxy::get_max_code(const int ev_type) {
-    switch (ev_type) {
-        case EV_KEY:
-            return KEY_MAX;
-        case EV_REL:
-            return REL_MAX;
-        case EV_ABS:
-            return ABS_MAX;
-        case EV_MSC:
-            return MSC_MAX;
-        case EV_LED:
-            return LED_MAX;
-        default:
-            return 0;
+void VirtualInputProxy::schedule_debounce(DeviceContext &ctx, KeyBinding &binding, const uint64_t timestamp_us) {
+    const uint64_t window_end_us = binding.last_edge_us + binding.debounce_ms * 1000ULL;
+    const auto remaining = std::chrono::milliseconds((window_end_us - timestamp_us + 999) / 1000);
+
+    /* Bindings may move when others are added, so look this one up again when the timer fires */
+    const int key = binding.key;
+    binding.debounce_timer = loop_.add_timer(std::max(remaining, std::chrono::milliseconds(1)), [this, &ctx, key] {
+        KeyBinding *b = ctx.find_binding(key);
+        if (!b) return;
+        cancel_debounce(*b);
+        if (b->raw != b->down) {
+            report_key(ctx, *b, b->raw, monotonic_micros());
+        }
+    });
+    if (binding.debounce_timer < 0) {
+        /* Without a timer the final state could be lost, so report it right away */
+        report_key(ctx, binding, binding.raw, timestamp_us);
     }
 }
 
-void VirtualInputProxy::set_virtual_bit(const int ufd, const int ev_type, const int code, const int physical_fd) {
-    switch (ev_type) {
-        case EV_KEY:
-            ioctl(ufd, UI_SET_KEYBIT, code);
-            break;
-        case EV_REL:
-            ioctl(ufd, UI_SET_RELBIT, code);
-            break;
-        case EV_ABS: {
-            if (ioctl(ufd, UI_SET_ABSBIT, code) < 0) {
-                Utility::error("Failed to set ABS bit for code: " + std::to_string(code));
-                break;
-            }
+void VirtualInputProxy::cancel_debounce(KeyBinding &binding) {
+    loop_.remove_timer(binding.debounce_timer);
+    binding.debounce_timer = -1;
+}
 
-            input_absinfo absinfo{};
-            if (ioctl(physical_fd, EVIOCGABS(code), &absinfo) == 0) {
-                struct uinput_abs_setup abs = {};
-                abs.code = code;
-                abs.absinfo = absinfo;
-
-                Utility::error("ABS[" + std::to_string(code) + "] - min: " + std::to_string(absinfo.minimum) +
-                               ", max: " + std::to_string(absinfo.maximum) +
-                               ", flat: " + std::to_string(absinfo.flat) +
-                               ", fuzz: " + std::to_string(absinfo.fuzz) +
-                               ", resolution: " + std::to_string(absinfo.resolution));
-
-                if (ioctl(ufd, UI_ABS_SETUP, &abs) < 0) {
-                    Utility::error("Failed UI_ABS_SETUP for ABS[" + std::to_string(code) + "]: " +
-                                   std::string(strerror(errno)));
-                }
-            } else {
-                Utility::error("Failed fallback EVIOCGABS for ABS[" + std::to_string(code) + "]: " +
-                               std::string(strerror(errno)));
-
-                uinput_abs_setup abs = {};
-                abs.code = code;
-                abs.absinfo.minimum = 0;
-                abs.absinfo.maximum = 255;
-                abs.absinfo.flat = 0;
-                abs.absinfo.fuzz = 0;
-                abs.absinfo.resolution = 0;
-
-                if (ioctl(ufd, UI_ABS_SETUP, &abs) < 0) {
-                    Utility::error("Failed fallback UI_ABS_SETUP for ABS[" + std::to_string(code) + "]: " +
-                                   std::string(strerror(errno)));
-                }
-            }
-            break;
-        }
-        case EV_MSC:
-            ioctl(ufd, UI_SET_MSCBIT, code);
-            break;
-        case EV_LED:
-            ioctl(ufd, UI_SET_LEDBIT, code);
-            break;
-        default:
-            break;
+void VirtualInputProxy::cancel_debounce(DeviceContext &ctx) {
+    for (auto &binding: ctx.bindings) {
+        cancel_debounce(binding);
     }
 }
 
-void VirtualInputProxy::handle_event(const DeviceContext &ctx, const input_event &ev) const {
-    if (ev.type == EV_KEY && ev.code == ctx.target_key) {
-        if (callback_) callback_(ctx.target_key, ev.value);
-    } else if (ctx.ufd >= 0) {
-        Utility::safe_write(ctx.ufd, &ev, sizeof(ev));
+void VirtualInputProxy::resync_device(DeviceContext &ctx) {
+    CapabilityBits<KEY_CNT> state;
+    if (ioctl(ctx.fd_physical, EVIOCGKEY(sizeof(state.words)), state.words) < 0) {
+        Utility::pError("Failed to resync key state of " + ctx.device_path);
+        return;
     }
+    /* Compare in terms of the codes the bindings and the virtual device see */
+    state = KeyState::apply_remap(state, ctx.remap);
+
+    const uint64_t now = monotonic_micros();
+    for (auto &binding: ctx.bindings) {
+        binding.raw = state.test(binding.key);
+        if (binding.raw != binding.down && binding.debounce_timer < 0) {
+            report_key(ctx, binding, binding.raw, now);
+        }
+    }
+
+    if (ctx.ufd < 0) return;
+
+    KeyState::lost_transitions(state, ctx.keys_down, ctx.target_keys).for_each([&](const int code) {
+        input_event ev{};
+        ev.type = EV_KEY;
+        ev.code = static_cast<uint16_t>(code);
+        ev.value = state.test(code) ? 1 : 0;
+        if (ev.value) ctx.keys_down.set(code);
+        else ctx.keys_down.reset(code);
+        ctx.frame.push_back(ev);
+    });
+
+    /* The input core drops ABS events that repeat the current value, so re-sending every axis is harmless */
+    CapabilityBits<ABS_CNT> abs_bits;
+    abs_bits.read(ctx.fd_physical, EV_ABS);
+    abs_bits.for_each([&](const int code) {
+        input_absinfo info{};
+        if (ioctl(ctx.fd_physical, EVIOCGABS(code), &info) < 0) return;
+        input_event ev{};
+        ev.type = EV_ABS;
+        ev.code = static_cast<uint16_t>(code);
+        ev.value = info.value;
+        ctx.frame.push_back(ev);
+    });
+
+    if (ctx.frame.empty()) return;
+
+    input_event syn{};
+    syn.type = EV_SYN;
+    syn.code = SYN_REPORT;
+    ctx.frame.push_back(syn);
+    flush_frame(ctx);
+}
+
+void VirtualInputProxy::report_throughput() {
+    const ServerStats &stats = ServerStats::instance();
+    const ThroughputSnapshot now{
+        stats.events_read.load(std::memory_order_relaxed),
+        stats.read_calls.load(std::memory_order_relaxed),
+        stats.events_written.load(std::memory_order_relaxed),
+        stats.write_calls.load(std::memory_order_relaxed),
+        stats.syn_dropped.load(std::memory_order_relaxed),
+        stats.events_coalesced.load(std::memory_order_relaxed),
+    };
+    const ThroughputSnapshot last = std::exchange(last_throughput_, now);
+    const uint64_t read_calls = now.read_calls - last.read_calls;
+    if (!Utility::is_debug_enabled() || read_calls == 0) return;
+
+    constexpr uint64_t seconds = THROUGHPUT_REPORT_INTERVAL_MS / 1000;
+    Utility::debugPrint("Throughput: read " + std::to_string((now.events_read - last.events_read) / seconds) +
+                        " events/s in " + std::to_string(read_calls / seconds) + " reads/s, forwarded " +
+                        std::to_string((now.events_written - last.events_written) / seconds) + " events/s in " +
+                        std::to_string((now.write_calls - last.write_calls) / seconds) + " syscalls/s, " +
+                        std::to_string(now.syn_dropped - last.syn_dropped) + " SYN_DROPPED, " +
+                        std::to_string(now.events_coalesced - last.events_coalesced) + " events coalesced");
+}
+
+std::string VirtualInputProxy::device_stats() {
+    std::string out;
+    loop_.run_in_loop([&] {
+        for (const auto &ctx: contexts_) {
+            size_t subscriptions = 0;
+            for (const auto &binding: ctx->bindings) subscriptions += binding.subscriptions.size();
+
+            out += "device " + ctx->device_path +
+                    " exclusive=" + std::to_string(ctx->exclusive) +
+                    " subscriptions=" + std::to_string(subscriptions) +
+                    " events_read=" + std::to_string(ctx->stats.events_read) +
+                    " frames_forwarded=" + std::to_string(ctx->stats.frames_forwarded) +
+                    " key_edges=" + std::to_string(ctx->stats.key_edges) +
+                    " syn_dropped=" + std::to_string(ctx->stats.syn_dropped) +
+                    " backlog_overruns=" + std::to_string(ctx->stats.backlog_overruns) +
+                    " backlog=" + std::to_string(ctx->backlog.size()) +
+                    " latency.dispatch " + ctx->stats.dispatch_latency.summary() + "\n";
+        }
+        for (const auto &[config, subscriber, present]: failed_configs) {
+            out += "waiting " + std::to_string(config.vendor_id) + ":" + std::to_string(config.product_id) + ":" +
+                    std::to_string(config.uid) + " key=" + std::to_string(config.target_key) +
+                    (present ? " (present, retrying)" : "") + "\n";
+        }
+    });
+    return out;
 }
 
 
 void VirtualInputProxy::detect_devices() {
     Utility::debugPrint("Device detection mode - press keys to see their device info (Ctrl+C to exit)\n");
 
-    std::vector<int> fds;
-    std::vector<std::string> device_paths;
+    /* Identity is read once per device, not on every key */
+    struct DetectedDevice {
+        int fd;
+        std::string path;
+        std::string name;
+        std::string id;
+    };
+    std::vector<DetectedDevice> devices;
 
     DIR *dir = opendir("/dev/input/");
     if (!dir) {
@@ -444,10 +1073,25 @@ void VirtualInputProxy::detect_devices() {
         if (std::string name(entry->d_name); name.substr(0, 5) == "event") {
             std::string path = "/dev/input/" + name;
 
-            if (int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK); fd >= 0) {
-                fds.push_back(fd);
-                device_paths.push_back(path);
+            const int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+            if (fd < 0) continue;
+
+            char device_name[256] = {};
+            if (ioctl(fd, EVIOCGNAME(sizeof(device_name)), device_name) < 0) device_name[0] = '\0';
+            device_name[sizeof(device_name) - 1] = '\0';
+            uint32_t uid = 0;
+            try {
+                uid = generate_uid(fd);
+            } catch (...) {
             }
+            uint16_t vendor = 0, product = 0;
+            try {
+                const std::string sysfs_path = "/sys/class/input/" + name + "/device/id/";
+                vendor = read_id_from_file(sysfs_path + "vendor");
+                product = read_id_from_file(sysfs_path + "product");
+            } catch (...) {
+            }
+            devices.push_back({fd, path, device_name, format_device_id(vendor, product, uid)});
         }
     }
     closedir(dir);
@@ -457,65 +1101,35 @@ void VirtualInputProxy::detect_devices() {
         FD_ZERO(&set);
         int max_fd = 0;
 
-        for (int fd: fds) {
-            FD_SET(fd, &set);
-            if (fd > max_fd) max_fd = fd;
-        }
-
-        timeval timeout{0, 100000};
-        if (select(max_fd + 1, &set, nullptr, nullptr, &timeout) < 0) break;
-
-        for (size_t i = 0; i < fds.size(); i++) {
-            if (FD_ISSET(fds[i], &set)) {
-                input_event ev{};
-                while (Utility::safe_read(fds[i], &ev, sizeof(ev)) == sizeof(ev)) {
-                    if (ev.type == EV_KEY || ev.type == EV_ABS && ev.value == 1) {
-                        DeviceCapabilities caps = get_device_capabilities(fds[i]);
-                        uint16_t vendor = 0, product = 0;
-
-                        try {
-                            std::string sysfs_path = "/sys/class/input/" +
-                                                     device_paths[i].substr(strlen("/dev/input/")) + "/device/id/";
-                            vendor = read_id_from_file(sysfs_path + "vendor");
-                            product = read_id_from_file(sysfs_path + "product");
-                        } catch (...) {
-                        }
-                        std::ostringstream oss;
-                        oss << "Key pressed: 0x" << std::hex << ev.code << "\n"
-                                << "Device: " << device_paths[i] << "\n"
-                                << "Vendor: 0x" << std::setw(4) << std::setfill('0') << vendor << "\n"
-                                << "Product: 0x" << std::setw(4) << std::setfill('0') << product << "\n"
-                                << "UID: 0x" << std::setw(8) << std::setfill('0') << DeviceUtils::generate_uid(caps) <<
-                                "\n"
-                                << "Name: " << caps.name << "\n";
-                        Utility::print(oss.str());
-
-                        std::ostringstream hex_oss;
-                        hex_oss << std::hex << std::setfill('0');
-
-                        hex_oss << std::setw(4) << vendor;
-                        const std::string vendor_str = "0x" + hex_oss.str();
-                        hex_oss.str("");
-
-                        hex_oss << std::setw(4) << product;
-                        const std::string product_str = "0x" + hex_oss.str();
-                        hex_oss.str("");
-
-                        hex_oss << std::setw(8) << DeviceUtils::generate_uid(caps);
-                        const std::string uid_str = "0x" + hex_oss.str();
-
-                        std::string device;
-                        device.append(vendor_str)
-                                .append(":")
-                                .append(product_str)
-                                .append(":")
-                                .append(uid_str);
-                        Utility::print("Device to use in the config: " + device + "\n\n");
-                    }
+        for (const auto &device: devices) {
+            FD_SET(device.fd, &set);
+            if (device.fd > max_fd) max_fd = device.fd;
+        }
+
+        if (select(max_fd + 1, &set, nullptr, nullptr, nullptr) < 0) break;
+
+        for (const auto &device: devices) {
+            if (!FD_ISSET(device.fd, &set)) continue;
+
+            input_event ev{};
+            while (Utility::safe_read(device.fd, &ev, sizeof(ev)) == sizeof(ev)) {
+                if (ev.type == EV_KEY || (ev.type == EV_ABS && ev.value == 1)) {
+                    print_detected_key(ev.code, device.path, device.name, device.id);
                 }
             }
         }
     }
 
-    for (int fd: fds) close(fd);
+    for (const auto &device: devices) close(device.fd);
+}
+
+void VirtualInputProxy::print_detected_key(const int key, const std::string &dev_path, const std::string &name,
+                                           const std::string &device_id) {
+    std::ostringstream oss;
+    oss << "Key pressed: 0x" << std::hex << key << "\n"
+            << "Device: " << dev_path << "\n"
+            << "ID: " << device_id << "\n"
+            << "Name: " << name << "\n";
+    Utility::print(oss.str());
+    Utility::print("Device to use in the config: " + device_id + "\n\n");
 }
@@ -1,27 +1,87 @@
 #ifndef VIRTUALINPUTPROXY_H
 #define VIRTUALINPUTPROXY_H
 
-#include <functional>
-#include <thread>
 #include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <linux/input.h>
 
 #include "common/device/DeviceCapabilities.h"
+#include "common/utilities/LatencyHistogram.h"
 #include "common/utilities/Utility.h"
+#include "DeviceIndex.h"
+#include "EventLoop.h"
+#include "FrameBacklog.h"
+#include "HotplugMonitor.h"
 
+/**
+ * Opens, grabs and reads each physical input device exactly once and fans
+ * its key edges out to every subscriber bound to that key.
+ *
+ * Subscribers are typically client sessions; several of them may bind the
+ * same device and key. Exclusive passthrough goes to a single shared
+ * virtual device per physical device.
+ */
 class VirtualInputProxy {
 public:
-    using Callback = std::function<void(int key, bool state)>;
+    /* timestamp_us is the kernel's CLOCK_MONOTONIC timestamp of the event */
+    using Callback = std::function<void(int key, bool state, uint64_t timestamp_us)>;
+    using SubscriberId = uint64_t;
+    /* Key press on any input device, for device pickers */
+    using WatchCallback = std::function<void(const DeviceIndexEntry &device, int key)>;
+    using WatcherId = uint64_t;
+
+    VirtualInputProxy();
+
+    /**
+     *  Runs the proxy on an event loop owned by the caller, e.g. the server reactor.
+     *  start() and stop() then only (un)register devices; driving the loop is up to the owner.
+     */
+    explicit VirtualInputProxy(EventLoop &loop);
 
     ~VirtualInputProxy();
 
-    void add_device(const DeviceConfig &config);
+    /**
+     *  Registers a consumer of key edges and returns its id for add_device()/remove_device().
+     */
+    SubscriberId add_subscriber(Callback callback);
+
+    /**
+     *  Replaces the callback of a subscriber, e.g. when a resumed session takes it over.
+     */
+    void set_subscriber_callback(SubscriberId subscriber, Callback callback);
+
+    /**
+     *  Drops all bindings of the subscriber. Devices nobody is bound to anymore are released.
+     */
+    void remove_subscriber(SubscriberId subscriber);
+
+    /**
+     *  Binds the subscriber to config.target_key on the device. The remap table only takes
+     *  effect while the device is exclusive, remapped codes must be ones the device can emit.
+     */
+    void add_device(const DeviceSetup &config, SubscriberId subscriber);
 
-    void remove_device(const DeviceConfig &config);
+    /**
+     *  Adds several configs at once. Devices that are not open yet are opened, and cloned to
+     *  virtual devices where needed, concurrently, so the call takes as long as the slowest
+     *  device rather than the sum of all of them.
+     */
+    void add_devices(const std::vector<DeviceSetup> &configs, SubscriberId subscriber);
 
-    void set_callback(Callback callback);
+    void remove_device(const DeviceConfig &config, SubscriberId subscriber);
+
+    /**
+     *  Reports key presses on every input device until remove_watcher().
+     *  Devices are only opened for this while at least one watcher exists.
+     */
+    WatcherId add_watcher(WatchCallback callback);
+
+    void remove_watcher(WatcherId watcher);
 
     void start_retry_loop();
     void stop_retry_loop();
@@ -30,70 +90,247 @@ public:
 
     void stop();
 
+    /**
+     *  One "device <path> ..." line of counters and dispatch latency per open device.
+     */
+    std::string device_stats();
+
     static void detect_devices();
 
+    static void print_detected_key(int key, const std::string &dev_path, const std::string &name,
+                                   const std::string &device_id);
+
 private:
-    std::thread retry_thread;
-    std::atomic<bool> running = false;
-    std::vector<DeviceConfig> failed_configs = {};
+    std::unique_ptr<EventLoop> owned_loop_;
+    EventLoop &loop_;
+    int retry_timer_ = -1;
+    std::unique_ptr<HotplugMonitor> hotplug_;
+    bool started_ = false;
+
+    /* A config of one subscriber, waiting for its device to show up */
+    struct PendingConfig {
+        DeviceSetup config;
+        SubscriberId subscriber;
+        /* The device is there but could not be opened, grabbed or mirrored, no hotplug event will announce it */
+        bool present = false;
+    };
+
+    std::vector<PendingConfig> failed_configs = {};
 
+    struct Subscription {
+        SubscriberId subscriber;
+        DeviceSetup config;
+    };
+
+    /* One PTT key on a device and everyone subscribed to it */
+    struct KeyBinding {
+        int key = -1;
+        std::vector<Subscription> subscriptions;
+        /* Strictest settings among the subscriptions */
+        bool exclusive = false;
+        uint16_t debounce_ms = 0;
+        /* Key state last reported to subscribers, and as last seen on the device */
+        bool down = false;
+        bool raw = false;
+        uint64_t last_edge_us = 0;
+        int debounce_timer = -1;
+    };
+
+    /* One physical device node: a single fd, grab and virtual device shared by all its bindings */
     struct DeviceContext {
+        std::string device_path;
         int fd_physical = -1;
         int ufd = -1;
-        int target_key = -1;
+        /* Virtual device created ahead of time by add_devices(), taken by apply_bindings() */
+        int prepared_ufd = -1;
         bool exclusive = false;
-        std::atomic<bool> running{false};
-        std::thread listener_thread;
-
-        DeviceContext() = default;
-
-        DeviceContext(DeviceContext &&other) noexcept
-            : fd_physical(other.fd_physical),
-              ufd(other.ufd),
-              target_key(other.target_key),
-              running(other.running.load()),
-              listener_thread(std::move(other.listener_thread)) {
-        }
-
-        DeviceContext &operator=(DeviceContext &&other) noexcept {
-            if (this != &other) {
-                fd_physical = other.fd_physical;
-                ufd = other.ufd;
-                target_key = other.target_key;
-                running.store(other.running.load());
-                listener_thread = std::move(other.listener_thread);
-            }
-            return *this;
-        }
-
-        DeviceContext(const DeviceContext &) = delete;
-
-        DeviceContext &operator=(const DeviceContext &) = delete;
+        bool registered = false;
+        /* Set after SYN_DROPPED until the next SYN_REPORT, events in between are stale */
+        bool dropping = false;
+        std::vector<KeyBinding> bindings;
+        /* Codes of all bindings, checked before looking a binding up */
+        CapabilityBits<KEY_CNT> target_keys;
+        std::vector<input_event> frame;
+        /* Code each key is forwarded as, indexed by the physical code; empty while nothing is remapped */
+        std::vector<uint16_t> remap;
+        /* Keys currently held on the virtual device */
+        CapabilityBits<KEY_CNT> keys_down;
+        FrameBacklog backlog;
+        int backlog_timer = -1;
+        /* A frame was dropped on a backlog overrun, resync once the backlog is delivered */
+        bool resync_pending = false;
+
+        /* Only touched on the loop thread */
+        struct {
+            uint64_t events_read = 0;
+            uint64_t frames_forwarded = 0;
+            uint64_t key_edges = 0;
+            uint64_t syn_dropped = 0;
+            uint64_t backlog_overruns = 0;
+            LatencyHistogram dispatch_latency;
+        } stats;
+
+        KeyBinding *find_binding(int key);
     };
 
+    /* ServerStats totals at the last throughput report */
+    struct ThroughputSnapshot {
+        uint64_t events_read = 0;
+        uint64_t read_calls = 0;
+        uint64_t events_written = 0;
+        uint64_t write_calls = 0;
+        uint64_t syn_dropped = 0;
+        uint64_t events_coalesced = 0;
+    };
+
+    ThroughputSnapshot last_throughput_;
+
+    /* A device node opened only to report key presses to watchers */
+    struct WatchedDevice {
+        DeviceIndexEntry entry;
+        int fd = -1;
+    };
 
-    std::vector<DeviceContext> contexts_;
-    Callback callback_;
+    std::unordered_map<WatcherId, WatchCallback> watchers_;
+    WatcherId next_watcher_ = 1;
+    std::vector<std::unique_ptr<WatchedDevice> > watched_;
+    int throughput_timer_ = -1;
+
+    std::vector<std::unique_ptr<DeviceContext> > contexts_;
+    std::unordered_map<SubscriberId, Callback> subscribers_;
+    SubscriberId next_subscriber_ = 1;
+
+    /* A device node opened off the loop thread, ready to become a DeviceContext */
+    struct PreparedDevice {
+        std::string device_path;
+        int fd_physical = -1;
+        int ufd = -1;
+        uint64_t open_us = 0;
+        uint64_t virtual_device_us = 0;
+    };
 
-    void add_failed_config(const DeviceConfig &config);
+    void add_failed_config(const DeviceSetup &config, SubscriberId subscriber, bool present = false);
 
-    void remove_failed_config(const DeviceConfig &config);
+    void remove_failed_config(const DeviceConfig &config, SubscriberId subscriber);
 
     void retry_failed_configs();
 
-    void handle_event(const DeviceContext &ctx, const input_event &ev) const;
+    /**
+     *  Keeps the periodic retry running while hotplug is unavailable or a present device failed to attach.
+     */
+    void update_retry_loop();
+
+    void attach_device(const DeviceSetup &config, SubscriberId subscriber, const std::string &device_path);
+
+    /**
+     *  Removes the subscriber from the key's binding, and the binding once nobody is left on it.
+     */
+    void unsubscribe(DeviceContext &ctx, int key, SubscriberId subscriber);
+
+    /**
+     *  Releases the device if it has no bindings left, otherwise re-applies its grab and mask.
+     */
+    void update_device(DeviceContext &ctx);
+
+    static void update_binding(KeyBinding &binding);
+
+    /**
+     *  Grabs the device and clones it to a virtual device if any binding is exclusive,
+     *  otherwise releases both and masks the fd down to the bound keys.
+     *  Returns false if the device could not be switched to exclusive mode.
+     */
+    bool apply_bindings(DeviceContext &ctx);
+
+    /**
+     *  Flattens the remap tables of all subscriptions on an exclusive device into ctx.remap.
+     *  Later entries win when several map the same code.
+     */
+    static void compile_remap(DeviceContext &ctx);
+
+    void on_hotplug(HotplugMonitor::Action action, const std::string &dev_path);
+
+    void watch_device(const DeviceIndexEntry &entry);
+
+    void unwatch_device(const std::string &dev_path);
+
+    void unwatch_all();
+
+    void on_watched_data(const WatchedDevice &device, const uint8_t *data, ssize_t bytes);
+
+    /**
+     *  Devices grabbed by a binding deliver nothing to other fds, so their presses are reported from handle_event().
+     */
+    void notify_watchers(const std::string &dev_path, int key);
 
-    [[nodiscard]] static int create_virtual_device(int physical_fd);
+    void register_device(DeviceContext &ctx);
 
-    static bool setup_capabilities(int physical_fd, int ufd);
+    /**
+     *  Handles events the loop read from the device; bytes <= 0 means it went away.
+     */
+    void on_device_data(DeviceContext &ctx, const uint8_t *data, ssize_t bytes);
 
-    static void setup_event_codes(int physical_fd, int ufd, int ev_type);
+    void detach_device(DeviceContext &ctx);
 
-    static void set_virtual_bit(int ufd, int ev_type, int code, int physical_fd);
+    void release_device(DeviceContext &ctx);
+
+    void release_virtual_device(DeviceContext &ctx);
+
+    /**
+     *  Asks the kernel to only queue the bound keys on a non-exclusive device fd, or lifts the mask.
+     *  Returns false if EVIOCSMASK is unsupported, in which case handle_event() filters as before.
+     */
+    static bool apply_event_mask(const DeviceContext &ctx, bool enable);
+
+    void handle_event(DeviceContext &ctx, input_event ev);
+
+    void flush_frame(DeviceContext &ctx);
+
+    /**
+     *  Writes as many whole events as the virtual device accepts without blocking.
+     *  Returns the number of events consumed; events that hit a hard error are dropped.
+     */
+    size_t write_events(DeviceContext &ctx, const input_event *events, size_t count);
+
+    /**
+     *  Queues a frame behind a backpressured virtual device and counts the events merged away.
+     *  A frame that does not fit in the bounded backlog is dropped and counted instead.
+     */
+    void enqueue_frame(DeviceContext &ctx, const input_event *events, size_t count, bool coalescable);
+
+    void drain_backlog(DeviceContext &ctx);
+
+    void report_key(DeviceContext &ctx, KeyBinding &binding, bool down, uint64_t timestamp_us);
+
+    /**
+     *  Arms a one-shot timer for the end of the debounce window that reports
+     *  the key's final state if it differs from the last reported edge.
+     */
+    void schedule_debounce(DeviceContext &ctx, KeyBinding &binding, uint64_t timestamp_us);
+
+    void cancel_debounce(KeyBinding &binding);
+
+    void cancel_debounce(DeviceContext &ctx);
+
+    /**
+     *  Re-reads key and ABS state after the kernel dropped events and emits
+     *  whatever transitions were lost to the callback and the virtual device.
+     */
+    void resync_device(DeviceContext &ctx);
+
+    void report_throughput();
 
     static std::string find_device_path(uint16_t vendor_id, uint16_t product_id, uint32_t expected_uid);
 
-    static int get_max_code(int ev_type);
+    /**
+     *  Opens a device node for reading with CLOCK_MONOTONIC timestamps. Returns -1 on error.
+     */
+    static int open_device(const std::string &device_path);
+
+    /**
+     *  Opens the device and, if it will be grabbed, clones it to a virtual device.
+     *  Touches no proxy state, so it runs on worker threads.
+     */
+    static PreparedDevice prepare_device(const std::string &device_path, bool exclusive);
 };
 
 #endif // VIRTUALINPUTPROXY_H
@@ -0,0 +1,405 @@
+#include "ClientSession.h"
+
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <utility>
+#include <sys/random.h>
+
+#include "common/device/DeviceCapabilities.h"
+#include "common/utilities/LatencyHistogram.h"
+#include "common/utilities/Utility.h"
+#include "server/device/DeviceIndex.h"
+#include "server/stats/ServerStats.h"
+
+#define MAX_PENDING_EDGES 256
+
+ClientSession::ClientSession(const int client_fd, EventLoop &loop, VirtualInputProxy &proxy,
+                             ResumeLookup resume_lookup, ConfigHook on_configured, std::string shared_secret)
+    : client_fd_(client_fd), loop_(loop), proxy_(proxy), shared_secret_(std::move(shared_secret)),
+      resume_lookup_(std::move(resume_lookup)), on_configured_(std::move(on_configured)) {
+    sockaddr_storage local{};
+    socklen_t local_len = sizeof(local);
+    if (getsockname(client_fd_, reinterpret_cast<sockaddr *>(&local), &local_len) < 0) {
+        throw std::runtime_error("Failed to get socket address: " + std::string(strerror(errno)));
+    }
+    remote_ = local.ss_family == AF_INET || local.ss_family == AF_INET6;
+
+    if (remote_) {
+        cred_.pid = 0;
+        cred_.uid = TCP_PEER_UID;
+        cred_.gid = static_cast<gid_t>(-1);
+        Utility::debugPrint("TCP client connected fd=" + std::to_string(client_fd_));
+        return;
+    }
+
+    socklen_t len = sizeof(cred_);
+    if (getsockopt(client_fd_, SOL_SOCKET, SO_PEERCRED, &cred_, &len)) {
+        throw std::runtime_error("Failed to get client credentials: " + std::string(strerror(errno)));
+    }
+    Utility::debugPrint("Client connected fd=" + std::to_string(client_fd_) +
+                        " pid=" + std::to_string(cred_.pid) +
+                        " uid=" + std::to_string(cred_.uid));
+}
+
+ClientSession::~ClientSession() {
+    set_watching(false);
+    if (subscriber_) {
+        proxy_.remove_subscriber(subscriber_);
+    }
+    if (client_fd_ >= 0) {
+        shutdown(client_fd_, SHUT_RDWR);
+        close(client_fd_);
+    }
+}
+
+bool ClientSession::can_resume() const {
+    return state_ == State::Active && subscriber_ && resume_token_ != 0 && !said_bye_ && !broken_;
+}
+
+void ClientSession::detach() {
+    if (client_fd_ < 0) return;
+    set_watching(false);
+    shutdown(client_fd_, SHUT_RDWR);
+    close(client_fd_);
+    client_fd_ = -1;
+    outbound_.clear();
+    unsent_key_timestamps_.clear();
+    want_writable_ = false;
+    Utility::debugPrint("Session detached, keeping devices for resumption");
+}
+
+bool ClientSession::on_received(const uint8_t *data, const ssize_t bytes) {
+    if (bytes < 0) {
+        Utility::error("Read failed fd=" + std::to_string(client_fd_) + ": " + strerror(static_cast<int>(-bytes)));
+        return false;
+    }
+    if (bytes == 0) {
+        Utility::print("Client disconnected");
+        return false;
+    }
+    reader_.feed(data, static_cast<size_t>(bytes));
+
+    try {
+        PacketHeader hdr{};
+        std::vector<uint8_t> payload;
+        while (reader_.next(hdr, payload)) {
+            handle_packet(hdr, payload);
+        }
+    } catch (const std::exception &e) {
+        Utility::error("Client handling error: " + std::string(e.what()));
+        return false;
+    }
+    return true;
+}
+
+void ClientSession::handle_packet(const PacketHeader &hdr, const std::vector<uint8_t> &payload) {
+    if (hdr.channel != static_cast<uint16_t>(Channel::Control)) {
+        Utility::debugPrint("Ignoring packet on channel " + channel_to_string(hdr.channel));
+        return;
+    }
+
+    switch (state_) {
+        case State::AwaitHandshake:
+            if (hdr.type != static_cast<uint16_t>(ControlType::HAND_SHAKE)) {
+                throw std::runtime_error("Expected HAND_SHAKE packet");
+            }
+            handle_handshake(payload);
+            break;
+
+        case State::AwaitConfig:
+            /* Monitoring tools and device pickers never configure devices */
+            if (handle_query(static_cast<ControlType>(hdr.type), payload)) break;
+            if (hdr.type != static_cast<uint16_t>(ControlType::CONFIG_LIST)) {
+                throw std::runtime_error("Expected CONFIG_LIST packet");
+            }
+            handle_config_list(payload);
+            state_ = State::Active;
+            break;
+
+        case State::Active:
+            switch (static_cast<ControlType>(hdr.type)) {
+                case ControlType::PING:
+                    send_control(ControlType::PONG);
+                    break;
+                case ControlType::BYE:
+                    said_bye_ = true;
+                    break;
+                default:
+                    if (!handle_query(static_cast<ControlType>(hdr.type), payload)) {
+                        Utility::debugPrint("Unhandled control packet: " + std::to_string(hdr.type));
+                    }
+                    break;
+            }
+            break;
+    }
+}
+
+void ClientSession::handle_handshake(const std::vector<uint8_t> &payload) {
+    HandshakePayload hello{};
+    if (payload.size() >= HANDSHAKE_PAYLOAD_V2_SIZE) {
+        std::memcpy(&hello, payload.data(), std::min(payload.size(), sizeof(hello)));
+        protocol_version_ = std::clamp<uint16_t>(hello.version, 1, PROTOCOL_VERSION);
+    }
+    Utility::debugPrint("Client fd=" + std::to_string(client_fd_) +
+                        " speaks protocol version " + std::to_string(protocol_version_));
+
+    if (remote_ && !check_secret(payload)) {
+        const std::string reason = "Authentication failed";
+        send_control(ControlType::ERROR, reason.data(), static_cast<uint32_t>(reason.size()));
+        throw std::runtime_error("TCP client did not present the shared secret");
+    }
+
+    if (protocol_version_ < 2) {
+        send_control(ControlType::ACK);
+        state_ = State::AwaitConfig;
+        return;
+    }
+
+    HandshakePayload reply{};
+    reply.version = protocol_version_;
+    if (protocol_version_ < 4) {
+        send_control(ControlType::ACK, &reply, HANDSHAKE_PAYLOAD_V2_SIZE);
+        state_ = State::AwaitConfig;
+        return;
+    }
+
+    if (hello.resume_token != 0 && resume_lookup_) {
+        if (const auto parked = resume_lookup_(hello.resume_token, cred_.uid)) {
+            adopt(*parked);
+            ServerStats::add(ServerStats::instance().sessions_resumed);
+            reply.flags |= HANDSHAKE_FLAG_RESUMED;
+            reply.resume_token = resume_token_;
+            send_control(ControlType::ACK, &reply, sizeof(reply));
+            state_ = State::Active;
+
+            Utility::debugPrint("Client fd=" + std::to_string(client_fd_) + " resumed its session, replaying " +
+                                std::to_string(pending_edges_.size()) + " key edges");
+            for (const auto &[key, state, timestamp_us]: pending_edges_) {
+                send_key(key, state, timestamp_us);
+            }
+            pending_edges_.clear();
+            return;
+        }
+        Utility::debugPrint("Unknown or expired resume token, starting a new session");
+    }
+
+    if (getrandom(&resume_token_, sizeof(resume_token_), 0) != sizeof(resume_token_)) {
+        resume_token_ = 0;
+    }
+    reply.resume_token = resume_token_;
+    send_control(ControlType::ACK, &reply, sizeof(reply));
+    state_ = State::AwaitConfig;
+}
+
+bool ClientSession::check_secret(const std::vector<uint8_t> &payload) const {
+    if (shared_secret_.empty() || payload.size() < sizeof(HandshakePayload) + sizeof(HandshakeSecret)) {
+        return false;
+    }
+
+    HandshakeSecret expected{};
+    std::memcpy(expected.secret, shared_secret_.data(), std::min(shared_secret_.size(), sizeof(expected.secret)));
+    const uint8_t *presented = payload.data() + sizeof(HandshakePayload);
+    uint8_t difference = 0;
+    for (size_t i = 0; i < sizeof(expected.secret); ++i) {
+        difference |= static_cast<uint8_t>(expected.secret[i]) ^ presented[i];
+    }
+    return difference == 0;
+}
+
+void ClientSession::handle_config_list(const std::vector<uint8_t> &payload) {
+    std::vector<DeviceSetup> configs = decode_config_list(payload, protocol_version_);
+
+    for (const auto &config: configs) {
+        Utility::debugPrint("Config:");
+        Utility::debugPrint("vendor_id: " + std::to_string(config.vendor_id));
+        Utility::debugPrint("product_id: " + std::to_string(config.product_id));
+        Utility::debugPrint("uid: " + std::to_string(config.uid));
+        Utility::debugPrint("target_key: " + std::to_string(config.target_key));
+        Utility::debugPrint("exclusive: " + std::to_string(config.exclusive));
+        Utility::debugPrint("debounce_ms: " + std::to_string(config.debounce_ms));
+        Utility::debugPrint("remap entries: " + std::to_string(config.remap.size()));
+    }
+
+    send_control(ControlType::ACK);
+
+    subscriber_ = proxy_.add_subscriber([this](const int key, const bool state, const uint64_t timestamp_us) {
+        on_key(key, state, timestamp_us);
+    });
+    proxy_.add_devices(configs, subscriber_);
+    configs_ = std::move(configs);
+    if (on_configured_) {
+        on_configured_();
+    }
+}
+
+void ClientSession::adopt(ClientSession &parked) {
+    subscriber_ = std::exchange(parked.subscriber_, 0);
+    event_sequence_ = parked.event_sequence_;
+    resume_token_ = parked.resume_token_;
+    configs_ = std::move(parked.configs_);
+    pending_edges_ = std::move(parked.pending_edges_);
+    proxy_.set_subscriber_callback(subscriber_, [this](const int key, const bool state, const uint64_t timestamp_us) {
+        on_key(key, state, timestamp_us);
+    });
+}
+
+void ClientSession::on_key(const int key, const bool state, const uint64_t timestamp_us) {
+    if (client_fd_ >= 0) {
+        send_key(key, state, timestamp_us);
+        return;
+    }
+
+    if (pending_edges_.size() >= MAX_PENDING_EDGES) {
+        pending_edges_.erase(pending_edges_.begin());
+    }
+    pending_edges_.push_back({key, state, timestamp_us});
+}
+
+void ClientSession::send_key(const int key, const bool state, const uint64_t timestamp_us) {
+    if (broken_) return;
+
+    bool queued;
+    if (protocol_version_ >= 2) {
+        KeyEventPayloadV2 p{};
+        p.key = key;
+        p.state = state ? 1 : 0;
+        p.sequence = ++event_sequence_;
+        p.timestamp_us = timestamp_us;
+        queued = outbound_.push(OutboundQueue::Lane::Key, Channel::Events,
+                                static_cast<uint16_t>(EventType::KEY_EVENT_V2), &p, sizeof(p));
+    } else {
+        const KeyEventPayload p{key, static_cast<uint8_t>(state ? 1 : 0)};
+        queued = outbound_.push(OutboundQueue::Lane::Key, Channel::Events,
+                                static_cast<uint16_t>(EventType::KEY_EVENT), &p, sizeof(p));
+    }
+    if (!queued) {
+        /* Dropping an edge could leave the microphone open, so give up on this client instead */
+        ServerStats::add(ServerStats::instance().slow_clients_dropped);
+        fail("Client is not reading key events");
+        return;
+    }
+    ServerStats::add(ServerStats::instance().key_packets_queued);
+    unsent_key_timestamps_.push_back(timestamp_us);
+    flush_outbound();
+}
+
+void ClientSession::send_control(const ControlType type, const void *data, const uint32_t len) {
+    if (broken_) return;
+
+    if (!outbound_.push(OutboundQueue::Lane::Control, Channel::Control, static_cast<uint16_t>(type), data, len)) {
+        ServerStats::add(ServerStats::instance().control_packets_dropped);
+        Utility::debugPrint("Outbound queue full, dropped " + control_type_to_string(static_cast<uint16_t>(type)) +
+                            " for fd=" + std::to_string(client_fd_));
+        return;
+    }
+    flush_outbound();
+}
+
+bool ClientSession::on_writable() {
+    flush_outbound();
+    return !broken_;
+}
+
+void ClientSession::flush_outbound() {
+    if (client_fd_ < 0 || broken_) return;
+
+    const auto result = outbound_.flush(client_fd_);
+    if (result == OutboundQueue::FlushResult::Error) {
+        fail("Failed to send to client");
+        return;
+    }
+
+    if (result != OutboundQueue::FlushResult::Pending && !unsent_key_timestamps_.empty()) {
+        const uint64_t now = monotonic_micros();
+        for (const uint64_t timestamp_us: unsent_key_timestamps_) {
+            ServerStats::instance().send_latency.record(now - timestamp_us);
+        }
+        unsent_key_timestamps_.clear();
+    }
+
+    if (const bool want_writable = result == OutboundQueue::FlushResult::Pending; want_writable != want_writable_) {
+        loop_.modify(client_fd_, want_writable ? SESSION_EPOLL_EVENTS | EPOLLOUT : SESSION_EPOLL_EVENTS);
+        want_writable_ = want_writable;
+    }
+}
+
+bool ClientSession::handle_query(const ControlType type, const std::vector<uint8_t> &payload) {
+    if (remote_ && (type == ControlType::DEVICE_LIST || type == ControlType::DEVICE_WATCH)) {
+        /* The host's device names and every key typed on it are not for guests, they only get their bound keys */
+        const std::string reason = control_type_to_string(static_cast<uint16_t>(type)) + " is not available over TCP";
+        send_control(ControlType::ERROR, reason.data(), static_cast<uint32_t>(reason.size()));
+        return true;
+    }
+
+    switch (type) {
+        case ControlType::STATS:
+            send_stats();
+            return true;
+        case ControlType::DEVICE_LIST:
+            send_device_list();
+            return true;
+        case ControlType::DEVICE_WATCH:
+            set_watching(payload.empty() || payload[0] != 0);
+            send_control(ControlType::ACK);
+            return true;
+        default:
+            return false;
+    }
+}
+
+void ClientSession::send_device_list() {
+    auto entries = DeviceIndex::instance().entries();
+    std::ranges::sort(entries, [](const DeviceIndexEntry &a, const DeviceIndexEntry &b) {
+        return a.event_name.size() != b.event_name.size() ? a.event_name.size() < b.event_name.size()
+                                                          : a.event_name < b.event_name;
+    });
+
+    std::string list;
+    for (const auto &entry: entries) {
+        list += DeviceUtils::format_device_id(entry.vendor_id, entry.product_id, entry.uid) + "\t" +
+                entry.dev_path() + "\t" + entry.capabilities + "\t" + entry.name + "\n";
+    }
+    send_control(ControlType::DEVICE_LIST, list.data(), static_cast<uint32_t>(list.size()));
+}
+
+void ClientSession::set_watching(const bool enable) {
+    if (enable && !watcher_) {
+        watcher_ = proxy_.add_watcher([this](const DeviceIndexEntry &device, const int key) {
+            on_device_key(device, key);
+        });
+    } else if (!enable && watcher_) {
+        proxy_.remove_watcher(std::exchange(watcher_, 0));
+    }
+}
+
+void ClientSession::on_device_key(const DeviceIndexEntry &device, const int key) {
+    if (client_fd_ < 0 || broken_) return;
+
+    DeviceKeyPayload p{};
+    p.vendor_id = device.vendor_id;
+    p.product_id = device.product_id;
+    p.uid = device.uid;
+    p.key = key;
+    /* Only informational, so it may be dropped like control packets rather than failing the session */
+    if (outbound_.push(OutboundQueue::Lane::Control, Channel::Events, static_cast<uint16_t>(EventType::DEVICE_KEY),
+                       &p, sizeof(p))) {
+        flush_outbound();
+    }
+}
+
+void ClientSession::send_stats() {
+    const std::string report = ServerStats::instance().report() + proxy_.device_stats();
+    send_control(ControlType::STATS, report.data(), static_cast<uint32_t>(report.size()));
+}
+
+void ClientSession::fail(const std::string &reason) {
+    Utility::error(reason + " fd=" + std::to_string(client_fd_) + ", closing the connection");
+    broken_ = true;
+    outbound_.clear();
+    unsent_key_timestamps_.clear();
+    /* The reactor sees the hangup and closes the session from its own handler */
+    shutdown(client_fd_, SHUT_RDWR);
+}
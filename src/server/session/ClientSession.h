@@ -0,0 +1,166 @@
+#ifndef CLIENTSESSION_H
+#define CLIENTSESSION_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "common/protocol/Packets.h"
+#include "server/device/EventLoop.h"
+#include "server/device/VirtualInputProxy.h"
+#include "OutboundQueue.h"
+
+/* Interest set of a session socket while nothing is waiting to be sent */
+#define SESSION_EPOLL_EVENTS (EPOLLIN | EPOLLRDHUP)
+/* Owner of TCP sessions, which carry no peer credentials; they only resume other TCP sessions */
+#define TCP_PEER_UID static_cast<uid_t>(-1)
+
+/**
+ * One connected ptt-client.
+ *
+ * Driven entirely by the server reactor: socket data is fed in through
+ * on_received() and parsed incrementally, so a slow or idle client never
+ * blocks any other session. Outgoing packets go through a non-blocking
+ * OutboundQueue drained on EPOLLOUT, so device reading never waits on a
+ * socket either. Devices are shared with other sessions through
+ * a subscription on the server-wide VirtualInputProxy.
+ */
+class ClientSession {
+public:
+    /* Hands over a detached session with the given resume token if it belongs to the same user */
+    using ResumeLookup = std::function<std::unique_ptr<ClientSession>(uint64_t token, uid_t uid)>;
+    /* Called after the client's CONFIG_LIST has been applied */
+    using ConfigHook = std::function<void()>;
+
+    /**
+     *  TCP peers must present shared_secret in their handshake; with an empty secret they are refused.
+     */
+    ClientSession(int client_fd, EventLoop &loop, VirtualInputProxy &proxy, ResumeLookup resume_lookup = {},
+                  ConfigHook on_configured = {}, std::string shared_secret = {});
+
+    ~ClientSession();
+
+    ClientSession(const ClientSession &) = delete;
+
+    ClientSession &operator=(const ClientSession &) = delete;
+
+    /**
+     *  Handles complete packets of data the reactor read from the socket (bytes is 0 at EOF, -errno on error).
+     *  Returns false when the session should be closed.
+     */
+    bool on_received(const uint8_t *data, ssize_t bytes);
+
+    /**
+     *  Sends queued packets once the socket accepts data again.
+     *  Returns false when the session should be closed.
+     */
+    bool on_writable();
+
+    [[nodiscard]] int fd() const { return client_fd_; }
+
+    [[nodiscard]] uid_t peer_uid() const { return cred_.uid; }
+
+    [[nodiscard]] uint64_t resume_token() const { return resume_token_; }
+
+    [[nodiscard]] const std::vector<DeviceSetup> &configs() const { return configs_; }
+
+    /**
+     *  Whether the session may be kept after its socket closed, for the client to resume.
+     */
+    [[nodiscard]] bool can_resume() const;
+
+    /**
+     *  Closes the socket but keeps devices grabbed, buffering key edges until a client resumes.
+     */
+    void detach();
+
+private:
+    enum class State {
+        AwaitHandshake,
+        AwaitConfig,
+        Active,
+    };
+
+    int client_fd_;
+    EventLoop &loop_;
+    VirtualInputProxy &proxy_;
+    VirtualInputProxy::SubscriberId subscriber_ = 0;
+    VirtualInputProxy::WatcherId watcher_ = 0;
+    State state_ = State::AwaitHandshake;
+    ucred cred_{};
+    /* Connected over TCP rather than the local socket */
+    bool remote_ = false;
+    std::string shared_secret_;
+    uint16_t protocol_version_ = 1;
+    uint32_t event_sequence_ = 0;
+    uint64_t resume_token_ = 0;
+    bool said_bye_ = false;
+    ResumeLookup resume_lookup_;
+    ConfigHook on_configured_;
+    std::vector<DeviceSetup> configs_;
+    PacketReader reader_;
+    OutboundQueue outbound_;
+    bool want_writable_ = false;
+    bool broken_ = false;
+
+    struct PendingEdge {
+        int key;
+        bool state;
+        uint64_t timestamp_us;
+    };
+
+    /* Edges seen while detached, oldest first */
+    std::vector<PendingEdge> pending_edges_;
+    /* Kernel timestamps of queued key packets the socket has not taken yet, for the send latency */
+    std::vector<uint64_t> unsent_key_timestamps_;
+
+    void handle_packet(const PacketHeader &hdr, const std::vector<uint8_t> &payload);
+
+    void handle_handshake(const std::vector<uint8_t> &payload);
+
+    /**
+     *  Checks the HandshakeSecret following the HandshakePayload in constant time.
+     */
+    [[nodiscard]] bool check_secret(const std::vector<uint8_t> &payload) const;
+
+    void handle_config_list(const std::vector<uint8_t> &payload);
+
+    /**
+     *  Takes over the devices, sequence and buffered edges of a detached session.
+     */
+    void adopt(ClientSession &parked);
+
+    void on_key(int key, bool state, uint64_t timestamp_us);
+
+    void send_key(int key, bool state, uint64_t timestamp_us);
+
+    void send_control(ControlType type, const void *data = nullptr, uint32_t len = 0);
+
+    /**
+     *  Answers requests that don't depend on the session state (STATS, DEVICE_LIST, DEVICE_WATCH).
+     *  Returns false for any other packet type.
+     */
+    bool handle_query(ControlType type, const std::vector<uint8_t> &payload);
+
+    void send_stats();
+
+    void send_device_list();
+
+    void set_watching(bool enable);
+
+    void on_device_key(const DeviceIndexEntry &device, int key);
+
+    /**
+     *  Writes what the socket takes and watches for EPOLLOUT while anything is left.
+     *  On a socket error the connection is shut down so the reactor closes the session.
+     */
+    void flush_outbound();
+
+    void fail(const std::string &reason);
+};
+
+#endif // CLIENTSESSION_H
@@ -0,0 +1,63 @@
+#include "OutboundQueue.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+
+#include "common/utilities/Utility.h"
+
+#define MAX_QUEUED_KEY_PACKETS 1024
+#define MAX_QUEUED_CONTROL_PACKETS 64
+
+bool OutboundQueue::push(const Lane lane, const Channel ch, const uint16_t type, const void *data,
+                         const uint32_t len) {
+    auto &queue = lane == Lane::Key ? key_lane_ : control_lane_;
+    if (const size_t limit = lane == Lane::Key ? MAX_QUEUED_KEY_PACKETS : MAX_QUEUED_CONTROL_PACKETS;
+        queue.size() >= limit) {
+        return false;
+    }
+
+    PacketHeader h{};
+    h.channel = static_cast<uint16_t>(ch);
+    h.type = type;
+    h.length = len;
+
+    std::vector<uint8_t> packet(sizeof(h) + len);
+    std::memcpy(packet.data(), &h, sizeof(h));
+    if (len > 0) {
+        std::memcpy(packet.data() + sizeof(h), data, len);
+    }
+    queue.push_back(std::move(packet));
+    return true;
+}
+
+OutboundQueue::FlushResult OutboundQueue::flush(const int fd) {
+    while (true) {
+        if (current_offset_ == current_.size()) {
+            current_.clear();
+            current_offset_ = 0;
+
+            auto &queue = !key_lane_.empty() ? key_lane_ : control_lane_;
+            if (queue.empty()) return FlushResult::Drained;
+            current_ = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        const ssize_t sent = send(fd, current_.data() + current_offset_, current_.size() - current_offset_,
+                                  MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return FlushResult::Pending;
+            Utility::error("send() failed fd=" + std::to_string(fd) + ": " + strerror(errno));
+            return FlushResult::Error;
+        }
+        current_offset_ += static_cast<size_t>(sent);
+    }
+}
+
+void OutboundQueue::clear() {
+    key_lane_.clear();
+    control_lane_.clear();
+    current_.clear();
+    current_offset_ = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef OUTBOUNDQUEUE_H
+#define OUTBOUNDQUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "common/protocol/Packets.h"
+
+/**
+ * Bounded, non-blocking send queue of one client socket.
+ *
+ * Packets are framed when queued and written with MSG_DONTWAIT whenever the
+ * socket accepts data, so no caller ever blocks on a slow client. Key events
+ * go to a priority lane that is always drained before control and log traffic;
+ * only a packet already partially on the wire is finished first.
+ *
+ * Overflow policy: a full control lane drops the new packet (PONGs and logs
+ * can be lost), a full key lane means the client stopped reading and the
+ * push fails so the owner can drop the connection.
+ */
+class OutboundQueue {
+public:
+    enum class Lane {
+        Key,
+        Control,
+    };
+
+    enum class FlushResult {
+        Drained,
+        Pending,
+        Error,
+    };
+
+    /**
+     *  Frames and queues a packet. Returns false if the lane is full, the caller counts the drop.
+     */
+    bool push(Lane lane, Channel ch, uint16_t type, const void *data, uint32_t len);
+
+    /**
+     *  Writes as much as the socket takes without blocking.
+     */
+    FlushResult flush(int fd);
+
+    void clear();
+
+    [[nodiscard]] bool empty() const { return current_.empty() && key_lane_.empty() && control_lane_.empty(); }
+
+private:
+    std::deque<std::vector<uint8_t> > key_lane_;
+    std::deque<std::vector<uint8_t> > control_lane_;
+    /* Packet being written, it has to finish before another lane may interleave */
+    std::vector<uint8_t> current_;
+    size_t current_offset_ = 0;
+};
+
+#endif // OUTBOUNDQUEUE_H
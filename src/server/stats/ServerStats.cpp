@@ -0,0 +1,48 @@
+#include "ServerStats.h"
+
+ServerStats &ServerStats::instance() {
+    static ServerStats stats;
+    return stats;
+}
+
+ServerStats::ServerStats() : started_us_(monotonic_micros()) {
+}
+
+std::string ServerStats::report() const {
+    std::string out;
+    const auto counter = [&out](const char *name, const std::atomic<uint64_t> &value) {
+        out += std::string(name) + " " + std::to_string(value.load(std::memory_order_relaxed)) + "\n";
+    };
+    const auto histogram = [&out](const char *name, const LatencyHistogram &hist) {
+        out += std::string("latency.") + name + " " + hist.summary() + " buckets " + hist.buckets_string() + "\n";
+    };
+
+    out += "uptime_s " + std::to_string((monotonic_micros() - started_us_) / 1000000) + "\n";
+    counter("events_read", events_read);
+    counter("read_calls", read_calls);
+    counter("syn_dropped", syn_dropped);
+    counter("key_edges", key_edges);
+    counter("edges_debounced", edges_debounced);
+    counter("open_failures", open_failures);
+    counter("grab_failures", grab_failures);
+    counter("retry_attempts", retry_attempts);
+    counter("events_written", events_written);
+    counter("write_calls", write_calls);
+    counter("frames_forwarded", frames_forwarded);
+    counter("events_coalesced", events_coalesced);
+    counter("events_dropped", events_dropped);
+    counter("backlog_events_dropped", backlog_events_dropped);
+    counter("sessions_accepted", sessions_accepted);
+    counter("sessions_resumed", sessions_resumed);
+    counter("sessions_active", sessions_active);
+    counter("sessions_parked", sessions_parked);
+    counter("key_packets_queued", key_packets_queued);
+    counter("control_packets_dropped", control_packets_dropped);
+    counter("slow_clients_dropped", slow_clients_dropped);
+
+    histogram("read", read_latency);
+    histogram("dispatch", dispatch_latency);
+    histogram("send", send_latency);
+    histogram("forward", forward_latency);
+    return out;
+}
@@ -0,0 +1,67 @@
+#ifndef SERVERSTATS_H
+#define SERVERSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "common/utilities/LatencyHistogram.h"
+
+/**
+ * Process-wide counters and per-stage latency histograms of the input pipeline.
+ *
+ * Everything is a relaxed atomic, so recording costs a few uncontended
+ * increments and stats are always collected. Served to clients through the
+ * STATS control packet as "name value" lines.
+ */
+class ServerStats {
+public:
+    static ServerStats &instance();
+
+    /* Physical devices */
+    std::atomic<uint64_t> events_read{0};
+    std::atomic<uint64_t> read_calls{0};
+    std::atomic<uint64_t> syn_dropped{0};
+    std::atomic<uint64_t> key_edges{0};
+    std::atomic<uint64_t> edges_debounced{0};
+    std::atomic<uint64_t> open_failures{0};
+    std::atomic<uint64_t> grab_failures{0};
+    std::atomic<uint64_t> retry_attempts{0};
+
+    /* Virtual devices */
+    std::atomic<uint64_t> events_written{0};
+    std::atomic<uint64_t> write_calls{0};
+    std::atomic<uint64_t> frames_forwarded{0};
+    std::atomic<uint64_t> events_coalesced{0};
+    std::atomic<uint64_t> events_dropped{0};
+    /* Events of frames dropped because a virtual device fell too far behind */
+    std::atomic<uint64_t> backlog_events_dropped{0};
+
+    /* Client sessions */
+    std::atomic<uint64_t> sessions_accepted{0};
+    std::atomic<uint64_t> sessions_resumed{0};
+    std::atomic<uint64_t> sessions_active{0};
+    std::atomic<uint64_t> sessions_parked{0};
+    std::atomic<uint64_t> key_packets_queued{0};
+    std::atomic<uint64_t> control_packets_dropped{0};
+    std::atomic<uint64_t> slow_clients_dropped{0};
+
+    /* Microseconds from the kernel's event timestamp until each stage */
+    LatencyHistogram read_latency;
+    LatencyHistogram dispatch_latency;
+    LatencyHistogram send_latency;
+    LatencyHistogram forward_latency;
+
+    static void add(std::atomic<uint64_t> &counter, const uint64_t n = 1) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::string report() const;
+
+private:
+    const uint64_t started_us_;
+
+    ServerStats();
+};
+
+#endif // SERVERSTATS_H
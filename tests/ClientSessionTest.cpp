@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "common/protocol/Packets.h"
+#include "server/device/EventLoop.h"
+#include "server/device/VirtualInputProxy.h"
+#include "server/session/ClientSession.h"
+#include "server/stats/ServerStats.h"
+#include "UinputDevice.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+    DeviceCapabilities ptt_pedal_caps() {
+        DeviceCapabilities caps;
+        caps.name = "PTT Test Pedal";
+        caps.key_bits.set(KEY_A);
+        caps.key_bits.set(KEY_F13);
+        caps.num_keys = static_cast<int>(caps.key_bits.count());
+        return caps;
+    }
+
+    /* Handshakes and binds F13 of the device, returns false if the server did not ACK both */
+    bool configure(const int fd, const UinputDevice &device) {
+        HandshakePayload handshake{};
+        handshake.version = PROTOCOL_VERSION;
+        PacketHeader hdr{};
+        std::vector<uint8_t> payload;
+        if (!write_packet(fd, Channel::Control, static_cast<uint16_t>(ControlType::HAND_SHAKE), &handshake,
+                          sizeof(handshake)) ||
+            !read_packet(fd, hdr, payload) || hdr.type != static_cast<uint16_t>(ControlType::ACK)) {
+            return false;
+        }
+
+        DeviceSetup setup{};
+        setup.vendor_id = UinputDevice::VENDOR_ID;
+        setup.product_id = UinputDevice::PRODUCT_ID;
+        setup.uid = device.uid();
+        setup.target_key = KEY_F13;
+        const std::vector<uint8_t> configs = encode_config_list({setup}, PROTOCOL_VERSION);
+        return write_packet(fd, Channel::Control, static_cast<uint16_t>(ControlType::CONFIG_LIST), configs.data(),
+                            static_cast<uint32_t>(configs.size())) &&
+               read_packet(fd, hdr, payload) && hdr.type == static_cast<uint16_t>(ControlType::ACK);
+    }
+
+    /* Reads KEY_EVENT_V2 packets until expected arrived, returns how many did with consecutive sequence numbers */
+    int read_key_events(const int fd, const int expected) {
+        int in_order = 0;
+        PacketHeader hdr{};
+        std::vector<uint8_t> payload;
+        while (in_order < expected && read_packet(fd, hdr, payload)) {
+            if (hdr.channel != static_cast<uint16_t>(Channel::Events) ||
+                hdr.type != static_cast<uint16_t>(EventType::KEY_EVENT_V2) ||
+                payload.size() < sizeof(KeyEventPayloadV2)) {
+                continue;
+            }
+            KeyEventPayloadV2 event{};
+            std::memcpy(&event, payload.data(), sizeof(event));
+            if (event.key != KEY_F13 || event.sequence != static_cast<uint32_t>(in_order + 1)) break;
+            ++in_order;
+        }
+        return in_order;
+    }
+}
+
+/* Sessions wired to the reactor the way InputProxyServer does it, over socketpairs */
+class ClientSessionTest : public testing::Test {
+protected:
+    EventLoop loop;
+    std::unique_ptr<VirtualInputProxy> proxy;
+    std::unordered_map<int, std::unique_ptr<ClientSession> > sessions;
+
+    void SetUp() override {
+        loop.start();
+        proxy = std::make_unique<VirtualInputProxy>(loop);
+        proxy->start();
+    }
+
+    void TearDown() override {
+        loop.run_in_loop([this] { sessions.clear(); });
+        proxy.reset();
+        loop.stop();
+    }
+
+    void close_session(const int server_fd) {
+        loop.remove(server_fd);
+        sessions.erase(server_fd);
+    }
+
+    /* Returns the client end of a new session */
+    int connect_session(const int send_buffer = 0) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) return -1;
+        const int server_fd = fds[0];
+        if (send_buffer) {
+            setsockopt(server_fd, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer));
+        }
+        timeval timeout{5, 0};
+        setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        loop.run_in_loop([&] {
+            sessions[server_fd] = std::make_unique<ClientSession>(server_fd, loop, *proxy);
+            loop.add_reader(server_fd, SESSION_EPOLL_EVENTS,
+                            [this, server_fd](const uint8_t *data, const ssize_t bytes) {
+                                const auto it = sessions.find(server_fd);
+                                if (it != sessions.end() && !it->second->on_received(data, bytes)) {
+                                    close_session(server_fd);
+                                }
+                            },
+                            [this, server_fd](uint32_t) {
+                                const auto it = sessions.find(server_fd);
+                                if (it != sessions.end() && !it->second->on_writable()) {
+                                    close_session(server_fd);
+                                }
+                            });
+        });
+        return fds[1];
+    }
+};
+
+TEST_F(ClientSessionTest, StalledClientDoesNotHoldBackOthers) {
+    const UinputDevice pedal(ptt_pedal_caps());
+    if (!pedal.ok()) GTEST_SKIP() << "uinput is not available";
+
+    constexpr int active_clients = 3;
+    constexpr int edges = 4000;
+
+    std::vector<int> active;
+    for (int i = 0; i < active_clients; ++i) {
+        active.push_back(connect_session());
+        ASSERT_TRUE(configure(active.back(), pedal));
+    }
+    /* Never reads past its handshake, and has little socket buffer to hide that */
+    const int stalled = connect_session(4096);
+    ASSERT_TRUE(configure(stalled, pedal));
+    const uint64_t slow_before = ServerStats::instance().slow_clients_dropped.load();
+
+    std::vector<int> received(active_clients, 0);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < active_clients; ++i) {
+        readers.emplace_back([&, i] { received[i] = read_key_events(active[i], edges); });
+    }
+
+    /* Paced so the evdev buffer never overruns and every edge reaches the sessions */
+    for (int i = 0; i < edges; ++i) {
+        if (!pedal.emit_key(KEY_F13, i % 2 == 0)) {
+            ADD_FAILURE() << "uinput write failed";
+            break;
+        }
+        std::this_thread::sleep_for(200us);
+    }
+    for (auto &reader: readers) reader.join();
+
+    for (int i = 0; i < active_clients; ++i) {
+        EXPECT_EQ(received[i], edges) << "client " << i;
+        close(active[i]);
+    }
+    /* The key lane holds far fewer packets than were sent, so the stalled client was given up on */
+    EXPECT_GT(ServerStats::instance().slow_clients_dropped.load(), slow_before);
+    close(stalled);
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+#include "common/device/DeviceCapabilities.h"
+#include "LegacyUid.h"
+#include "UinputDevice.h"
+
+using namespace DeviceUtils;
+
+namespace {
+    DeviceCapabilities gamepad_caps() {
+        DeviceCapabilities caps;
+        caps.name = "Test Gamepad";
+        caps.key_bits.set(KEY_A);
+        caps.key_bits.set(BTN_SOUTH);
+        caps.key_bits.set(BTN_EAST);
+        caps.num_keys = static_cast<int>(caps.key_bits.count());
+        caps.rel_bits.set(REL_WHEEL);
+        for (const int code: {ABS_X, ABS_RZ}) {
+            caps.abs_bits.set(code);
+            caps.abs_info[code] = {0, -32768, 32767, 16, 128, 0};
+            caps.abs_info_valid.set(code);
+        }
+        return caps;
+    }
+}
+
+TEST(DeviceCapabilitiesTest, UidMatchesLegacyAlgorithm) {
+    const DeviceCapabilities caps = gamepad_caps();
+    EXPECT_EQ(generate_uid(caps), legacy_uid(caps));
+
+    DeviceCapabilities keyboard;
+    keyboard.name = "Test Keyboard";
+    for (int code = KEY_ESC; code <= KEY_KPDOT; ++code) keyboard.key_bits.set(code);
+    keyboard.num_keys = static_cast<int>(keyboard.key_bits.count());
+    EXPECT_EQ(generate_uid(keyboard), legacy_uid(keyboard));
+}
+
+TEST(DeviceCapabilitiesTest, UidPathsAgreeWhenNameAndBitsAreUnreadable) {
+    /* Every evdev ioctl fails on a non-evdev fd, exercising all fallbacks of both paths */
+    const int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    ASSERT_GE(fd, 0);
+
+    const DeviceCapabilities caps = get_device_capabilities(fd);
+    EXPECT_EQ(caps.name, "");
+    EXPECT_EQ(generate_uid(fd), generate_uid(caps));
+    EXPECT_EQ(generate_uid(fd), legacy_uid(caps));
+    close(fd);
+}
+
+TEST(DeviceCapabilitiesTest, UidPathsAgreeOnDevice) {
+    const UinputDevice device(gamepad_caps());
+    if (!device.ok()) GTEST_SKIP() << "uinput is not available";
+
+    const int fd = open(device.dev_path().c_str(), O_RDONLY | O_CLOEXEC);
+    ASSERT_GE(fd, 0);
+
+    const DeviceCapabilities caps = get_device_capabilities(fd);
+    EXPECT_EQ(caps.name, "Test Gamepad");
+    EXPECT_EQ(generate_uid(fd), generate_uid(caps));
+    EXPECT_EQ(generate_uid(fd), legacy_uid(caps));
+
+    close(fd);
+}
@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "server/device/EventLoop.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+    /* What a reader was handed, filled on the loop thread */
+    struct Received {
+        std::vector<uint8_t> data;
+        int reads = 0;
+        ssize_t last = 1;
+        std::promise<void> ended;
+    };
+
+    EventLoop::Reader collect(EventLoop &loop, const int fd, Received &received) {
+        return [&loop, fd, &received](const uint8_t *data, const ssize_t bytes) {
+            ++received.reads;
+            received.last = bytes;
+            if (bytes <= 0) {
+                loop.remove(fd);
+                received.ended.set_value();
+                return;
+            }
+            received.data.insert(received.data.end(), data, data + bytes);
+        };
+    }
+
+    std::vector<uint8_t> pattern(const size_t size) {
+        std::vector<uint8_t> out(size);
+        for (size_t i = 0; i < size; ++i) out[i] = static_cast<uint8_t>(i * 7 + i / 251);
+        return out;
+    }
+}
+
+/* Every case runs once per backend, io_uring ones are skipped where the kernel lacks it */
+class EventLoopTest : public testing::TestWithParam<IoEngine> {
+protected:
+    std::unique_ptr<EventLoop> loop;
+
+    void SetUp() override {
+        EventLoop::set_io_engine(GetParam());
+        loop = std::make_unique<EventLoop>();
+        EventLoop::set_io_engine(IoEngine::Epoll);
+        if (GetParam() == IoEngine::IoUring && std::string(loop->backend()) != "io_uring") {
+            GTEST_SKIP() << "io_uring is not available";
+        }
+        loop->start();
+    }
+
+    void TearDown() override {
+        loop->stop();
+    }
+};
+
+TEST_P(EventLoopTest, ReaderGetsDataInOrderThenEof) {
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK | O_CLOEXEC), 0);
+    Received received;
+    ASSERT_TRUE(loop->add_reader(fds[0], EPOLLIN, collect(*loop, fds[0], received)));
+
+    const std::vector<uint8_t> expected = pattern(3000);
+    for (size_t offset = 0; offset < expected.size(); offset += 1000) {
+        ASSERT_EQ(write(fds[1], expected.data() + offset, 1000), 1000);
+        std::this_thread::sleep_for(5ms);
+    }
+    close(fds[1]);
+
+    ASSERT_EQ(received.ended.get_future().wait_for(2s), std::future_status::ready);
+    EXPECT_EQ(received.data, expected);
+    EXPECT_EQ(received.last, 0);
+    close(fds[0]);
+}
+
+TEST_P(EventLoopTest, ReaderKeepsUpWithMoreThanItsBuffers) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds), 0);
+    Received received;
+    ASSERT_TRUE(loop->add_reader(fds[0], EPOLLIN | EPOLLRDHUP, collect(*loop, fds[0], received)));
+
+    /* Well past the 512 KiB of provided buffers io_uring reads into */
+    const std::vector<uint8_t> expected = pattern(2 * 1024 * 1024);
+    size_t sent = 0;
+    while (sent < expected.size()) {
+        const ssize_t n = write(fds[1], expected.data() + sent, expected.size() - sent);
+        if (n > 0) {
+            sent += static_cast<size_t>(n);
+        } else {
+            ASSERT_EQ(errno, EAGAIN);
+            std::this_thread::sleep_for(100us);
+        }
+    }
+    close(fds[1]);
+
+    ASSERT_EQ(received.ended.get_future().wait_for(5s), std::future_status::ready);
+    EXPECT_EQ(received.data.size(), expected.size());
+    EXPECT_TRUE(received.data == expected);
+    close(fds[0]);
+}
+
+TEST_P(EventLoopTest, ReaderHandlerGetsWritability) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds), 0);
+    Received received;
+    std::promise<uint32_t> writable;
+    bool reported = false;
+    ASSERT_TRUE(loop->add_reader(fds[0], EPOLLIN, collect(*loop, fds[0], received), [&](const uint32_t events) {
+        if (!reported) writable.set_value(events);
+        reported = true;
+    }));
+
+    /* Only data reaches the reader until EPOLLOUT is asked for */
+    ASSERT_EQ(write(fds[1], "ping", 4), 4);
+    std::this_thread::sleep_for(50ms);
+    loop->run_in_loop([&] { EXPECT_FALSE(reported); });
+    ASSERT_TRUE(loop->modify(fds[0], EPOLLIN | EPOLLOUT));
+
+    auto events = writable.get_future();
+    ASSERT_EQ(events.wait_for(2s), std::future_status::ready);
+    EXPECT_TRUE(events.get() & EPOLLOUT);
+    loop->run_in_loop([&] { EXPECT_EQ(std::string(received.data.begin(), received.data.end()), "ping"); });
+
+    loop->remove(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_P(EventLoopTest, RemovedReaderGetsNothingMore) {
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK | O_CLOEXEC), 0);
+    Received received;
+    ASSERT_TRUE(loop->add_reader(fds[0], EPOLLIN, collect(*loop, fds[0], received)));
+    loop->remove(fds[0]);
+
+    ASSERT_EQ(write(fds[1], "late", 4), 4);
+    std::this_thread::sleep_for(50ms);
+    loop->run_in_loop([&] { EXPECT_EQ(received.reads, 0); });
+
+    /* The data stayed in the pipe for whoever reads next */
+    char buffer[8];
+    EXPECT_EQ(read(fds[0], buffer, sizeof(buffer)), 4);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, EventLoopTest, testing::Values(IoEngine::Epoll, IoEngine::IoUring),
+                         [](const testing::TestParamInfo<IoEngine> &info) {
+                             return info.param == IoEngine::Epoll ? "epoll" : "io_uring";
+                         });
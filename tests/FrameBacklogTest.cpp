@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include <tuple>
+#include <vector>
+
+#include "server/device/FrameBacklog.h"
+
+namespace {
+    input_event event(const uint16_t type, const uint16_t code, const int32_t value) {
+        input_event ev{};
+        ev.type = type;
+        ev.code = code;
+        ev.value = value;
+        return ev;
+    }
+
+    input_event syn() {
+        return event(EV_SYN, SYN_REPORT, 0);
+    }
+
+    void push(FrameBacklog &backlog, const std::vector<input_event> &frame, size_t *merged = nullptr) {
+        const size_t n = backlog.push(frame.data(), frame.size(), FrameBacklog::is_motion_frame(frame));
+        if (merged) *merged = n;
+    }
+
+    using Event = std::tuple<uint16_t, uint16_t, int32_t>;
+
+    std::vector<Event> contents(const FrameBacklog &backlog) {
+        std::vector<Event> out;
+        for (size_t i = 0; i < backlog.size(); ++i) {
+            const input_event &ev = backlog.data()[i];
+            out.emplace_back(ev.type, ev.code, ev.value);
+        }
+        return out;
+    }
+}
+
+TEST(FrameBacklogTest, MotionFrameClassification) {
+    EXPECT_TRUE(FrameBacklog::is_motion_frame({event(EV_REL, REL_X, 1), event(EV_REL, REL_WHEEL, -1), syn()}));
+    EXPECT_TRUE(FrameBacklog::is_motion_frame({event(EV_ABS, ABS_X, 10), event(EV_MSC, MSC_TIMESTAMP, 5), syn()}));
+
+    EXPECT_FALSE(FrameBacklog::is_motion_frame({event(EV_KEY, BTN_LEFT, 1), event(EV_REL, REL_X, 1), syn()}));
+    EXPECT_FALSE(FrameBacklog::is_motion_frame({event(EV_ABS, ABS_MT_SLOT, 1), syn()}));
+    EXPECT_FALSE(FrameBacklog::is_motion_frame({event(EV_ABS, ABS_MT_POSITION_X, 100), syn()}));
+    EXPECT_FALSE(FrameBacklog::is_motion_frame({event(EV_MSC, MSC_SCAN, 30), syn()}));
+    EXPECT_FALSE(FrameBacklog::is_motion_frame({event(EV_REL, REL_X, 1), event(EV_SYN, SYN_DROPPED, 0)}));
+}
+
+TEST(FrameBacklogTest, RelativeMotionIsSummed) {
+    FrameBacklog backlog;
+    size_t merged = 0;
+    push(backlog, {event(EV_REL, REL_X, 3), event(EV_REL, REL_Y, -1), syn()});
+    push(backlog, {event(EV_REL, REL_X, 4), event(EV_REL, REL_WHEEL, 1), syn()}, &merged);
+
+    EXPECT_EQ(merged, 1u);
+    EXPECT_EQ(contents(backlog), (std::vector<Event>{
+                  {EV_REL, REL_X, 7}, {EV_REL, REL_Y, -1}, {EV_REL, REL_WHEEL, 1}, {EV_SYN, SYN_REPORT, 0},
+                  }));
+}
+
+TEST(FrameBacklogTest, AbsolutePositionIsReplaced) {
+    FrameBacklog backlog;
+    push(backlog, {event(EV_ABS, ABS_X, 100), event(EV_ABS, ABS_Y, 200), syn()});
+    push(backlog, {event(EV_ABS, ABS_X, 150), syn()});
+    push(backlog, {event(EV_ABS, ABS_X, 120), event(EV_ABS, ABS_Y, 180), syn()});
+
+    EXPECT_EQ(contents(backlog), (std::vector<Event>{
+                  {EV_ABS, ABS_X, 120}, {EV_ABS, ABS_Y, 180}, {EV_SYN, SYN_REPORT, 0},
+                  }));
+}
+
+TEST(FrameBacklogTest, KeyFramesAreNeverMerged) {
+    FrameBacklog backlog;
+    size_t merged = 0;
+    push(backlog, {event(EV_REL, REL_X, 1), syn()});
+    push(backlog, {event(EV_KEY, BTN_LEFT, 1), syn()}, &merged);
+    EXPECT_EQ(merged, 0u);
+
+    /* Motion after a click starts a new frame instead of jumping ahead of the click */
+    push(backlog, {event(EV_REL, REL_X, 2), syn()});
+    push(backlog, {event(EV_REL, REL_X, 5), syn()});
+    push(backlog, {event(EV_KEY, BTN_LEFT, 0), syn()});
+    push(backlog, {event(EV_KEY, BTN_LEFT, 1), syn()});
+
+    EXPECT_EQ(contents(backlog), (std::vector<Event>{
+                  {EV_REL, REL_X, 1}, {EV_SYN, SYN_REPORT, 0},
+                  {EV_KEY, BTN_LEFT, 1}, {EV_SYN, SYN_REPORT, 0},
+                  {EV_REL, REL_X, 7}, {EV_SYN, SYN_REPORT, 0},
+                  {EV_KEY, BTN_LEFT, 0}, {EV_SYN, SYN_REPORT, 0},
+                  {EV_KEY, BTN_LEFT, 1}, {EV_SYN, SYN_REPORT, 0},
+                  }));
+}
+
+TEST(FrameBacklogTest, PartiallyWrittenFrameIsNotMergedInto) {
+    FrameBacklog backlog;
+    push(backlog, {event(EV_REL, REL_X, 1), event(EV_REL, REL_Y, 1), syn()});
+
+    /* The device took REL_X, so the rest of that frame must go out unchanged */
+    backlog.consume(1);
+    push(backlog, {event(EV_REL, REL_Y, 5), syn()});
+
+    EXPECT_EQ(contents(backlog), (std::vector<Event>{
+                  {EV_REL, REL_Y, 1}, {EV_SYN, SYN_REPORT, 0},
+                  {EV_REL, REL_Y, 5}, {EV_SYN, SYN_REPORT, 0},
+                  }));
+}
+
+TEST(FrameBacklogTest, TrailingFrameStaysMergeableAfterEarlierFramesDrain) {
+    FrameBacklog backlog;
+    push(backlog, {event(EV_KEY, KEY_A, 1), syn()});
+    push(backlog, {event(EV_REL, REL_X, 1), syn()});
+
+    backlog.consume(2);
+    size_t merged = 0;
+    push(backlog, {event(EV_REL, REL_X, 2), syn()}, &merged);
+
+    EXPECT_EQ(merged, 1u);
+    EXPECT_EQ(contents(backlog), (std::vector<Event>{{EV_REL, REL_X, 3}, {EV_SYN, SYN_REPORT, 0}}));
+}
+
+TEST(FrameBacklogTest, ClearForgetsTheTrailingFrame) {
+    FrameBacklog backlog;
+    push(backlog, {event(EV_REL, REL_X, 1), syn()});
+    backlog.clear();
+    EXPECT_TRUE(backlog.empty());
+
+    size_t merged = 0;
+    push(backlog, {event(EV_REL, REL_X, 2), syn()}, &merged);
+    EXPECT_EQ(merged, 0u);
+    EXPECT_EQ(contents(backlog), (std::vector<Event>{{EV_REL, REL_X, 2}, {EV_SYN, SYN_REPORT, 0}}));
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include <numeric>
+#include <vector>
+
+#include "common/utilities/Utility.h"
+#include "server/device/KeyState.h"
+
+namespace {
+    KeyBits keys(const std::initializer_list<int> codes) {
+        KeyBits bits;
+        for (const int code: codes) bits.set(code);
+        return bits;
+    }
+
+    std::vector<int> codes(const KeyBits &bits) {
+        std::vector<int> out;
+        bits.for_each([&](const int code) { out.push_back(code); });
+        return out;
+    }
+
+    std::vector<uint16_t> identity_remap() {
+        std::vector<uint16_t> remap(KEY_CNT);
+        std::iota(remap.begin(), remap.end(), 0);
+        return remap;
+    }
+}
+
+TEST(KeyStateTest, EmptyRemapKeepsState) {
+    const KeyBits state = keys({KEY_A, KEY_LEFTCTRL, BTN_SOUTH});
+    EXPECT_EQ(codes(KeyState::apply_remap(state, {})), codes(state));
+}
+
+TEST(KeyStateTest, RemapTranslatesAndDropsKeys) {
+    auto remap = identity_remap();
+    remap[KEY_CAPSLOCK] = KEY_LEFTCTRL;
+    remap[KEY_INSERT] = REMAP_DROP;
+
+    const KeyBits mapped = KeyState::apply_remap(keys({KEY_A, KEY_CAPSLOCK, KEY_INSERT}), remap);
+    EXPECT_EQ(codes(mapped), (std::vector{KEY_LEFTCTRL, KEY_A}));
+}
+
+TEST(KeyStateTest, TwoKeysRemappedToOneCodeStayDownWhileEitherIs) {
+    auto remap = identity_remap();
+    remap[KEY_RIGHTALT] = KEY_LEFTALT;
+
+    EXPECT_EQ(codes(KeyState::apply_remap(keys({KEY_RIGHTALT}), remap)), (std::vector{KEY_LEFTALT}));
+    EXPECT_EQ(codes(KeyState::apply_remap(keys({KEY_LEFTALT, KEY_RIGHTALT}), remap)), (std::vector{KEY_LEFTALT}));
+}
+
+TEST(KeyStateTest, LostTransitionsReportPressesAndReleases) {
+    /* KEY_A was released and KEY_B pressed while events were dropped, KEY_C is unchanged */
+    const KeyBits state = keys({KEY_B, KEY_C});
+    const KeyBits keys_down = keys({KEY_A, KEY_C});
+
+    EXPECT_EQ(codes(KeyState::lost_transitions(state, keys_down, {})), (std::vector{KEY_A, KEY_B}));
+}
+
+TEST(KeyStateTest, LostTransitionsSkipBoundKeys) {
+    /* The PTT key goes to subscribers, never to the virtual device */
+    const KeyBits state = keys({KEY_F13, KEY_B});
+    const KeyBits target_keys = keys({KEY_F13});
+
+    EXPECT_EQ(codes(KeyState::lost_transitions(state, {}, target_keys)), (std::vector{KEY_B}));
+}
+
+TEST(KeyStateTest, NoTransitionsWhenInSync) {
+    const KeyBits state = keys({KEY_A, BTN_LEFT, KEY_MAX});
+    EXPECT_FALSE(KeyState::lost_transitions(state, state, {}).any());
+}
+
+TEST(KeyStateTest, ResyncUsesRemappedCodes) {
+    /* A held CapsLock remapped to Ctrl must not look like a lost Ctrl release */
+    auto remap = identity_remap();
+    remap[KEY_CAPSLOCK] = KEY_LEFTCTRL;
+    const KeyBits state = KeyState::apply_remap(keys({KEY_CAPSLOCK}), remap);
+
+    EXPECT_FALSE(KeyState::lost_transitions(state, keys({KEY_LEFTCTRL}), {}).any());
+}
+
+TEST(KeyStateTest, RemapTableStaysEmptyWithoutEntries) {
+    std::vector<uint16_t> table;
+    KeyState::add_remap(table, {}, KEY_F13);
+    EXPECT_TRUE(table.empty());
+}
+
+TEST(KeyStateTest, RemapTableMapsDropsAndResolvesPtt) {
+    std::vector<uint16_t> table;
+    KeyState::add_remap(table, {{KEY_CAPSLOCK, KEY_LEFTCTRL}, {KEY_INSERT, REMAP_DROP}, {BTN_EXTRA, REMAP_TO_PTT}},
+                        KEY_F13);
+
+    ASSERT_EQ(table.size(), static_cast<size_t>(KEY_CNT));
+    EXPECT_EQ(table[KEY_CAPSLOCK], KEY_LEFTCTRL);
+    EXPECT_EQ(table[KEY_INSERT], REMAP_DROP);
+    EXPECT_EQ(table[BTN_EXTRA], KEY_F13);
+    /* Everything else passes through unchanged */
+    EXPECT_EQ(table[KEY_A], KEY_A);
+    EXPECT_EQ(table[KEY_LEFTCTRL], KEY_LEFTCTRL);
+}
+
+TEST(KeyStateTest, RemapTableIgnoresOutOfRangeCodes) {
+    std::vector<uint16_t> table;
+    KeyState::add_remap(table, {{KEY_CNT, KEY_A}, {KEY_A, KEY_CNT}, {0xFFFE, KEY_B}}, KEY_F13);
+    EXPECT_TRUE(table.empty());
+
+    /* REMAP_TO_PTT on a binding without a valid key is ignored too */
+    KeyState::add_remap(table, {{KEY_A, REMAP_TO_PTT}}, -1);
+    EXPECT_TRUE(table.empty());
+}
+
+TEST(KeyStateTest, LaterRemapEntriesWin) {
+    std::vector<uint16_t> table;
+    KeyState::add_remap(table, {{KEY_CAPSLOCK, KEY_LEFTCTRL}, {KEY_CAPSLOCK, KEY_ESC}}, KEY_F13);
+    EXPECT_EQ(table[KEY_CAPSLOCK], KEY_ESC);
+
+    /* A second subscription on the same device overrides the first, each resolving its own PTT key */
+    KeyState::add_remap(table, {{KEY_CAPSLOCK, REMAP_TO_PTT}, {KEY_PAUSE, REMAP_DROP}}, KEY_F14);
+    EXPECT_EQ(table[KEY_CAPSLOCK], KEY_F14);
+    EXPECT_EQ(table[KEY_PAUSE], REMAP_DROP);
+}
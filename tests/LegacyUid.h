@@ -0,0 +1,37 @@
+#ifndef LEGACYUID_H
+#define LEGACYUID_H
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <zlib.h>
+
+#include "common/device/DeviceCapabilities.h"
+
+/**
+ * The string-building UID algorithm configs were saved with, kept as the
+ * reference generate_uid() has to match and as the baseline it is measured against.
+ */
+inline uint32_t legacy_uid(const DeviceCapabilities &caps) {
+    std::stringstream ss;
+    ss << caps.name << ":" << caps.num_keys << ":";
+    for (int i = 0; i <= KEY_MAX; ++i) {
+        if (caps.key_bits.test(i)) ss << "K" << i << ",";
+    }
+    for (int i = 0; i <= ABS_MAX; ++i) {
+        if (caps.abs_bits.test(i)) {
+            const auto &absinfo = caps.abs_info[i];
+            ss << "A" << i << ":" << absinfo.minimum << "," << absinfo.maximum << "," << absinfo.fuzz << ","
+                    << absinfo.flat << "," << absinfo.resolution << ",";
+        }
+    }
+    for (int i = 0; i <= REL_MAX; ++i) {
+        if (caps.rel_bits.test(i)) ss << "R" << i << ",";
+    }
+
+    std::string uid_str = ss.str();
+    if (!uid_str.empty() && uid_str.back() == ',') uid_str.pop_back();
+    return crc32(0, reinterpret_cast<const Bytef *>(uid_str.data()), uid_str.size());
+}
+
+#endif // LEGACYUID_H
@@ -0,0 +1,130 @@
+#ifndef UINPUTDEVICE_H
+#define UINPUTDEVICE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+
+#include "common/device/DeviceCapabilities.h"
+
+/**
+ * A virtual evdev device built from a capability set, for tests and benches.
+ *
+ * ok() is false when /dev/uinput is not accessible or the event node never
+ * showed up, callers skip in that case. The device is destroyed with the object.
+ */
+class UinputDevice {
+public:
+    static constexpr uint16_t VENDOR_ID = 0x1209;
+    static constexpr uint16_t PRODUCT_ID = 0x7077;
+
+    explicit UinputDevice(const DeviceCapabilities &caps) {
+        ufd_ = open("/dev/uinput", O_WRONLY | O_CLOEXEC);
+        if (ufd_ < 0) return;
+
+        if (caps.key_bits.any()) ioctl(ufd_, UI_SET_EVBIT, EV_KEY);
+        caps.key_bits.for_each([&](const int code) { ioctl(ufd_, UI_SET_KEYBIT, code); });
+        if (caps.rel_bits.any()) ioctl(ufd_, UI_SET_EVBIT, EV_REL);
+        caps.rel_bits.for_each([&](const int code) { ioctl(ufd_, UI_SET_RELBIT, code); });
+        if (caps.abs_bits.any()) ioctl(ufd_, UI_SET_EVBIT, EV_ABS);
+        caps.abs_bits.for_each([&](const int code) {
+            uinput_abs_setup abs{};
+            abs.code = static_cast<uint16_t>(code);
+            abs.absinfo = caps.abs_info[code];
+            ioctl(ufd_, UI_ABS_SETUP, &abs);
+        });
+
+        uinput_setup setup{};
+        setup.id.bustype = BUS_VIRTUAL;
+        setup.id.vendor = VENDOR_ID;
+        setup.id.product = PRODUCT_ID;
+        strncpy(setup.name, caps.name.c_str(), sizeof(setup.name) - 1);
+        char sysname[64] = {};
+        if (ioctl(ufd_, UI_DEV_SETUP, &setup) < 0 || ioctl(ufd_, UI_DEV_CREATE) < 0 ||
+            ioctl(ufd_, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+            destroy();
+            return;
+        }
+
+        const std::string sys_path = "/sys/devices/virtual/input/" + std::string(sysname);
+        /* udev creates the node and fixes its permissions asynchronously */
+        for (int attempt = 0; attempt < 100 && event_name_.empty(); ++attempt) {
+            if (DIR *dir = opendir(sys_path.c_str())) {
+                while (const dirent *entry = readdir(dir)) {
+                    if (std::string(entry->d_name).starts_with("event")) {
+                        const std::string name = entry->d_name;
+                        if (const int fd = open(("/dev/input/" + name).c_str(), O_RDONLY | O_CLOEXEC); fd >= 0) {
+                            uid_ = DeviceUtils::generate_uid(fd);
+                            close(fd);
+                            event_name_ = name;
+                        }
+                    }
+                }
+                closedir(dir);
+            }
+            if (event_name_.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (event_name_.empty()) destroy();
+    }
+
+    ~UinputDevice() { destroy(); }
+
+    UinputDevice(const UinputDevice &) = delete;
+
+    UinputDevice &operator=(const UinputDevice &) = delete;
+
+    [[nodiscard]] bool ok() const { return ufd_ >= 0; }
+
+    [[nodiscard]] const std::string &event_name() const { return event_name_; }
+
+    [[nodiscard]] std::string dev_path() const { return "/dev/input/" + event_name_; }
+
+    [[nodiscard]] uint32_t uid() const { return uid_; }
+
+    /**
+     *  Writes the events in one go, uinput accepts any number per write(). Returns false on a short write.
+     */
+    bool write_events(const input_event *events, const size_t count) const {
+        const auto size = static_cast<ssize_t>(count * sizeof(input_event));
+        return write(ufd_, events, size) == size;
+    }
+
+    static input_event event(const uint16_t type, const uint16_t code, const int32_t value) {
+        input_event ev{};
+        ev.type = type;
+        ev.code = code;
+        ev.value = value;
+        return ev;
+    }
+
+    bool emit(const uint16_t type, const uint16_t code, const int32_t value) const {
+        const input_event ev = event(type, code, value);
+        return write_events(&ev, 1);
+    }
+
+    /* A key edge followed by its SYN_REPORT */
+    bool emit_key(const uint16_t code, const bool down) const {
+        return emit(EV_KEY, code, down ? 1 : 0) && emit(EV_SYN, SYN_REPORT, 0);
+    }
+
+    void destroy() {
+        if (ufd_ < 0) return;
+        ioctl(ufd_, UI_DEV_DESTROY);
+        close(ufd_);
+        ufd_ = -1;
+    }
+
+private:
+    int ufd_ = -1;
+    std::string event_name_;
+    uint32_t uid_ = 0;
+};
+
+#endif // UINPUTDEVICE_H
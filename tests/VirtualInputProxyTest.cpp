@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "server/device/EventLoop.h"
+#include "server/device/HotplugMonitor.h"
+#include "server/device/VirtualInputProxy.h"
+#include "server/stats/ServerStats.h"
+#include "UinputDevice.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+    DeviceCapabilities ptt_keyboard_caps() {
+        DeviceCapabilities caps;
+        caps.name = "PTT Test Keyboard";
+        for (int code = KEY_ESC; code <= KEY_KPDOT; ++code) caps.key_bits.set(code);
+        caps.key_bits.set(KEY_F13);
+        caps.num_keys = static_cast<int>(caps.key_bits.count());
+        return caps;
+    }
+
+    DeviceSetup setup_for(const UinputDevice &device, const int target_key, const bool exclusive) {
+        DeviceSetup setup{};
+        setup.vendor_id = UinputDevice::VENDOR_ID;
+        setup.product_id = UinputDevice::PRODUCT_ID;
+        setup.uid = device.uid();
+        setup.target_key = target_key;
+        setup.exclusive = exclusive;
+        return setup;
+    }
+}
+
+class VirtualInputProxyTest : public testing::Test {
+protected:
+    EventLoop loop;
+    std::unique_ptr<VirtualInputProxy> proxy;
+    VirtualInputProxy::SubscriberId subscriber = 0;
+
+    std::mutex mutex;
+    std::condition_variable edge_seen;
+    std::vector<std::pair<int, bool> > edges;
+
+    void SetUp() override {
+        loop.start();
+        proxy = std::make_unique<VirtualInputProxy>(loop);
+        subscriber = proxy->add_subscriber([this](const int key, const bool state, uint64_t) {
+            std::lock_guard lock(mutex);
+            edges.emplace_back(key, state);
+            edge_seen.notify_all();
+        });
+        proxy->start();
+    }
+
+    void TearDown() override {
+        proxy.reset();
+        loop.stop();
+    }
+
+    bool attached(const UinputDevice &device) const {
+        return proxy->device_stats().find("device " + device.dev_path() + " ") != std::string::npos;
+    }
+
+    /* Hotplug and detach are asynchronous, so state is polled for a bounded time */
+    template<typename Predicate>
+    static bool eventually(Predicate predicate, const std::chrono::milliseconds timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!predicate()) {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(10ms);
+        }
+        return true;
+    }
+
+    bool wait_for_edge(const int key, const bool state) {
+        std::unique_lock lock(mutex);
+        return edge_seen.wait_for(lock, 2s, [&] {
+            return std::ranges::find(edges, std::make_pair(key, state)) != edges.end();
+        });
+    }
+};
+
+TEST_F(VirtualInputProxyTest, HotplugAttachesAndDetachesDevice) {
+    auto device = std::make_unique<UinputDevice>(ptt_keyboard_caps());
+    if (!device->ok()) GTEST_SKIP() << "uinput is not available";
+    {
+        HotplugMonitor probe(loop);
+        if (!probe.start([](HotplugMonitor::Action, const std::string &) {})) {
+            GTEST_SKIP() << "kernel uevents are not available";
+        }
+        probe.stop();
+    }
+
+    const DeviceSetup setup = setup_for(*device, KEY_F13, false);
+    proxy->add_device(setup, subscriber);
+    ASSERT_TRUE(attached(*device));
+    ASSERT_TRUE(device->emit_key(KEY_F13, true));
+    EXPECT_TRUE(wait_for_edge(KEY_F13, true));
+
+    /* Unplugging releases the device and leaves the config waiting for it */
+    const std::string unplugged_path = device->dev_path();
+    device.reset();
+    ASSERT_TRUE(eventually([&] {
+        const std::string stats = proxy->device_stats();
+        return stats.find("device " + unplugged_path + " ") == std::string::npos &&
+               stats.find("waiting ") != std::string::npos;
+    }, 2s));
+
+    /* Well within the 5 s retry interval, so only the hotplug add can have attached it */
+    const auto replugged = std::make_unique<UinputDevice>(ptt_keyboard_caps());
+    ASSERT_TRUE(replugged->ok());
+    ASSERT_EQ(replugged->uid(), setup.uid);
+    ASSERT_TRUE(eventually([&] { return attached(*replugged); }, 2s));
+
+    {
+        std::lock_guard lock(mutex);
+        edges.clear();
+    }
+    ASSERT_TRUE(replugged->emit_key(KEY_F13, true));
+    EXPECT_TRUE(wait_for_edge(KEY_F13, true));
+    EXPECT_EQ(proxy->device_stats().find("waiting "), std::string::npos);
+}
+
+TEST_F(VirtualInputProxyTest, SynDroppedResyncReportsLostPress) {
+    const UinputDevice device(ptt_keyboard_caps());
+    if (!device.ok()) GTEST_SKIP() << "uinput is not available";
+
+    /* Exclusive, so KEY_A is not masked away by EVIOCSMASK and reaches the evdev buffer */
+    proxy->add_device(setup_for(device, KEY_F13, true), subscriber);
+    ASSERT_TRUE(attached(device));
+    const uint64_t syn_dropped_before = ServerStats::instance().syn_dropped.load();
+
+    /* Stall the loop so nothing drains the device while it is flooded */
+    std::promise<void> release;
+    std::promise<void> stalled;
+    loop.post([&] {
+        stalled.set_value();
+        release.get_future().wait();
+    });
+    stalled.get_future().wait();
+
+    /* The press is queued first, so the overrun discards it along with the older part of the flood */
+    ASSERT_TRUE(device.emit_key(KEY_F13, true));
+    std::vector<input_event> flood;
+    for (int i = 0; i < 4096; ++i) {
+        flood.push_back(UinputDevice::event(EV_KEY, KEY_A, i % 2 == 0 ? 1 : 0));
+        flood.push_back(UinputDevice::event(EV_SYN, SYN_REPORT, 0));
+    }
+    ASSERT_TRUE(device.write_events(flood.data(), flood.size()));
+    release.set_value();
+
+    EXPECT_TRUE(wait_for_edge(KEY_F13, true));
+    EXPECT_GT(ServerStats::instance().syn_dropped.load(), syn_dropped_before);
+}